@@ -0,0 +1,2469 @@
+#include <cstdio>
+#include <concepts>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <string_view>
+#include <initializer_list>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <linux/io_uring.h>
+
+using uint8 = unsigned char;
+using int32 = int;
+using uint32 = unsigned int;
+using int64 = long long int;
+using uint64 = long long unsigned int;
+using std::nullptr_t;
+using std::size_t;
+
+#define nassert(...)
+
+namespace Nickel::System::Runtime::Alchemy
+{
+    struct TypeId
+    {
+        static constexpr uint32 Invalid = 0;
+        static constexpr uint32 Type = 1;
+        static constexpr uint32 Null = 2;
+        static constexpr uint32 Bool = 3;
+        static constexpr uint32 Int = 4;
+        static constexpr uint32 UInt = 5;
+        static constexpr uint32 Float = 6;
+        static constexpr uint32 Double = 7;
+
+        uint32 value;
+
+        constexpr TypeId()
+            : value( Invalid )
+        {
+        }
+
+        constexpr TypeId( uint32 value )
+            : value( value )
+        {
+        }
+
+        explicit operator uint32() const { return value; }
+        explicit operator bool() const { return value != 0; }
+
+        static constexpr const char* getName( uint32 type_id )
+        {
+            switch( type_id )
+            {
+                case Type: return "type";
+                case Null: return "null";
+                case Bool: return "bool";
+                case Int: return "int";
+                case UInt: return "uint";
+                case Float: return "float";
+                case Double: return "double";
+            }
+
+            return "(invalid)";
+        }
+    };
+
+    class Value
+    {
+        // tagged value layouts
+
+        // short layout ( 32bit )
+        // type: 0xffff0000 + 32bit type id
+        // null: 0xffff0001 + 00000000
+        // bool(true): 0xffff0002 + 00000001
+        // bool(false): 0xffff0002 + 00000000
+        // int: 0xffff0003 + 32bit payload
+        // uint: 0xffff0004 + 32bit payload
+        // float: 0xffff0005 + 32bit payload
+
+        // reference layout ( 48bit )
+        // reference: 0x0000 + 48bit payload(pointer)
+        // reference include string, tuple, array, function, object, cfunction, cobject
+
+        // long layout ( 64bit )
+        // double: range( 0x0001, 0xfffe ) + ( native_double_value + 0x0001000000000000 );
+
+        static constexpr uint64 LayoutMask = 0xffff000000000000;
+        static constexpr uint64 ShortLayout = 0xffff000000000000;
+        static constexpr uint64 ReferenceLayout = 0x0000000000000000;
+        
+        static constexpr uint64 LongValueTagMask = 0xffff000000000000;
+        static constexpr uint32 ReferenceTag = 0x0000000000000000;
+
+        static constexpr uint32 TypeIdTag = 0xffff0000;
+        static constexpr uint32 NullTag = 0xffff0001;
+        static constexpr uint32 BoolTag = 0xffff0002;
+        static constexpr uint32 IntTag = 0xffff0003;
+        static constexpr uint32 UIntTag = 0xffff0004;
+        static constexpr uint32 FloatTag = 0xffff0005;
+        
+        static constexpr uint64 DoubleEncodingOffset = 0x0001000000000000;
+        static constexpr uint64 ReferenceEncodingMask = 0x0000ffffffffffff;
+
+    public:
+        static constexpr uint64 InvalidType = TypeIdTag | TypeId::Invalid;
+        static constexpr uint64 TypeType = TypeIdTag | TypeId::Type;
+        static constexpr uint64 NullType = TypeIdTag | TypeId::Null;
+        static constexpr uint64 BoolType = TypeIdTag | TypeId::Bool;
+        static constexpr uint64 IntType = TypeIdTag | TypeId::Int;
+        static constexpr uint64 UIntType = TypeIdTag | TypeId::UInt;
+        static constexpr uint64 FloatType = TypeIdTag | TypeId::Float;
+        static constexpr uint64 DoubleType = TypeIdTag | TypeId::Double;
+
+        static constexpr uint64 NullValue = NullTag;
+        static constexpr uint64 TrueValue = BoolTag | 0x00000001;
+        static constexpr uint64 FalseValue = BoolTag | 0x00000000;
+
+    private:
+        union
+        {
+            uint64 data;
+
+            struct
+            {
+                union
+                {
+                    TypeId type_id;
+                    int32 int_value;
+                    uint32 uint_value;
+                    float float_value;
+                } value;
+
+                uint32 tag;
+
+            } short_layout;
+
+            struct
+            {
+                union
+                {
+                    double double_value;
+                    uint64 double_data;
+                } value;
+            } double_layout;
+
+            struct
+            {
+                void* reference_value;
+            } reference_layout;
+        };
+
+        static inline constexpr Value encodeDouble( double value )
+        {
+            Value v;
+            v.double_layout.value.double_value = value;
+            v.double_layout.value.double_data += DoubleEncodingOffset;
+
+            return v;
+        }
+
+        static inline constexpr double decodeDouble( Value value )
+        {
+            value.double_layout.value.double_data -= DoubleEncodingOffset;
+            return value.double_layout.value.double_value;
+        }
+
+    public:
+        constexpr Value()
+            : data { NullValue }
+        {
+        }
+
+        constexpr Value( uint64 data )
+            : data( data )
+        {
+        }
+
+        constexpr Value( TypeId value )
+        {
+            setTypeId( value );
+        }
+
+        constexpr Value( nullptr_t )
+        {
+            setNull();
+        }
+
+        constexpr Value( bool value )
+        {
+            setBool( value );
+        }
+
+        constexpr Value( int32 value )
+        {
+            setInt( value );
+        }
+
+        constexpr Value( uint32 value )
+        {
+            setUInt( value );
+        }
+
+        constexpr Value( float value )
+        {
+            setFloat( value );
+        }
+
+        constexpr Value( void* value )
+        {
+            setReference( value );
+        }
+
+        constexpr Value( double value )
+        {
+            setDouble( value );
+        }
+
+        explicit operator nullptr_t() const { nassert( isNull() ); return nullptr; }
+        explicit operator bool() const { nassert( isBool() ); return getBool(); }
+        //explicit operator int32() const { nassert( isInt() ); return getInt(); }
+        explicit operator uint32() const { nassert( isUInt() ); return getUInt(); }
+        explicit operator float() const { nassert( isFloat() ); return getFloat(); }
+        explicit operator void*() const { nassert( isReference() ); return getReference(); }
+        explicit operator double() const { nassert( isDouble() ); return getDouble(); }
+
+        inline constexpr bool isShortLayout() const { return ( data & LayoutMask ) == ShortLayout; }
+        inline constexpr bool isReferenceLayout() const { return ( data & LayoutMask ) == ReferenceLayout; }
+        inline constexpr bool isDoubleLayout() const { return !isShortLayout() && !isReferenceLayout(); }
+
+        inline constexpr bool isTypeId() const { return short_layout.tag == TypeIdTag; }
+        inline constexpr void setTypeId( TypeId value ) { short_layout = { { .type_id = value }, TypeIdTag }; }
+        inline constexpr TypeId getTypeId() const { return short_layout.value.type_id; }
+
+        inline constexpr bool isNull() const { return short_layout.tag == NullTag; }
+        inline constexpr void setNull() { data = NullValue; }
+        inline constexpr nullptr_t getNull() { return nullptr; }
+
+        inline constexpr bool isBool() const { return short_layout.tag == BoolTag; }
+        inline constexpr void setBool( bool value ) { data = value ? TrueValue : FalseValue; }
+        inline constexpr bool getBool() const { return data == TrueValue; }
+        inline constexpr void setTrue() { data = TrueValue; }
+        inline constexpr void setFalse() { data = FalseValue; }
+        inline constexpr bool isTrue() const { return data == TrueValue; }
+        inline constexpr bool isFalse() const { return data == FalseValue; }
+
+        inline constexpr bool isInt() const { return short_layout.tag == IntTag; }
+        inline constexpr void setInt( int32 value ) { short_layout = { { .int_value = value }, IntTag }; }
+        inline constexpr int32 getInt() const { return short_layout.value.int_value; }
+
+        inline constexpr bool isUInt() const { return short_layout.tag == UIntTag; }
+        inline constexpr void setUInt( uint32 value ) { short_layout = { { .uint_value = value }, UIntTag }; }
+        inline constexpr uint32 getUInt() const { return short_layout.value.uint_value; }
+
+        inline constexpr bool isFloat() const { return short_layout.tag == FloatTag; }
+        inline constexpr void setFloat( float value ) { short_layout = { { .float_value = value }, FloatTag }; }
+        inline constexpr float getFloat() const { return short_layout.value.float_value; }
+
+        inline constexpr bool isReference() const { return isReferenceLayout(); }
+        inline constexpr void setReference( void* value ) { reference_layout.reference_value = value; }
+        inline constexpr void* getReference() const { return reference_layout.reference_value; }
+
+        inline constexpr bool isDouble() const { return isDoubleLayout(); }
+        inline constexpr void setDouble( double value ) { *this = encodeDouble( value ); }
+        inline constexpr double getDouble() const { return decodeDouble( *this ); }
+
+        inline constexpr bool isNumeric() const { return isInt() || isUInt() || isFloat() || isDouble(); }
+        inline constexpr bool isValid() const { return data != InvalidType; }
+
+        inline constexpr TypeId getType() const
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return TypeId::Type;
+                    case NullTag:
+                        return TypeId::Null;
+                    case BoolTag:
+                        return TypeId::Bool;
+                    case IntTag:
+                        return TypeId::Int;
+                    case UIntTag:
+                        return TypeId::UInt;
+                    case FloatTag:
+                        return TypeId::Float;
+                    default:
+                        return TypeId::Invalid;
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                // TODO: implement abstract type deduction, do not support abstract value for now
+                return TypeId::Invalid;
+            }
+            
+            return TypeId::Double;
+        }
+
+        template<typename F>
+        constexpr auto apply( F f )
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return f( getTypeId() );
+                    case NullTag:
+                        return f( getNull() );
+                    case IntTag:
+                        return f( getInt() );
+                    case UIntTag:
+                        return f( getUInt() );
+                    case FloatTag:
+                        return f( getFloat() );
+                    default:
+                    {
+                        nassert( false, "Value", "Invalid tag, value corruption detected" );
+                        // return as if value is null
+                        return f( getNull() );
+                    }
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                return f( getReference() );
+            }
+
+            return f( getDouble() );
+        }
+    };
+
+    // value stacks are chains of heap segments, so a suspended script only pins the segments it uses
+    struct ValueSegment
+    {
+        static constexpr size_t Capacity = 1024;
+
+        ValueSegment* previous;
+        Value* end;
+        Value values[ Capacity ];
+    };
+
+    struct ValueStack
+    {
+        ValueSegment* segment;
+        Value* top;
+        Value* end;
+    };
+
+    // header of an isolate heap chunk or of an allocation too large for one, the bytes follow it
+    struct alignas( 16 ) HeapBlock
+    {
+        HeapBlock* previous;
+    };
+
+    // the heap memory of one script, filled by bump allocation and handed back whole once the script finishes
+    struct HeapRegion
+    {
+        HeapBlock* chunks;
+        HeapBlock* large_blocks;
+        unsigned char* cursor;
+        unsigned char* end;
+    };
+
+    // isolate owns everything a script touches: a bump allocated heap and the active value stack
+    // nothing inside an isolate is shared, so scripts never synchronize with each other
+    class Isolate
+    {
+    public:
+        static constexpr size_t HeapChunkSize = 1024 * 1024;
+
+        Isolate()
+            : stack { nullptr, nullptr, nullptr }
+            , free_segments( nullptr )
+            , heap { nullptr, nullptr, nullptr, nullptr }
+            , free_chunks( nullptr )
+        {
+        }
+
+        ~Isolate()
+        {
+            while( free_segments != nullptr )
+            {
+                ValueSegment* segment = free_segments;
+                free_segments = segment->previous;
+                delete segment;
+            }
+
+            resetHeap();
+            while( free_chunks != nullptr )
+            {
+                HeapBlock* chunk = free_chunks;
+                free_chunks = chunk->previous;
+                ::operator delete( chunk );
+            }
+        }
+
+        Isolate( const Isolate& ) = delete;
+        Isolate& operator=( const Isolate& ) = delete;
+
+        inline void push( Value value )
+        {
+            if( stack.top == stack.end )
+            {
+                pushSegment();
+            }
+            *stack.top++ = value;
+        }
+
+        // stack.top only rests on a segment start in the first segment, so top() never crosses segments
+        inline Value pop()
+        {
+            nassert( stack.top > stack.segment->values );
+            Value value = *--stack.top;
+            if( stack.top == stack.segment->values && stack.segment->previous != nullptr )
+            {
+                popSegment();
+            }
+            return value;
+        }
+
+        inline Value& top() { return stack.top[ -1 ]; }
+
+        // fibers swap their stack in and out on every switch
+        inline void swapStack( ValueStack& other ) { std::swap( stack, other ); }
+
+        ValueStack acquireStack()
+        {
+            ValueSegment* segment = acquireSegment( nullptr );
+            return { segment, segment->values, segment->end };
+        }
+
+        void releaseStack( ValueStack& released )
+        {
+            ValueSegment* segment = released.segment;
+            while( segment != nullptr )
+            {
+                ValueSegment* previous = segment->previous;
+                segment->previous = free_segments;
+                free_segments = segment;
+                segment = previous;
+            }
+            released = { nullptr, nullptr, nullptr };
+        }
+
+        void* allocate( size_t size )
+        {
+            size = ( size + 15 ) & ~size_t( 15 );
+            if( size > HeapChunkSize )
+            {
+                // would not fit any chunk, gets a block of its own that lives as long as the region
+                HeapBlock* block = static_cast<HeapBlock*>( ::operator new( sizeof( HeapBlock ) + size ) );
+                block->previous = heap.large_blocks;
+                heap.large_blocks = block;
+                return block + 1;
+            }
+
+            if( heap.cursor == nullptr || heap.cursor + size > heap.end )
+            {
+                nextChunk();
+            }
+
+            void* result = heap.cursor;
+            heap.cursor += size;
+            return result;
+        }
+
+        // fibers swap their heap region in and out with their stack, so every script allocates into chunks of its own
+        inline void swapHeap( HeapRegion& other ) { std::swap( heap, other ); }
+
+        // only valid once nothing points into the region, its chunks are kept so a warm isolate never hits malloc again
+        void releaseHeap( HeapRegion& released )
+        {
+            while( released.chunks != nullptr )
+            {
+                HeapBlock* chunk = released.chunks;
+                released.chunks = chunk->previous;
+                chunk->previous = free_chunks;
+                free_chunks = chunk;
+            }
+
+            while( released.large_blocks != nullptr )
+            {
+                HeapBlock* block = released.large_blocks;
+                released.large_blocks = block->previous;
+                ::operator delete( block );
+            }
+
+            released = { nullptr, nullptr, nullptr, nullptr };
+        }
+
+        // releases the region that is swapped in
+        void resetHeap() { releaseHeap( heap ); }
+
+    private:
+        ValueSegment* acquireSegment( ValueSegment* previous )
+        {
+            ValueSegment* segment = free_segments;
+            if( segment != nullptr )
+            {
+                free_segments = segment->previous;
+            }
+            else
+            {
+                segment = new ValueSegment;
+                segment->end = segment->values + ValueSegment::Capacity;
+            }
+
+            segment->previous = previous;
+            return segment;
+        }
+
+        void pushSegment()
+        {
+            ValueSegment* segment = acquireSegment( stack.segment );
+            stack = { segment, segment->values, segment->end };
+        }
+
+        void popSegment()
+        {
+            ValueSegment* segment = stack.segment;
+            stack = { segment->previous, segment->previous->end, segment->previous->end };
+
+            segment->previous = free_segments;
+            free_segments = segment;
+        }
+
+        void nextChunk()
+        {
+            HeapBlock* chunk = free_chunks;
+            if( chunk != nullptr )
+            {
+                free_chunks = chunk->previous;
+            }
+            else
+            {
+                chunk = static_cast<HeapBlock*>( ::operator new( sizeof( HeapBlock ) + HeapChunkSize ) );
+            }
+
+            chunk->previous = heap.chunks;
+            heap.chunks = chunk;
+            heap.cursor = reinterpret_cast<unsigned char*>( chunk + 1 );
+            heap.end = heap.cursor + HeapChunkSize;
+        }
+
+        ValueStack stack;
+        ValueSegment* free_segments;
+
+        HeapRegion heap;
+        HeapBlock* free_chunks;
+    };
+
+    // the submitter owns the task, it must stay alive until Scheduler::wait returns
+    // result must not reference isolate memory, the heap region of a script is recycled as soon as it finishes
+    // slice_budget bounds how many time slices the script may be preempted for before it is aborted, 0 never aborts
+    struct ScriptTask
+    {
+        using Entry = Value (*)( Isolate& isolate, Value argument );
+
+        Entry entry;
+        Value argument;
+        Value result;
+        uint32 slice_budget = 0;
+    };
+
+    // Chase-Lev deque, the owning worker pushes and pops at the bottom, thieves steal from the top
+    class WorkStealingDeque
+    {
+    public:
+        static constexpr int64 Capacity = 4096;
+        static constexpr int64 Mask = Capacity - 1;
+
+        WorkStealingDeque()
+            : top( 0 )
+            , bottom( 0 )
+        {
+        }
+
+        bool push( ScriptTask* task )
+        {
+            int64 b = bottom.load( std::memory_order_relaxed );
+            int64 t = top.load( std::memory_order_acquire );
+            if( b - t >= Capacity )
+            {
+                return false;
+            }
+
+            buffer[ b & Mask ].store( task, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+            bottom.store( b + 1, std::memory_order_relaxed );
+            return true;
+        }
+
+        ScriptTask* pop()
+        {
+            int64 b = bottom.load( std::memory_order_relaxed ) - 1;
+            bottom.store( b, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            int64 t = top.load( std::memory_order_relaxed );
+
+            if( t > b )
+            {
+                bottom.store( b + 1, std::memory_order_relaxed );
+                return nullptr;
+            }
+
+            ScriptTask* task = buffer[ b & Mask ].load( std::memory_order_relaxed );
+            if( t == b )
+            {
+                // last element, race against thieves for it
+                if( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+                {
+                    task = nullptr;
+                }
+                bottom.store( b + 1, std::memory_order_relaxed );
+            }
+
+            return task;
+        }
+
+        ScriptTask* steal()
+        {
+            int64 t = top.load( std::memory_order_acquire );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            int64 b = bottom.load( std::memory_order_acquire );
+
+            if( t >= b )
+            {
+                return nullptr;
+            }
+
+            ScriptTask* task = buffer[ t & Mask ].load( std::memory_order_relaxed );
+            if( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+            {
+                return nullptr;
+            }
+
+            return task;
+        }
+
+        bool isEmpty() const
+        {
+            return bottom.load( std::memory_order_relaxed ) <= top.load( std::memory_order_relaxed );
+        }
+
+    private:
+        alignas( 64 ) std::atomic<int64> top;
+        alignas( 64 ) std::atomic<int64> bottom;
+        alignas( 64 ) std::atomic<ScriptTask*> buffer[ Capacity ];
+    };
+
+#if !defined( __x86_64__ )
+#error "fiber context switch is only implemented for x86-64"
+#endif
+
+    class Fiber;
+
+    // saves callee saved registers on the current stack, stores the stack pointer and continues on another stack
+    extern "C" void alchemy_switch_context( void** save_stack_pointer, void* load_stack_pointer );
+    extern "C" void alchemy_fiber_entry();
+    extern "C" void alchemy_fiber_main( Fiber* fiber );
+
+    asm( R"(
+        .text
+        .globl alchemy_switch_context
+        .type alchemy_switch_context, @function
+    alchemy_switch_context:
+        pushq %rbp
+        pushq %rbx
+        pushq %r12
+        pushq %r13
+        pushq %r14
+        pushq %r15
+        movq %rsp, (%rdi)
+        movq %rsi, %rsp
+        popq %r15
+        popq %r14
+        popq %r13
+        popq %r12
+        popq %rbx
+        popq %rbp
+        ret
+        .size alchemy_switch_context, .-alchemy_switch_context
+
+        .globl alchemy_fiber_entry
+        .type alchemy_fiber_entry, @function
+    alchemy_fiber_entry:
+        movq %r12, %rdi
+        andq $-16, %rsp
+        call alchemy_fiber_main
+        ud2
+        .size alchemy_fiber_entry, .-alchemy_fiber_entry
+    )" );
+
+    struct FiberLink
+    {
+        std::atomic<FiberLink*> next;
+    };
+
+    class Scheduler;
+
+    // a fiber is a native stack plus a segmented value stack, reused across tasks by its owning worker
+    class Fiber : public FiberLink
+    {
+    public:
+        static constexpr size_t NativeStackSize = 64 * 1024;
+        static constexpr size_t GuardSize = 4096;
+
+        Fiber( Scheduler* scheduler, uint32 worker_index )
+            : stack_pointer( nullptr )
+            , value_stack { nullptr, nullptr, nullptr }
+            , heap { nullptr, nullptr, nullptr, nullptr }
+            , task( nullptr )
+            , scheduler( scheduler )
+            , worker_index( worker_index )
+            , next_free( nullptr )
+            , slices_used( 0 )
+            , finished( false )
+        {
+            next.store( nullptr, std::memory_order_relaxed );
+
+            // guard page below the stack turns an overflow into a fault instead of silent corruption
+            void* mapping = mmap( nullptr, GuardSize + NativeStackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+            if( mapping == MAP_FAILED || mprotect( mapping, GuardSize, PROT_NONE ) != 0 )
+            {
+                // out of address space or mappings, the caller fails the task instead of running it on this fiber
+                if( mapping != MAP_FAILED )
+                {
+                    munmap( mapping, GuardSize + NativeStackSize );
+                }
+                native_stack = nullptr;
+                return;
+            }
+            native_stack = static_cast<unsigned char*>( mapping );
+
+            // initial frame matches what alchemy_switch_context pops: r15 r14 r13 r12 rbx rbp, then the return address
+            uint64* top = reinterpret_cast<uint64*>( native_stack + GuardSize + NativeStackSize );
+            top[ -1 ] = 0;
+            top[ -2 ] = reinterpret_cast<uint64>( &alchemy_fiber_entry );
+            top[ -3 ] = 0;
+            top[ -4 ] = 0;
+            top[ -5 ] = reinterpret_cast<uint64>( this );
+            top[ -6 ] = 0;
+            top[ -7 ] = 0;
+            top[ -8 ] = 0;
+            stack_pointer = top - 8;
+        }
+
+        ~Fiber()
+        {
+            if( native_stack != nullptr )
+            {
+                munmap( native_stack, GuardSize + NativeStackSize );
+            }
+        }
+
+        Fiber( const Fiber& ) = delete;
+        Fiber& operator=( const Fiber& ) = delete;
+
+        inline bool isValid() const { return native_stack != nullptr; }
+
+    private:
+        friend class Scheduler;
+        friend void alchemy_fiber_main( Fiber* fiber );
+
+        void* stack_pointer;
+        unsigned char* native_stack;
+        ValueStack value_stack;
+        HeapRegion heap;
+        ScriptTask* task;
+
+        Scheduler* scheduler;
+        uint32 worker_index;
+
+        Fiber* next_free;
+        uint32 slices_used;
+        bool finished;
+    };
+
+    // intrusive multi producer single consumer queue (Vyukov), any thread resumes, only the owner pops
+    class FiberQueue
+    {
+    public:
+        FiberQueue()
+            : head( &stub )
+            , tail( &stub )
+        {
+            stub.next.store( nullptr, std::memory_order_relaxed );
+        }
+
+        FiberQueue( const FiberQueue& ) = delete;
+        FiberQueue& operator=( const FiberQueue& ) = delete;
+
+        void push( FiberLink* link )
+        {
+            link->next.store( nullptr, std::memory_order_relaxed );
+            FiberLink* previous = head.exchange( link, std::memory_order_acq_rel );
+            previous->next.store( link, std::memory_order_release );
+        }
+
+        // may report empty while a push is halfway through, the pusher wakes the owner afterwards
+        Fiber* pop()
+        {
+            FiberLink* first = tail;
+            FiberLink* next = first->next.load( std::memory_order_acquire );
+
+            if( first == &stub )
+            {
+                if( next == nullptr )
+                {
+                    return nullptr;
+                }
+
+                tail = next;
+                first = next;
+                next = next->next.load( std::memory_order_acquire );
+            }
+
+            if( next != nullptr )
+            {
+                tail = next;
+                return static_cast<Fiber*>( first );
+            }
+
+            if( first != head.load( std::memory_order_acquire ) )
+            {
+                return nullptr;
+            }
+
+            push( &stub );
+            next = first->next.load( std::memory_order_acquire );
+            if( next != nullptr )
+            {
+                tail = next;
+                return static_cast<Fiber*>( first );
+            }
+
+            return nullptr;
+        }
+
+    private:
+        alignas( 64 ) std::atomic<FiberLink*> head;
+        alignas( 64 ) FiberLink* tail;
+        FiberLink stub;
+    };
+
+    // minimal io_uring wrapper over the raw syscalls, one per worker so no ring is ever shared
+    // sqes are queued while scripts run and handed to the kernel together once per scheduler iteration
+    class IoRing
+    {
+    public:
+        static constexpr uint32 Entries = 256;
+
+        IoRing()
+            : ring_fd( -1 )
+            , sq_ring( MAP_FAILED )
+            , cq_ring( MAP_FAILED )
+            , sqes( static_cast<io_uring_sqe*>( MAP_FAILED ) )
+            , sqe_tail( 0 )
+        {
+            io_uring_params params;
+            memset( &params, 0, sizeof( params ) );
+
+            ring_fd = static_cast<int>( syscall( __NR_io_uring_setup, Entries, &params ) );
+            if( ring_fd < 0 )
+            {
+                return;
+            }
+
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof( uint32 );
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+            bool single_mmap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+            if( single_mmap )
+            {
+                sq_ring_size = cq_ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+            }
+
+            sq_ring = mmap( nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING );
+            cq_ring = single_mmap ? sq_ring : mmap( nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING );
+            sqes = static_cast<io_uring_sqe*>( mmap( nullptr, params.sq_entries * sizeof( io_uring_sqe ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES ) );
+            sqe_count = params.sq_entries;
+
+            if( sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED )
+            {
+                release();
+                return;
+            }
+
+            unsigned char* sq = static_cast<unsigned char*>( sq_ring );
+            unsigned char* cq = static_cast<unsigned char*>( cq_ring );
+            sq_head = reinterpret_cast<uint32*>( sq + params.sq_off.head );
+            sq_tail = reinterpret_cast<uint32*>( sq + params.sq_off.tail );
+            sq_mask = *reinterpret_cast<uint32*>( sq + params.sq_off.ring_mask );
+            cq_head = reinterpret_cast<uint32*>( cq + params.cq_off.head );
+            cq_tail = reinterpret_cast<uint32*>( cq + params.cq_off.tail );
+            cq_mask = *reinterpret_cast<uint32*>( cq + params.cq_off.ring_mask );
+            cqes = reinterpret_cast<io_uring_cqe*>( cq + params.cq_off.cqes );
+
+            // identity index array, sqes are consumed in the order they were filled
+            uint32* sq_array = reinterpret_cast<uint32*>( sq + params.sq_off.array );
+            for( uint32 i = 0; i < params.sq_entries; ++i )
+            {
+                sq_array[ i ] = i;
+            }
+
+            sqe_tail = *sq_tail;
+        }
+
+        ~IoRing()
+        {
+            release();
+        }
+
+        IoRing( const IoRing& ) = delete;
+        IoRing& operator=( const IoRing& ) = delete;
+
+        // false when the kernel or a seccomp policy refuses io_uring, callers then fall back to blocking syscalls
+        bool isValid() const { return ring_fd >= 0; }
+
+        // flushes queued sqes first when the submission ring is full
+        io_uring_sqe* getSqe()
+        {
+            if( sqe_tail - std::atomic_ref<uint32>( *sq_head ).load( std::memory_order_acquire ) == sqe_count )
+            {
+                submit( 0 );
+                if( sqe_tail - std::atomic_ref<uint32>( *sq_head ).load( std::memory_order_acquire ) == sqe_count )
+                {
+                    return nullptr;
+                }
+            }
+
+            io_uring_sqe* sqe = &sqes[ sqe_tail & sq_mask ];
+            ++sqe_tail;
+            memset( sqe, 0, sizeof( *sqe ) );
+            return sqe;
+        }
+
+        bool hasUnsubmitted() const
+        {
+            return sqe_tail != std::atomic_ref<uint32>( *sq_head ).load( std::memory_order_acquire );
+        }
+
+        // a single io_uring_enter covers every sqe queued since the last call, and optionally blocks for completions
+        int submit( uint32 wait_count )
+        {
+            std::atomic_ref<uint32>( *sq_tail ).store( sqe_tail, std::memory_order_release );
+            uint32 to_submit = sqe_tail - std::atomic_ref<uint32>( *sq_head ).load( std::memory_order_acquire );
+            if( to_submit == 0 && wait_count == 0 )
+            {
+                return 0;
+            }
+
+            int result;
+            do
+            {
+                result = static_cast<int>( syscall( __NR_io_uring_enter, ring_fd, to_submit, wait_count, wait_count != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0 ) );
+            }
+            while( result < 0 && errno == EINTR );
+
+            return result;
+        }
+
+        // completions are read straight from shared memory, no syscall
+        template<typename F>
+        uint32 reap( F f )
+        {
+            uint32 head = *cq_head;
+            uint32 tail = std::atomic_ref<uint32>( *cq_tail ).load( std::memory_order_acquire );
+            uint32 count = tail - head;
+
+            while( head != tail )
+            {
+                f( cqes[ head & cq_mask ] );
+                ++head;
+            }
+
+            std::atomic_ref<uint32>( *cq_head ).store( head, std::memory_order_release );
+            return count;
+        }
+
+    private:
+        void release()
+        {
+            if( sqes != MAP_FAILED )
+            {
+                munmap( sqes, sqe_count * sizeof( io_uring_sqe ) );
+            }
+            if( cq_ring != MAP_FAILED && cq_ring != sq_ring )
+            {
+                munmap( cq_ring, cq_ring_size );
+            }
+            if( sq_ring != MAP_FAILED )
+            {
+                munmap( sq_ring, sq_ring_size );
+            }
+            if( ring_fd >= 0 )
+            {
+                close( ring_fd );
+            }
+
+            ring_fd = -1;
+            sq_ring = cq_ring = MAP_FAILED;
+            sqes = static_cast<io_uring_sqe*>( MAP_FAILED );
+        }
+
+        int ring_fd;
+        void* sq_ring;
+        void* cq_ring;
+        size_t sq_ring_size;
+        size_t cq_ring_size;
+
+        io_uring_sqe* sqes;
+        uint32 sqe_count;
+        uint32 sqe_tail;
+
+        uint32* sq_head;
+        uint32* sq_tail;
+        uint32 sq_mask;
+
+        uint32* cq_head;
+        uint32* cq_tail;
+        uint32 cq_mask;
+        io_uring_cqe* cqes;
+    };
+
+    class Scheduler
+    {
+    public:
+        static constexpr uint32 StealAttempts = 64;
+        static constexpr uint32 BatchSize = 32;
+        static constexpr std::chrono::microseconds TimeSlice { 1000 };
+
+        explicit Scheduler( uint32 worker_count = std::thread::hardware_concurrency() )
+            : pending( 0 )
+            , work_epoch( 0 )
+            , sleeping( 0 )
+            , next_worker( 0 )
+            , stopping( false )
+        {
+            worker_count = worker_count == 0 ? 1 : worker_count;
+            uint32 cpu_count = std::thread::hardware_concurrency();
+
+            for( uint32 i = 0; i < worker_count; ++i )
+            {
+                workers.emplace_back( new Worker( this, i ) );
+            }
+
+            for( uint32 i = 0; i < worker_count; ++i )
+            {
+                Worker& worker = *workers[ i ];
+                worker.thread = std::thread( [&worker] { worker.scheduler->run( worker ); } );
+
+                if( cpu_count != 0 )
+                {
+                    cpu_set_t cpu_set;
+                    CPU_ZERO( &cpu_set );
+                    CPU_SET( i % cpu_count, &cpu_set );
+                    pthread_setaffinity_np( worker.thread.native_handle(), sizeof( cpu_set ), &cpu_set );
+                }
+            }
+
+            timer = std::thread( [this] { runTimer(); } );
+        }
+
+        // workers only exit once every fiber they own has finished
+        ~Scheduler()
+        {
+            stopping.store( true, std::memory_order_seq_cst );
+            wake();
+
+            for( auto& worker : workers )
+            {
+                worker->thread.join();
+            }
+
+            timer.join();
+        }
+
+        Scheduler( const Scheduler& ) = delete;
+        Scheduler& operator=( const Scheduler& ) = delete;
+
+        uint32 getWorkerCount() const { return static_cast<uint32>( workers.size() ); }
+
+        void submit( ScriptTask* task )
+        {
+            pending.fetch_add( 1, std::memory_order_relaxed );
+
+            // tasks spawned by a script stay on the local deque, no lock taken
+            Worker* worker = current_worker;
+            if( worker == nullptr || worker->scheduler != this || !worker->deque.push( task ) )
+            {
+                worker = workers[ next_worker.fetch_add( 1, std::memory_order_relaxed ) % workers.size() ].get();
+
+                std::lock_guard<std::mutex> lock( worker->inbox_mutex );
+                worker->inbox.push_back( task );
+                worker->inbox_pending.store( true, std::memory_order_release );
+            }
+
+            wake();
+        }
+
+        void wait()
+        {
+            uint64 count = pending.load( std::memory_order_acquire );
+            while( count != 0 )
+            {
+                pending.wait( count, std::memory_order_acquire );
+                count = pending.load( std::memory_order_acquire );
+            }
+        }
+
+        // only valid inside a script
+        static Fiber* getCurrentFiber() { return current_fiber; }
+
+        // parks the calling script until someone passes its fiber to resume
+        static void suspend()
+        {
+            Fiber* fiber = current_fiber;
+            nassert( fiber != nullptr, "Scheduler", "suspend called outside of a script" );
+            Worker& worker = *fiber->scheduler->workers[ fiber->worker_index ];
+            alchemy_switch_context( &fiber->stack_pointer, worker.stack_pointer );
+        }
+
+        // the script goes behind every task that is ready or waiting to start, so a loop that keeps yielding
+        // or getting preempted never starves the work queued on its worker
+        static void yield()
+        {
+            Fiber* fiber = current_fiber;
+            Worker& worker = *fiber->scheduler->workers[ fiber->worker_index ];
+
+            fiber->next_free = nullptr;
+            if( worker.yielded_tail != nullptr )
+            {
+                worker.yielded_tail->next_free = fiber;
+            }
+            else
+            {
+                worker.yielded_head = fiber;
+            }
+            worker.yielded_tail = fiber;
+
+            suspend();
+        }
+
+        // callable from any thread, even before the target finished suspending:
+        // fibers never migrate and the owner only drains its ready queue from the scheduler context
+        void resume( Fiber* fiber )
+        {
+            workers[ fiber->worker_index ]->ready.push( fiber );
+            wake();
+        }
+
+        // scripts poll this at loop back-edges and call sites, a relaxed load and a compare that is almost never taken
+        // the reference stays valid for the whole script, interpreters keep it in a register
+        static const std::atomic<uint32>& getSafepointFlag() { return *safepoint_flag; }
+
+        static inline bool poll()
+        {
+            return safepoint_flag->load( std::memory_order_relaxed ) == 0 || safepoint();
+        }
+
+        // slow path once the timer flagged the current slice as expired
+        // returns false when the script ran out of budget and has to unwind
+        static bool safepoint()
+        {
+            Fiber* fiber = current_fiber;
+            if( fiber == nullptr )
+            {
+                return true;
+            }
+
+            // a request the timer raised for a fiber that has since been switched out is stale and ignored
+            Worker& worker = *fiber->scheduler->workers[ fiber->worker_index ];
+            uint32 tag = safepoint_flag->exchange( 0, std::memory_order_relaxed );
+            if( tag != uint32( worker.switch_count.load( std::memory_order_relaxed ) ) )
+            {
+                return true;
+            }
+
+            uint32 budget = fiber->task->slice_budget;
+            if( budget != 0 && ++fiber->slices_used >= budget )
+            {
+                return false;
+            }
+
+            yield();
+            return true;
+        }
+
+        // i/o builtins, the calling script is suspended until its completion is reaped
+        // results follow the syscall convention: byte count, or a negated errno
+        static int32 read( int fd, void* buffer, uint32 length, uint64 offset = ~uint64( 0 ) )
+        {
+            return submitIo( IORING_OP_READ, fd, buffer, length, offset );
+        }
+
+        static int32 write( int fd, const void* buffer, uint32 length, uint64 offset = ~uint64( 0 ) )
+        {
+            return submitIo( IORING_OP_WRITE, fd, const_cast<void*>( buffer ), length, offset );
+        }
+
+    private:
+        friend void alchemy_fiber_main( Fiber* fiber );
+
+        // lives on the suspended fiber's native stack, its address is the sqe user_data
+        struct IoRequest
+        {
+            Fiber* fiber;
+            int32 result;
+        };
+
+        // user_data of the eventfd read that lets wake() interrupt a worker blocked in the ring
+        static constexpr uint64 WakeupUserData = 0;
+
+        struct Worker
+        {
+            Worker( Scheduler* scheduler, uint32 index )
+                : scheduler( scheduler )
+                , index( index )
+                , inbox_pending( false )
+                , stack_pointer( nullptr )
+                , free_fibers( nullptr )
+                , live_fibers( 0 )
+                , yielded_head( nullptr )
+                , yielded_tail( nullptr )
+                , event_fd( eventfd( 0, EFD_CLOEXEC ) )
+                , event_value( 0 )
+                , event_armed( false )
+                , io_in_flight( 0 )
+                , io_sleeping( false )
+                , preempt( 0 )
+                , switch_count( 0 )
+            {
+            }
+
+            ~Worker()
+            {
+                while( free_fibers != nullptr )
+                {
+                    Fiber* fiber = free_fibers;
+                    free_fibers = fiber->next_free;
+                    delete fiber;
+                }
+
+                close( event_fd );
+            }
+
+            Scheduler* scheduler;
+            uint32 index;
+            Isolate isolate;
+            WorkStealingDeque deque;
+
+            // external submissions land here, drained into the deque by the owner or taken directly by thieves
+            std::mutex inbox_mutex;
+            std::vector<ScriptTask*> inbox;
+            std::atomic<bool> inbox_pending;
+
+            // started scripts are pinned to the isolate that holds their values
+            FiberQueue ready;
+            void* stack_pointer;
+            Fiber* free_fibers;
+            uint32 live_fibers;
+
+            // fibers that yielded or were preempted, only touched by the owner and linked through next_free
+            Fiber* yielded_head;
+            Fiber* yielded_tail;
+
+            IoRing ring;
+            int event_fd;
+            uint64 event_value;
+            bool event_armed;
+            uint32 io_in_flight;
+            std::atomic<bool> io_sleeping;
+
+            // preempt is set by the timer thread to request a switch and cleared by the worker on every switch.
+            // switch_count is odd while a fiber runs, only the worker writes it so the updates need no lock prefix.
+            // the timer stores the count it saw as the request, never 0, and a request older than the running fiber is ignored
+            std::atomic<uint32> preempt;
+            std::atomic<uint64> switch_count;
+
+            std::thread thread;
+        };
+
+        // a worker that stays inside the same fiber across a full tick has used up its slice
+        void runTimer()
+        {
+            std::vector<uint64> last_switch( workers.size(), 0 );
+
+            while( !stopping.load( std::memory_order_acquire ) )
+            {
+                std::this_thread::sleep_for( TimeSlice );
+
+                for( size_t i = 0; i < workers.size(); ++i )
+                {
+                    Worker& worker = *workers[ i ];
+                    uint64 count = worker.switch_count.load( std::memory_order_relaxed );
+                    if( ( count & 1 ) != 0 && count == last_switch[ i ] )
+                    {
+                        worker.preempt.store( uint32( count ), std::memory_order_relaxed );
+                    }
+                    last_switch[ i ] = count;
+                }
+            }
+        }
+
+        static int32 submitIo( uint8 opcode, int fd, void* buffer, uint32 length, uint64 offset )
+        {
+            Fiber* fiber = current_fiber;
+            nassert( fiber != nullptr, "Scheduler", "i/o builtin called outside of a script" );
+            Worker& worker = *fiber->scheduler->workers[ fiber->worker_index ];
+
+            io_uring_sqe* sqe = worker.ring.isValid() ? worker.ring.getSqe() : nullptr;
+            if( sqe == nullptr )
+            {
+                ssize_t result = opcode == IORING_OP_READ
+                    ? ( offset == ~uint64( 0 ) ? ::read( fd, buffer, length ) : pread( fd, buffer, length, static_cast<off_t>( offset ) ) )
+                    : ( offset == ~uint64( 0 ) ? ::write( fd, buffer, length ) : pwrite( fd, buffer, length, static_cast<off_t>( offset ) ) );
+                return result < 0 ? -errno : static_cast<int32>( result );
+            }
+
+            IoRequest request = { fiber, 0 };
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64>( buffer );
+            sqe->len = length;
+            sqe->off = offset;
+            sqe->user_data = reinterpret_cast<uint64>( &request );
+
+            ++worker.io_in_flight;
+            suspend();
+            return request.result;
+        }
+
+        // one io_uring_enter for everything the last batch of scripts queued, completions go to the ready queue
+        uint32 pollIo( Worker& worker, uint32 wait_count )
+        {
+            if( !worker.ring.isValid() || ( worker.io_in_flight == 0 && !worker.event_armed && !worker.ring.hasUnsubmitted() ) )
+            {
+                return 0;
+            }
+
+            if( worker.ring.hasUnsubmitted() || wait_count != 0 )
+            {
+                worker.ring.submit( wait_count );
+            }
+
+            return worker.ring.reap( [&worker]( const io_uring_cqe& cqe ) {
+                if( cqe.user_data == WakeupUserData )
+                {
+                    worker.event_armed = false;
+                    return;
+                }
+
+                IoRequest* request = reinterpret_cast<IoRequest*>( cqe.user_data );
+                request->result = cqe.res;
+                --worker.io_in_flight;
+                worker.ready.push( request->fiber );
+            } );
+        }
+
+        // blocks in the ring instead of the futex while completions are outstanding
+        void parkInRing( Worker& worker, uint32 epoch )
+        {
+            if( !worker.event_armed )
+            {
+                io_uring_sqe* sqe = worker.ring.getSqe();
+                if( sqe == nullptr )
+                {
+                    return;
+                }
+
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = worker.event_fd;
+                sqe->addr = reinterpret_cast<uint64>( &worker.event_value );
+                sqe->len = sizeof( worker.event_value );
+                sqe->user_data = WakeupUserData;
+                worker.event_armed = true;
+            }
+
+            worker.io_sleeping.store( true, std::memory_order_seq_cst );
+            if( work_epoch.load( std::memory_order_seq_cst ) == epoch )
+            {
+                pollIo( worker, 1 );
+            }
+            worker.io_sleeping.store( false, std::memory_order_seq_cst );
+        }
+
+        // the epoch bump and the sleeper check are both seq_cst, so a waker either sees the
+        // sleeper or the sleeper sees the new epoch, and the futex call is skipped while everyone is busy
+        void wake()
+        {
+            work_epoch.fetch_add( 1, std::memory_order_seq_cst );
+            if( sleeping.load( std::memory_order_seq_cst ) != 0 )
+            {
+                work_epoch.notify_all();
+
+                for( auto& worker : workers )
+                {
+                    if( worker->io_sleeping.load( std::memory_order_seq_cst ) )
+                    {
+                        uint64 one = 1;
+                        [[maybe_unused]] ssize_t written = ::write( worker->event_fd, &one, sizeof( one ) );
+                    }
+                }
+            }
+        }
+
+        void drainInbox( Worker& worker )
+        {
+            if( !worker.inbox_pending.load( std::memory_order_acquire ) )
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock( worker.inbox_mutex );
+            size_t drained = 0;
+            while( drained < worker.inbox.size() && worker.deque.push( worker.inbox[ drained ] ) )
+            {
+                ++drained;
+            }
+
+            worker.inbox.erase( worker.inbox.begin(), worker.inbox.begin() + drained );
+            worker.inbox_pending.store( !worker.inbox.empty(), std::memory_order_release );
+        }
+
+        // a worker stuck in a long script never drains its inbox, so thieves take external submissions from there too
+        ScriptTask* stealInbox( Worker& victim )
+        {
+            if( !victim.inbox_pending.load( std::memory_order_acquire ) )
+            {
+                return nullptr;
+            }
+
+            std::lock_guard<std::mutex> lock( victim.inbox_mutex );
+            if( victim.inbox.empty() )
+            {
+                return nullptr;
+            }
+
+            ScriptTask* task = victim.inbox.front();
+            victim.inbox.erase( victim.inbox.begin() );
+            victim.inbox_pending.store( !victim.inbox.empty(), std::memory_order_release );
+            return task;
+        }
+
+        ScriptTask* findTask( Worker& worker )
+        {
+            drainInbox( worker );
+
+            if( ScriptTask* task = worker.deque.pop() )
+            {
+                return task;
+            }
+
+            // victims are probed starting after ourselves so thieves spread out
+            size_t count = workers.size();
+            for( size_t i = 1; i < count; ++i )
+            {
+                Worker& victim = *workers[ ( worker.index + i ) % count ];
+                if( ScriptTask* task = victim.deque.steal() )
+                {
+                    return task;
+                }
+            }
+
+            for( size_t i = 1; i < count; ++i )
+            {
+                if( ScriptTask* task = stealInbox( *workers[ ( worker.index + i ) % count ] ) )
+                {
+                    return task;
+                }
+            }
+
+            return nullptr;
+        }
+
+        void start( Worker& worker, ScriptTask* task )
+        {
+            Fiber* fiber = worker.free_fibers;
+            if( fiber != nullptr )
+            {
+                worker.free_fibers = fiber->next_free;
+            }
+            else
+            {
+                fiber = new Fiber( this, worker.index );
+                if( !fiber->isValid() )
+                {
+                    delete fiber;
+                    task->result = Value( Value::InvalidType );
+                    complete();
+                    return;
+                }
+            }
+
+            fiber->task = task;
+            fiber->slices_used = 0;
+            fiber->finished = false;
+            fiber->value_stack = worker.isolate.acquireStack();
+            ++worker.live_fibers;
+
+            switchTo( worker, fiber );
+        }
+
+        void switchTo( Worker& worker, Fiber* fiber )
+        {
+            current_fiber = fiber;
+            worker.preempt.store( 0, std::memory_order_relaxed );
+            worker.switch_count.store( worker.switch_count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+            worker.isolate.swapStack( fiber->value_stack );
+            worker.isolate.swapHeap( fiber->heap );
+            alchemy_switch_context( &worker.stack_pointer, fiber->stack_pointer );
+            worker.isolate.swapHeap( fiber->heap );
+            worker.isolate.swapStack( fiber->value_stack );
+            worker.switch_count.store( worker.switch_count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+            current_fiber = nullptr;
+
+            if( fiber->finished )
+            {
+                finish( worker, fiber );
+            }
+        }
+
+        void finish( Worker& worker, Fiber* fiber )
+        {
+            worker.isolate.releaseStack( fiber->value_stack );
+            worker.isolate.releaseHeap( fiber->heap );
+            fiber->task = nullptr;
+            fiber->next_free = worker.free_fibers;
+            worker.free_fibers = fiber;
+            --worker.live_fibers;
+
+            complete();
+        }
+
+        void complete()
+        {
+            if( pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            {
+                pending.notify_all();
+            }
+        }
+
+        // body of every fiber, loops so a pooled fiber picks up its next task without rebuilding its stack
+        void runFiber( Fiber* fiber )
+        {
+            Worker& worker = *workers[ fiber->worker_index ];
+
+            while( true )
+            {
+                ScriptTask* task = fiber->task;
+                task->result = task->entry( worker.isolate, task->argument );
+                fiber->finished = true;
+                alchemy_switch_context( &fiber->stack_pointer, worker.stack_pointer );
+            }
+        }
+
+        // runs several scripts before going back to the ring, so their i/o is submitted together
+        uint32 runBatch( Worker& worker )
+        {
+            uint32 count = 0;
+            while( count < BatchSize )
+            {
+                // resuming in-flight scripts first keeps their latency bounded
+                if( Fiber* fiber = worker.ready.pop() )
+                {
+                    switchTo( worker, fiber );
+                }
+                else if( ScriptTask* task = findTask( worker ) )
+                {
+                    start( worker, task );
+                }
+                else if( Fiber* yielded = worker.yielded_head )
+                {
+                    worker.yielded_head = yielded->next_free;
+                    if( worker.yielded_head == nullptr )
+                    {
+                        worker.yielded_tail = nullptr;
+                    }
+                    switchTo( worker, yielded );
+                }
+                else
+                {
+                    break;
+                }
+
+                ++count;
+            }
+
+            return count;
+        }
+
+        void run( Worker& worker )
+        {
+            current_worker = &worker;
+            safepoint_flag = &worker.preempt;
+
+            while( true )
+            {
+                uint32 epoch = work_epoch.load( std::memory_order_seq_cst );
+
+                uint32 found = 0;
+                for( uint32 attempt = 0; found == 0 && attempt < StealAttempts; ++attempt )
+                {
+                    found = runBatch( worker );
+                    found += pollIo( worker, 0 );
+                }
+
+                if( found != 0 )
+                {
+                    continue;
+                }
+
+                if( stopping.load( std::memory_order_seq_cst ) && worker.live_fibers == 0 )
+                {
+                    break;
+                }
+
+                // nothing anywhere, park until the next submission, resume or i/o completion
+                sleeping.fetch_add( 1, std::memory_order_seq_cst );
+                if( worker.io_in_flight != 0 )
+                {
+                    parkInRing( worker, epoch );
+                }
+                else
+                {
+                    work_epoch.wait( epoch, std::memory_order_seq_cst );
+                }
+                sleeping.fetch_sub( 1, std::memory_order_seq_cst );
+            }
+
+            current_worker = nullptr;
+            safepoint_flag = &never_preempted;
+        }
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::thread timer;
+
+        alignas( 64 ) std::atomic<uint64> pending;
+        alignas( 64 ) std::atomic<uint32> work_epoch;
+        std::atomic<uint32> sleeping;
+        std::atomic<uint32> next_worker;
+        std::atomic<bool> stopping;
+
+        static inline thread_local Worker* current_worker = nullptr;
+        static inline thread_local Fiber* current_fiber = nullptr;
+
+        // threads outside the scheduler poll a flag nobody ever sets
+        static inline std::atomic<uint32> never_preempted { 0 };
+        static inline thread_local std::atomic<uint32>* safepoint_flag = &never_preempted;
+    };
+
+    extern "C" void alchemy_fiber_main( Fiber* fiber )
+    {
+        fiber->scheduler->runFiber( fiber );
+    }
+
+    // header of every object in the shared heap, payload follows inline:
+    // characters plus a terminator for strings, values for tuples and arrays
+    struct SharedObject
+    {
+        static constexpr uint32 String = 0;
+        static constexpr uint32 Tuple = 1;
+        static constexpr uint32 Array = 2;
+
+        std::atomic<uint32> references;
+        uint32 kind;
+        uint32 length;
+        uint32 size_class;
+
+        inline const char* getCharacters() const { return reinterpret_cast<const char*>( this + 1 ); }
+        inline const Value* getValues() const { return reinterpret_cast<const Value*>( this + 1 ); }
+    };
+
+    // one process wide region that every isolate may point into, objects are frozen at publish time
+    // and reference counted, so a value is handed to another isolate as the pointer itself
+    class SharedHeap
+    {
+    public:
+        static constexpr size_t RegionSize = size_t( 1 ) << 30;
+        static constexpr uint32 MinSizeClass = 5;
+        static constexpr uint32 SizeClassCount = 31;
+
+        static SharedHeap& get()
+        {
+            static SharedHeap heap;
+            return heap;
+        }
+
+        // shared references must never be mutated, isolate builtins check this before writing through a value
+        inline bool contains( const void* pointer ) const
+        {
+            return pointer >= region && pointer < region + RegionSize;
+        }
+
+        inline bool contains( Value value ) const
+        {
+            return value.isReference() && contains( value.getReference() );
+        }
+
+        // nullptr once the region is exhausted or for an object larger than the region
+        SharedObject* allocate( uint32 kind, uint32 length, size_t payload_size )
+        {
+            size_t size = sizeof( SharedObject ) + payload_size;
+            if( size > RegionSize )
+            {
+                return nullptr;
+            }
+
+            uint32 size_class = MinSizeClass;
+            while( ( size_t( 1 ) << size_class ) < size )
+            {
+                ++size_class;
+            }
+
+            void* memory = nullptr;
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                if( free_lists[ size_class ] != nullptr )
+                {
+                    memory = free_lists[ size_class ];
+                    free_lists[ size_class ] = *static_cast<void**>( memory );
+                }
+                else if( cursor + ( size_t( 1 ) << size_class ) <= region + RegionSize )
+                {
+                    memory = cursor;
+                    cursor += size_t( 1 ) << size_class;
+                }
+                else
+                {
+                    return nullptr;
+                }
+                ++live_objects;
+            }
+
+            SharedObject* object = static_cast<SharedObject*>( memory );
+            object->references.store( 1, std::memory_order_relaxed );
+            object->kind = kind;
+            object->length = length;
+            object->size_class = size_class;
+            return object;
+        }
+
+        static inline void retain( Value value )
+        {
+            if( get().contains( value ) )
+            {
+                static_cast<SharedObject*>( value.getReference() )->references.fetch_add( 1, std::memory_order_relaxed );
+            }
+        }
+
+        static void release( Value value )
+        {
+            SharedHeap& heap = get();
+            if( !heap.contains( value ) )
+            {
+                return;
+            }
+
+            SharedObject* object = static_cast<SharedObject*>( value.getReference() );
+            if( object->references.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+            {
+                return;
+            }
+
+            if( object->kind != SharedObject::String )
+            {
+                for( uint32 i = 0; i < object->length; ++i )
+                {
+                    release( object->getValues()[ i ] );
+                }
+            }
+
+            std::lock_guard<std::mutex> lock( heap.mutex );
+            *reinterpret_cast<void**>( object ) = heap.free_lists[ object->size_class ];
+            heap.free_lists[ object->size_class ] = object;
+            --heap.live_objects;
+        }
+
+        size_t getLiveObjectCount()
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            return live_objects;
+        }
+
+    private:
+        SharedHeap()
+            : live_objects( 0 )
+        {
+            region = static_cast<unsigned char*>( mmap( nullptr, RegionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 ) );
+            nassert( region != MAP_FAILED, "SharedHeap", "Failed to reserve shared region" );
+            cursor = region;
+
+            for( auto& free_list : free_lists )
+            {
+                free_list = nullptr;
+            }
+        }
+
+        unsigned char* region;
+        unsigned char* cursor;
+
+        // publishing is rare next to reading, a single lock keeps the region simple
+        std::mutex mutex;
+        void* free_lists[ SizeClassCount ];
+        size_t live_objects;
+    };
+
+    // read only views, the only way to get at a shared payload, there is no mutable accessor to misuse
+    // views borrow, they stay valid while some SharedValue holds the object or one of its parents
+    class SharedString
+    {
+    public:
+        explicit SharedString( Value value )
+            : object( static_cast<const SharedObject*>( value.getReference() ) )
+        {
+            nassert( SharedHeap::get().contains( value ) && object->kind == SharedObject::String );
+        }
+
+        inline uint32 getLength() const { return object->length; }
+        inline const char* getData() const { return object->getCharacters(); }
+        inline std::string_view getView() const { return std::string_view( getData(), getLength() ); }
+
+    private:
+        const SharedObject* object;
+    };
+
+    class SharedSequence
+    {
+    public:
+        explicit SharedSequence( Value value )
+            : object( static_cast<const SharedObject*>( value.getReference() ) )
+        {
+            nassert( SharedHeap::get().contains( value ) && object->kind != SharedObject::String );
+        }
+
+        inline bool isTuple() const { return object->kind == SharedObject::Tuple; }
+        inline bool isArray() const { return object->kind == SharedObject::Array; }
+        inline uint32 getLength() const { return object->length; }
+        inline Value operator[]( uint32 index ) const { nassert( index < object->length ); return object->getValues()[ index ]; }
+        inline const Value* begin() const { return object->getValues(); }
+        inline const Value* end() const { return object->getValues() + object->length; }
+
+    private:
+        const SharedObject* object;
+    };
+
+    // owns one reference, short and double values pass through untouched
+    class SharedValue
+    {
+    public:
+        SharedValue()
+            : value()
+        {
+        }
+
+        // takes over a reference the caller already holds
+        static SharedValue adopt( Value value )
+        {
+            SharedValue result;
+            result.value = value;
+            return result;
+        }
+
+        SharedValue( const SharedValue& other )
+            : value( other.value )
+        {
+            SharedHeap::retain( value );
+        }
+
+        SharedValue( SharedValue&& other )
+            : value( other.value )
+        {
+            other.value = Value();
+        }
+
+        SharedValue& operator=( SharedValue other )
+        {
+            std::swap( value, other.value );
+            return *this;
+        }
+
+        ~SharedValue()
+        {
+            SharedHeap::release( value );
+        }
+
+        // publishing fails with an empty value, isShared() is false, when the shared region has no room left
+        static SharedValue publishString( std::string_view text )
+        {
+            SharedObject* object = SharedHeap::get().allocate( SharedObject::String, static_cast<uint32>( text.size() ), text.size() + 1 );
+            if( object == nullptr )
+            {
+                return SharedValue();
+            }
+            char* characters = reinterpret_cast<char*>( object + 1 );
+            memcpy( characters, text.data(), text.size() );
+            characters[ text.size() ] = 0;
+            return adopt( Value( static_cast<void*>( object ) ) );
+        }
+
+        static SharedValue publishTuple( const Value* values, uint32 count ) { return publishSequence( SharedObject::Tuple, values, count ); }
+        static SharedValue publishTuple( std::initializer_list<Value> values ) { return publishTuple( values.begin(), static_cast<uint32>( values.size() ) ); }
+        static SharedValue publishArray( const Value* values, uint32 count ) { return publishSequence( SharedObject::Array, values, count ); }
+
+        inline Value get() const { return value; }
+        inline bool isShared() const { return SharedHeap::get().contains( value ); }
+        inline SharedString getString() const { return SharedString( value ); }
+        inline SharedSequence getSequence() const { return SharedSequence( value ); }
+
+        // hands the reference over, e.g. into a channel slot
+        Value detach()
+        {
+            Value result = value;
+            value = Value();
+            return result;
+        }
+
+    private:
+        // elements must be short, double or already shared, isolate local references cannot cross
+        static SharedValue publishSequence( uint32 kind, const Value* values, uint32 count )
+        {
+            SharedObject* object = SharedHeap::get().allocate( kind, count, count * sizeof( Value ) );
+            if( object == nullptr )
+            {
+                return SharedValue();
+            }
+
+            Value* elements = reinterpret_cast<Value*>( object + 1 );
+            for( uint32 i = 0; i < count; ++i )
+            {
+                nassert( !values[ i ].isReference() || SharedHeap::get().contains( values[ i ] ), "SharedValue", "Isolate local reference published" );
+                SharedHeap::retain( values[ i ] );
+                elements[ i ] = values[ i ];
+            }
+            return adopt( Value( static_cast<void*>( object ) ) );
+        }
+
+        Value value;
+    };
+
+    // fan-out channel between isolates, only the pointer travels, receivers suspend while it is empty
+    class SharedChannel
+    {
+    public:
+        explicit SharedChannel( Scheduler& scheduler )
+            : scheduler( scheduler )
+        {
+        }
+
+        ~SharedChannel()
+        {
+            for( Value value : values )
+            {
+                SharedHeap::release( value );
+            }
+        }
+
+        void send( const SharedValue& value )
+        {
+            SharedHeap::retain( value.get() );
+
+            Fiber* waiter = nullptr;
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                values.push_back( value.get() );
+                if( !waiters.empty() )
+                {
+                    waiter = waiters.back();
+                    waiters.pop_back();
+                }
+            }
+
+            if( waiter != nullptr )
+            {
+                scheduler.resume( waiter );
+            }
+        }
+
+        // script side, parks the fiber until a value arrives
+        SharedValue receive()
+        {
+            while( true )
+            {
+                {
+                    std::lock_guard<std::mutex> lock( mutex );
+                    if( !values.empty() )
+                    {
+                        Value value = values.back();
+                        values.pop_back();
+                        return SharedValue::adopt( value );
+                    }
+                    waiters.push_back( Scheduler::getCurrentFiber() );
+                }
+
+                Scheduler::suspend();
+            }
+        }
+
+    private:
+        Scheduler& scheduler;
+        std::mutex mutex;
+        std::vector<Value> values;
+        std::vector<Fiber*> waiters;
+    };
+}
+
+using Value = ::Nickel::System::Runtime::Alchemy::Value;
+using Isolate = ::Nickel::System::Runtime::Alchemy::Isolate;
+using HeapRegion = ::Nickel::System::Runtime::Alchemy::HeapRegion;
+using ScriptTask = ::Nickel::System::Runtime::Alchemy::ScriptTask;
+using Scheduler = ::Nickel::System::Runtime::Alchemy::Scheduler;
+using Fiber = ::Nickel::System::Runtime::Alchemy::Fiber;
+using SharedHeap = ::Nickel::System::Runtime::Alchemy::SharedHeap;
+using SharedValue = ::Nickel::System::Runtime::Alchemy::SharedValue;
+using SharedChannel = ::Nickel::System::Runtime::Alchemy::SharedChannel;
+using SharedString = ::Nickel::System::Runtime::Alchemy::SharedString;
+using SharedSequence = ::Nickel::System::Runtime::Alchemy::SharedSequence;
+
+template<std::size_t I>
+struct Instruction;
+
+template<>
+struct Instruction<0>
+{
+    template<typename T>
+    static constexpr bool Addable = std::same_as<T, int32> || std::same_as<T, uint32> || std::same_as<T, float> || std::same_as<T, double>;
+    static inline constexpr Value evaluate( Value lhs, Value rhs )
+    {
+        Value result = lhs.apply( [rhs]<typename T>( T lhs_value ) mutable {
+            if constexpr( Addable<T> )
+            {
+                // workaround the bug that nested lambda can't capture parameters in parent scope
+                T redirect_lhs_value = lhs_value;
+                return rhs.apply( [redirect_lhs_value]<typename U>( U rhs_value ) {
+                    if constexpr( Addable<U> )
+                    {
+                        return Value( redirect_lhs_value + rhs_value );
+                    }
+                    return Value( Value::InvalidType );
+                } );
+            }
+            return Value( Value::InvalidType );
+        } );
+        return result;
+    }
+};
+
+// register-free stack bytecode, operands index the function's constant, local or callee tables
+enum class Opcode : uint8
+{
+    PushConstant,
+    LoadLocal,
+    StoreLocal,
+    Add,
+    JumpIfLess,
+    Call,
+    Return,
+};
+
+struct Bytecode
+{
+    Opcode opcode;
+    int32 operand;
+};
+
+struct Function
+{
+    const Bytecode* code;
+    const Value* constants;
+    const Function* const* callees;
+    uint32 argument_count;
+    uint32 local_count;
+};
+
+class Interpreter
+{
+public:
+    static constexpr uint32 MaxLocals = 16;
+
+    // arguments are taken from the isolate stack, returns Value::InvalidType when aborted at a safepoint
+    static Value run( Isolate& isolate, const Function& function )
+    {
+        Value result;
+        return execute( isolate, function, Scheduler::getSafepointFlag(), result ) ? result : Value( Value::InvalidType );
+    }
+
+private:
+    static bool execute( Isolate& isolate, const Function& function, const std::atomic<uint32>& safepoint, Value& result )
+    {
+        nassert( function.local_count <= MaxLocals );
+
+        Value locals[ MaxLocals ];
+        for( uint32 i = function.argument_count; i > 0; --i )
+        {
+            locals[ i - 1 ] = isolate.pop();
+        }
+
+        for( const Bytecode* pc = function.code; ; ++pc )
+        {
+            switch( pc->opcode )
+            {
+                case Opcode::PushConstant:
+                    isolate.push( function.constants[ pc->operand ] );
+                    break;
+                case Opcode::LoadLocal:
+                    isolate.push( locals[ pc->operand ] );
+                    break;
+                case Opcode::StoreLocal:
+                    locals[ pc->operand ] = isolate.pop();
+                    break;
+                case Opcode::Add:
+                {
+                    Value rhs = isolate.pop();
+                    isolate.top() = Instruction<0>::evaluate( isolate.top(), rhs );
+                    break;
+                }
+                case Opcode::JumpIfLess:
+                {
+                    Value rhs = isolate.pop();
+                    Value lhs = isolate.pop();
+                    if( lhs.getInt() < rhs.getInt() )
+                    {
+                        const Bytecode* target = function.code + pc->operand;
+                        // only back-edges poll, forward jumps always reach a back-edge or a return
+                        if( target <= pc && safepoint.load( std::memory_order_relaxed ) != 0 && !Scheduler::safepoint() )
+                        {
+                            return false;
+                        }
+                        pc = target - 1;
+                    }
+                    break;
+                }
+                case Opcode::Call:
+                {
+                    if( safepoint.load( std::memory_order_relaxed ) != 0 && !Scheduler::safepoint() )
+                    {
+                        return false;
+                    }
+
+                    Value callee_result;
+                    if( !execute( isolate, *function.callees[ pc->operand ], safepoint, callee_result ) )
+                    {
+                        return false;
+                    }
+                    isolate.push( callee_result );
+                    break;
+                }
+                case Opcode::Return:
+                    result = isolate.pop();
+                    return true;
+            }
+        }
+    }
+};
+
+// sums 1..n on the isolate stack, yielding to other scripts between additions
+static Value sumScript( Isolate& isolate, Value argument )
+{
+    int32 n = argument.getInt();
+
+    isolate.push( Value( 0 ) );
+    for( int32 i = 1; i <= n; ++i )
+    {
+        isolate.push( Value( i ) );
+        Value rhs = isolate.pop();
+        isolate.top() = Instruction<0>::evaluate( isolate.top(), rhs );
+        Scheduler::yield();
+    }
+
+    return isolate.pop();
+}
+
+// stands in for an i/o completion source: scripts park here until another thread resumes them
+struct WaitList
+{
+    std::mutex mutex;
+    std::vector<Fiber*> fibers;
+};
+
+static WaitList wait_list;
+
+static Value waitScript( Isolate& isolate, Value argument )
+{
+    // deep enough to spill into a second value segment across the suspension
+    for( int32 i = 0; i < 1500; ++i )
+    {
+        isolate.push( argument );
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( wait_list.mutex );
+        wait_list.fibers.push_back( Scheduler::getCurrentFiber() );
+    }
+    Scheduler::suspend();
+
+    Value result = Value( 0 );
+    for( int32 i = 0; i < 1500; ++i )
+    {
+        result = Instruction<0>::evaluate( result, isolate.pop() );
+    }
+
+    return result;
+}
+
+static int io_file = -1;
+
+// local0 = n, local1 = i, local2 = sum; while( i < n ) { i = i + 1; sum = sum + i; } return sum;
+static const Value count_constants[] = { Value( 0 ), Value( 1 ) };
+static const Bytecode count_code[] =
+{
+    { Opcode::PushConstant, 0 },
+    { Opcode::StoreLocal, 1 },
+    { Opcode::PushConstant, 0 },
+    { Opcode::StoreLocal, 2 },
+    { Opcode::LoadLocal, 1 },
+    { Opcode::PushConstant, 1 },
+    { Opcode::Add, 0 },
+    { Opcode::StoreLocal, 1 },
+    { Opcode::LoadLocal, 2 },
+    { Opcode::LoadLocal, 1 },
+    { Opcode::Add, 0 },
+    { Opcode::StoreLocal, 2 },
+    { Opcode::LoadLocal, 1 },
+    { Opcode::LoadLocal, 0 },
+    { Opcode::JumpIfLess, 4 },
+    { Opcode::LoadLocal, 2 },
+    { Opcode::Return, 0 },
+};
+static const Function count_function = { count_code, count_constants, nullptr, 1, 3 };
+
+// while( 0 < 1 ) { count( argument ); } never returns on its own
+static const Value spin_constants[] = { Value( 0 ), Value( 1 ) };
+static const Function* const spin_callees[] = { &count_function };
+static const Bytecode spin_code[] =
+{
+    { Opcode::LoadLocal, 0 },
+    { Opcode::Call, 0 },
+    { Opcode::StoreLocal, 1 },
+    { Opcode::PushConstant, 0 },
+    { Opcode::PushConstant, 1 },
+    { Opcode::JumpIfLess, 0 },
+    { Opcode::LoadLocal, 1 },
+    { Opcode::Return, 0 },
+};
+static const Function spin_function = { spin_code, spin_constants, spin_callees, 1, 2 };
+
+static Value countScript( Isolate& isolate, Value argument )
+{
+    isolate.push( argument );
+    return Interpreter::run( isolate, count_function );
+}
+
+static Value spinScript( Isolate& isolate, Value argument )
+{
+    isolate.push( argument );
+    return Interpreter::run( isolate, spin_function );
+}
+
+// reads a 64 byte record through the worker's ring and sums its bytes
+static Value readScript( Isolate& isolate, Value argument )
+{
+    unsigned char record[ 64 ];
+    int32 length = Scheduler::read( io_file, record, sizeof( record ), argument.getUInt() * sizeof( record ) );
+
+    isolate.push( Value( 0 ) );
+    for( int32 i = 0; i < length; ++i )
+    {
+        isolate.push( Value( int32( record[ i ] ) ) );
+        Value rhs = isolate.pop();
+        isolate.top() = Instruction<0>::evaluate( isolate.top(), rhs );
+    }
+
+    return isolate.pop();
+}
+
+static Scheduler* runaway_scheduler = nullptr;
+static std::atomic<bool> short_task_ran( false );
+
+static Value shortScript( Isolate&, Value )
+{
+    short_task_ran.store( true, std::memory_order_release );
+    return Value( 1 );
+}
+
+static ScriptTask short_task = { shortScript, Value(), Value() };
+
+// spins at its safepoint without a budget until the task it queued behind itself got to run
+static Value runawayScript( Isolate&, Value )
+{
+    runaway_scheduler->submit( &short_task );
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 2 );
+    while( !short_task_ran.load( std::memory_order_acquire ) && std::chrono::steady_clock::now() < deadline )
+    {
+        Scheduler::poll();
+    }
+
+    return Value( int32( short_task_ran.load( std::memory_order_acquire ) ? 1 : 0 ) );
+}
+
+static SharedChannel* payload_channel = nullptr;
+
+// every receiver reads the same published tuple ( name, values ) in place
+static Value fanOutScript( Isolate& isolate, Value )
+{
+    SharedValue payload = payload_channel->receive();
+    SharedSequence tuple = payload.getSequence();
+    SharedString name( tuple[ 0 ] );
+    SharedSequence values( tuple[ 1 ] );
+
+    isolate.push( Value( int32( name.getLength() ) ) );
+    for( Value value : values )
+    {
+        isolate.push( value );
+        Value rhs = isolate.pop();
+        isolate.top() = Instruction<0>::evaluate( isolate.top(), rhs );
+    }
+
+    return isolate.pop();
+}
+
+int main( int argc, char** argv )
+{
+    constexpr uint32 TaskCount = 1024;
+
+    FILE* file = tmpfile();
+    io_file = fileno( file );
+    unsigned char contents[ TaskCount * 64 ];
+    int expected_bytes = 0;
+    for( uint32 i = 0; i < sizeof( contents ); ++i )
+    {
+        contents[ i ] = static_cast<unsigned char>( i * 7 + argc );
+        expected_bytes += contents[ i ];
+    }
+    [[maybe_unused]] ssize_t written = write( io_file, contents, sizeof( contents ) );
+
+    Scheduler scheduler;
+
+    // runaway scripts only delay the others by a slice and get aborted once their budget is spent
+    ScriptTask spin_task = { spinScript, Value( 1000 ), Value(), 5 };
+    ScriptTask count_task = { countScript, Value( 50000 ), Value() };
+    scheduler.submit( &spin_task );
+    scheduler.submit( &count_task );
+
+    SharedChannel channel( scheduler );
+    payload_channel = &channel;
+    std::unique_ptr<ScriptTask[]> fan_out_tasks( new ScriptTask[ TaskCount ] );
+    int expected_fan_out = 0;
+    {
+        Value elements[ 1000 ];
+        for( int32 i = 0; i < 1000; ++i )
+        {
+            elements[ i ] = Value( i * argc );
+            expected_fan_out += i * argc;
+        }
+
+        SharedValue name = SharedValue::publishString( "payload" );
+        SharedValue values = SharedValue::publishArray( elements, 1000 );
+        SharedValue payload = SharedValue::publishTuple( { name.get(), values.get() } );
+        expected_fan_out += 7;
+
+        for( uint32 i = 0; i < TaskCount; ++i )
+        {
+            fan_out_tasks[ i ] = { fanOutScript, Value(), Value() };
+            scheduler.submit( &fan_out_tasks[ i ] );
+            channel.send( payload );
+        }
+    }
+
+    std::unique_ptr<ScriptTask[]> sum_tasks( new ScriptTask[ TaskCount ] );
+    std::unique_ptr<ScriptTask[]> wait_tasks( new ScriptTask[ TaskCount ] );
+    std::unique_ptr<ScriptTask[]> read_tasks( new ScriptTask[ TaskCount ] );
+
+    for( uint32 i = 0; i < TaskCount; ++i )
+    {
+        sum_tasks[ i ] = { sumScript, Value( argc ), Value() };
+        wait_tasks[ i ] = { waitScript, Value( argc ), Value() };
+        read_tasks[ i ] = { readScript, Value( i ), Value() };
+        scheduler.submit( &sum_tasks[ i ] );
+        scheduler.submit( &wait_tasks[ i ] );
+        scheduler.submit( &read_tasks[ i ] );
+    }
+
+    uint32 resumed = 0;
+    while( resumed < TaskCount )
+    {
+        std::vector<Fiber*> fibers;
+        {
+            std::lock_guard<std::mutex> lock( wait_list.mutex );
+            fibers.swap( wait_list.fibers );
+        }
+
+        for( Fiber* fiber : fibers )
+        {
+            scheduler.resume( fiber );
+        }
+
+        resumed += static_cast<uint32>( fibers.size() );
+        std::this_thread::yield();
+    }
+
+    scheduler.wait();
+
+    fclose( file );
+
+    int result = -expected_bytes;
+    result += spin_task.result.isValid() ? 1 : 0;
+    result += count_task.result.getInt() == int32( 50000 / 2 * 50001 ) ? 0 : 1;
+    for( uint32 i = 0; i < TaskCount; ++i )
+    {
+        result += sum_tasks[ i ].result.getInt() - argc * ( argc + 1 ) / 2;
+        result += wait_tasks[ i ].result.getInt() - argc * 1500;
+        result += read_tasks[ i ].result.getInt();
+        result += fan_out_tasks[ i ].result.getInt() - expected_fan_out;
+    }
+
+    // the last receiver to drop the payload freed all three objects
+    result += static_cast<int>( SharedHeap::get().getLiveObjectCount() );
+
+    // a preempted script goes behind the work queued on its worker instead of being resumed at once
+    {
+        Scheduler single( 1 );
+        runaway_scheduler = &single;
+        ScriptTask runaway_task = { runawayScript, Value(), Value() };
+        single.submit( &runaway_task );
+        single.wait();
+        result += runaway_task.result.getInt() == 1 && short_task.result.getInt() == 1 ? 0 : 1;
+    }
+
+    // an allocation bigger than a chunk gets its own block and leaves the chunk it interrupted usable
+    Isolate isolate;
+    unsigned char* small = static_cast<unsigned char*>( isolate.allocate( 64 ) );
+    unsigned char* large = static_cast<unsigned char*>( isolate.allocate( Isolate::HeapChunkSize * 3 ) );
+    memset( large, argc, Isolate::HeapChunkSize * 3 );
+    unsigned char* next = static_cast<unsigned char*>( isolate.allocate( 64 ) );
+    result += next == small + 64 && large[ Isolate::HeapChunkSize * 3 - 1 ] == argc ? 0 : 1;
+    isolate.resetHeap();
+
+    // a finished script's chunks are reused right away while another script still holds its own region
+    HeapRegion finished = { nullptr, nullptr, nullptr, nullptr };
+    HeapRegion running = { nullptr, nullptr, nullptr, nullptr };
+    isolate.swapHeap( finished );
+    unsigned char* finished_bytes = static_cast<unsigned char*>( isolate.allocate( 64 ) );
+    isolate.swapHeap( finished );
+    isolate.swapHeap( running );
+    unsigned char* running_bytes = static_cast<unsigned char*>( isolate.allocate( 64 ) );
+    isolate.swapHeap( running );
+    isolate.releaseHeap( finished );
+    unsigned char* reused_bytes = static_cast<unsigned char*>( isolate.allocate( 64 ) );
+    result += running_bytes != finished_bytes && reused_bytes == finished_bytes ? 0 : 1;
+    isolate.releaseHeap( running );
+
+    // more than the whole shared region is refused instead of handing out memory that is not there
+    result += !SharedValue::publishArray( nullptr, uint32( 1 ) << 28 ).isShared() && SharedHeap::get().getLiveObjectCount() == 0 ? 0 : 1;
+
+    return result == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,899 @@
+#include <cstdio>
+#include <concepts>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+using int32 = int;
+using uint32 = unsigned int;
+using uint64 = long long unsigned int;
+using std::nullptr_t;
+using std::size_t;
+
+#define nassert(...)
+
+namespace Nickel::System::Runtime::Alchemy
+{
+    struct TypeId
+    {
+        static constexpr uint32 Invalid = 0;
+        static constexpr uint32 Type = 1;
+        static constexpr uint32 Null = 2;
+        static constexpr uint32 Bool = 3;
+        static constexpr uint32 Int = 4;
+        static constexpr uint32 UInt = 5;
+        static constexpr uint32 Float = 6;
+        static constexpr uint32 Double = 7;
+
+        uint32 value;
+
+        constexpr TypeId()
+            : value( Invalid )
+        {
+        }
+
+        constexpr TypeId( uint32 value )
+            : value( value )
+        {
+        }
+
+        explicit operator uint32() const { return value; }
+        explicit operator bool() const { return value != 0; }
+
+        static constexpr const char* getName( uint32 type_id )
+        {
+            switch( type_id )
+            {
+                case Type: return "type";
+                case Null: return "null";
+                case Bool: return "bool";
+                case Int: return "int";
+                case UInt: return "uint";
+                case Float: return "float";
+                case Double: return "double";
+            }
+
+            return "(invalid)";
+        }
+    };
+
+    class Value
+    {
+        // tagged value layouts
+
+        // short layout ( 32bit )
+        // type: 0xffff0000 + 32bit type id
+        // null: 0xffff0001 + 00000000
+        // bool(true): 0xffff0002 + 00000001
+        // bool(false): 0xffff0002 + 00000000
+        // int: 0xffff0003 + 32bit payload
+        // uint: 0xffff0004 + 32bit payload
+        // float: 0xffff0005 + 32bit payload
+
+        // reference layout ( 48bit )
+        // reference: 0x0000 + 48bit payload(pointer)
+        // reference include string, tuple, array, function, object, cfunction, cobject
+
+        // long layout ( 64bit )
+        // double: range( 0x0001, 0xfffe ) + ( native_double_value + 0x0001000000000000 );
+
+        static constexpr uint64 LayoutMask = 0xffff000000000000;
+        static constexpr uint64 ShortLayout = 0xffff000000000000;
+        static constexpr uint64 ReferenceLayout = 0x0000000000000000;
+        
+        static constexpr uint64 LongValueTagMask = 0xffff000000000000;
+        static constexpr uint32 ReferenceTag = 0x0000000000000000;
+
+        static constexpr uint32 TypeIdTag = 0xffff0000;
+        static constexpr uint32 NullTag = 0xffff0001;
+        static constexpr uint32 BoolTag = 0xffff0002;
+        static constexpr uint32 IntTag = 0xffff0003;
+        static constexpr uint32 UIntTag = 0xffff0004;
+        static constexpr uint32 FloatTag = 0xffff0005;
+        
+        static constexpr uint64 DoubleEncodingOffset = 0x0001000000000000;
+        static constexpr uint64 ReferenceEncodingMask = 0x0000ffffffffffff;
+
+    public:
+        static constexpr uint64 InvalidType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Invalid;
+        static constexpr uint64 TypeType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Type;
+        static constexpr uint64 NullType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Null;
+        static constexpr uint64 BoolType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Bool;
+        static constexpr uint64 IntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Int;
+        static constexpr uint64 UIntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::UInt;
+        static constexpr uint64 FloatType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Float;
+        static constexpr uint64 DoubleType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Double;
+
+        static constexpr uint64 NullValue = uint64( NullTag ) << 32;
+        static constexpr uint64 TrueValue = ( uint64( BoolTag ) << 32 ) | 0x00000001;
+        static constexpr uint64 FalseValue = ( uint64( BoolTag ) << 32 ) | 0x00000000;
+
+    private:
+        union
+        {
+            uint64 data;
+
+            struct
+            {
+                union
+                {
+                    TypeId type_id;
+                    int32 int_value;
+                    uint32 uint_value;
+                    float float_value;
+                } value;
+
+                uint32 tag;
+
+            } short_layout;
+
+            struct
+            {
+                union
+                {
+                    double double_value;
+                    uint64 double_data;
+                } value;
+            } double_layout;
+
+            struct
+            {
+                void* reference_value;
+            } reference_layout;
+        };
+
+        static inline constexpr Value encodeDouble( double value )
+        {
+            Value v;
+            v.double_layout.value.double_value = value;
+            v.double_layout.value.double_data += DoubleEncodingOffset;
+
+            return v;
+        }
+
+        static inline constexpr double decodeDouble( Value value )
+        {
+            value.double_layout.value.double_data -= DoubleEncodingOffset;
+            return value.double_layout.value.double_value;
+        }
+
+    public:
+        constexpr Value()
+            : data { NullValue }
+        {
+        }
+
+        constexpr Value( uint64 data )
+            : data( data )
+        {
+        }
+
+        constexpr Value( TypeId value )
+        {
+            setTypeId( value );
+        }
+
+        constexpr Value( nullptr_t )
+        {
+            setNull();
+        }
+
+        constexpr Value( bool value )
+        {
+            setBool( value );
+        }
+
+        constexpr Value( int32 value )
+        {
+            setInt( value );
+        }
+
+        constexpr Value( uint32 value )
+        {
+            setUInt( value );
+        }
+
+        constexpr Value( float value )
+        {
+            setFloat( value );
+        }
+
+        constexpr Value( void* value )
+        {
+            setReference( value );
+        }
+
+        constexpr Value( double value )
+        {
+            setDouble( value );
+        }
+
+        explicit operator nullptr_t() const { nassert( isNull() ); return nullptr; }
+        explicit operator bool() const { nassert( isBool() ); return getBool(); }
+        //explicit operator int32() const { nassert( isInt() ); return getInt(); }
+        explicit operator uint32() const { nassert( isUInt() ); return getUInt(); }
+        explicit operator float() const { nassert( isFloat() ); return getFloat(); }
+        explicit operator void*() const { nassert( isReference() ); return getReference(); }
+        explicit operator double() const { nassert( isDouble() ); return getDouble(); }
+
+        inline constexpr bool isShortLayout() const { return ( data & LayoutMask ) == ShortLayout; }
+        inline constexpr bool isReferenceLayout() const { return ( data & LayoutMask ) == ReferenceLayout; }
+        inline constexpr bool isDoubleLayout() const { return !isShortLayout() && !isReferenceLayout(); }
+
+        inline constexpr bool isTypeId() const { return short_layout.tag == TypeIdTag; }
+        inline constexpr void setTypeId( TypeId value ) { short_layout = { { .type_id = value }, TypeIdTag }; }
+        inline constexpr TypeId getTypeId() const { return short_layout.value.type_id; }
+
+        inline constexpr bool isNull() const { return short_layout.tag == NullTag; }
+        inline constexpr void setNull() { data = NullValue; }
+        inline constexpr nullptr_t getNull() { return nullptr; }
+
+        inline constexpr bool isBool() const { return short_layout.tag == BoolTag; }
+        inline constexpr void setBool( bool value ) { data = value ? TrueValue : FalseValue; }
+        inline constexpr bool getBool() const { return data == TrueValue; }
+        inline constexpr void setTrue() { data = TrueValue; }
+        inline constexpr void setFalse() { data = FalseValue; }
+        inline constexpr bool isTrue() const { return data == TrueValue; }
+        inline constexpr bool isFalse() const { return data == FalseValue; }
+
+        inline constexpr bool isInt() const { return short_layout.tag == IntTag; }
+        inline constexpr void setInt( int32 value ) { short_layout = { { .int_value = value }, IntTag }; }
+        inline constexpr int32 getInt() const { return short_layout.value.int_value; }
+
+        inline constexpr bool isUInt() const { return short_layout.tag == UIntTag; }
+        inline constexpr void setUInt( uint32 value ) { short_layout = { { .uint_value = value }, UIntTag }; }
+        inline constexpr uint32 getUInt() const { return short_layout.value.uint_value; }
+
+        inline constexpr bool isFloat() const { return short_layout.tag == FloatTag; }
+        inline constexpr void setFloat( float value ) { short_layout = { { .float_value = value }, FloatTag }; }
+        inline constexpr float getFloat() const { return short_layout.value.float_value; }
+
+        inline constexpr bool isReference() const { return isReferenceLayout(); }
+        inline constexpr void setReference( void* value ) { reference_layout.reference_value = value; }
+        inline constexpr void* getReference() const { return reference_layout.reference_value; }
+
+        inline constexpr bool isDouble() const { return isDoubleLayout(); }
+        inline constexpr void setDouble( double value ) { *this = encodeDouble( value ); }
+        inline constexpr double getDouble() const { return decodeDouble( *this ); }
+
+        inline constexpr bool isNumeric() const { return isInt() || isUInt() || isFloat() || isDouble(); }
+        inline constexpr bool isValid() const { return data != InvalidType; }
+
+        inline constexpr TypeId getType() const
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return TypeId::Type;
+                    case NullTag:
+                        return TypeId::Null;
+                    case BoolTag:
+                        return TypeId::Bool;
+                    case IntTag:
+                        return TypeId::Int;
+                    case UIntTag:
+                        return TypeId::UInt;
+                    case FloatTag:
+                        return TypeId::Float;
+                    default:
+                        return TypeId::Invalid;
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                // TODO: implement abstract type deduction, do not support abstract value for now
+                return TypeId::Invalid;
+            }
+            
+            return TypeId::Double;
+        }
+
+        template<typename F>
+        constexpr auto apply( F f )
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return f( getTypeId() );
+                    case NullTag:
+                        return f( getNull() );
+                    case IntTag:
+                        return f( getInt() );
+                    case UIntTag:
+                        return f( getUInt() );
+                    case FloatTag:
+                        return f( getFloat() );
+                    default:
+                    {
+                        nassert( false, "Value", "Invalid tag, value corruption detected" );
+                        // return as if value is null
+                        return f( getNull() );
+                    }
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                return f( getReference() );
+            }
+
+            return f( getDouble() );
+        }
+    };
+
+    enum class RingProducers
+    {
+        Single,
+        Multiple,
+    };
+
+    // one field of a record, scalars travel as their value word, strings and arrays are copied out of line
+    struct RingField
+    {
+        static constexpr uint32 Scalar = 0;
+        static constexpr uint32 String = 1;
+        static constexpr uint32 Array = 2;
+
+        Value value;
+        uint32 kind;
+        uint32 length;
+        const void* data;
+
+        static RingField scalar( Value value ) { return { value, Scalar, 0, nullptr }; }
+        static RingField string( std::string_view text ) { return { Value(), String, static_cast<uint32>( text.size() ), text.data() }; }
+        static RingField array( const Value* values, uint32 count ) { return { Value(), Array, count, values }; }
+    };
+
+    // lock free ring of records in POSIX shared memory, one consumer and one or many producers
+    // record layout: header, one value word per field, then the out of line payloads, all 16 byte aligned
+    // an out of line field is a reference layout word holding its payload offset from the record start,
+    // the consumer turns it into a pointer into its own mapping so payloads are read in place
+    template<RingProducers Producers>
+    class ValueRing
+    {
+        struct Header
+        {
+            static constexpr uint32 Magic = 0x52564c41;
+
+            uint32 magic;
+            uint32 reserved;
+            uint64 capacity;
+
+            // futex words, bumped on every commit and release, waiters only register when the ring stays idle
+            alignas( 64 ) std::atomic<uint32> commit_epoch;
+            std::atomic<uint32> consumer_waiting;
+            alignas( 64 ) std::atomic<uint32> release_epoch;
+            std::atomic<uint32> producers_waiting;
+
+            alignas( 64 ) std::atomic<uint64> reserve;
+            alignas( 64 ) std::atomic<uint64> head;
+        };
+
+        // sequence is the record position plus one and written last, consumed records are zeroed,
+        // so a header position still holding an older lap's payload never looks committed
+        struct RecordHeader
+        {
+            uint64 sequence;
+            uint32 size;
+            uint32 count;
+        };
+
+        struct OutOfLine
+        {
+            uint32 kind;
+            uint32 length;
+        };
+
+        static constexpr uint32 PaddingRecord = ~uint32( 0 );
+        static constexpr uint32 SpinCount = 256;
+
+    public:
+        class Record
+        {
+        public:
+            inline uint32 getCount() const { return header->count; }
+
+            // out of line fields come back as references into the mapping, valid until release
+            inline Value operator[]( uint32 index ) const
+            {
+                Value value = getWords()[ index ];
+                if( value.isReference() )
+                {
+                    return Value( static_cast<void*>( reinterpret_cast<unsigned char*>( header ) + reinterpret_cast<uint64>( value.getReference() ) ) );
+                }
+                return value;
+            }
+
+            inline bool isString( uint32 index ) const { return isOutOfLine( index, RingField::String ); }
+            inline bool isArray( uint32 index ) const { return isOutOfLine( index, RingField::Array ); }
+
+            std::string_view getString( uint32 index ) const
+            {
+                const OutOfLine* payload = getPayload( index );
+                return std::string_view( reinterpret_cast<const char*>( payload + 1 ), payload->length );
+            }
+
+            const Value* getArray( uint32 index, uint32& length ) const
+            {
+                const OutOfLine* payload = getPayload( index );
+                length = payload->length;
+                return reinterpret_cast<const Value*>( payload + 1 );
+            }
+
+        private:
+            friend class ValueRing;
+
+            explicit Record( RecordHeader* header )
+                : header( header )
+            {
+            }
+
+            inline const Value* getWords() const { return reinterpret_cast<const Value*>( header + 1 ); }
+
+            inline bool isOutOfLine( uint32 index, uint32 kind ) const
+            {
+                return getWords()[ index ].isReference() && getPayload( index )->kind == kind;
+            }
+
+            inline const OutOfLine* getPayload( uint32 index ) const
+            {
+                return static_cast<const OutOfLine*>( ( *this )[ index ].getReference() );
+            }
+
+            RecordHeader* header;
+        };
+
+        // capacity is rounded up to a power of two, a single record may use at most half of it
+        static ValueRing create( const char* name, uint64 capacity )
+        {
+            uint64 rounded = 4096;
+            while( rounded < capacity )
+            {
+                rounded <<= 1;
+            }
+
+            int fd = shm_open( name, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+            if( fd < 0 )
+            {
+                return ValueRing();
+            }
+
+            size_t size = sizeof( Header ) + rounded;
+            if( ftruncate( fd, static_cast<off_t>( size ) ) != 0 )
+            {
+                close( fd );
+                return ValueRing();
+            }
+
+            ValueRing ring = map( fd, size );
+            if( ring.header != nullptr )
+            {
+                // ftruncate zero filled the region, only the geometry has to be written
+                ring.header->capacity = rounded;
+                ring.mask = rounded - 1;
+                std::atomic_thread_fence( std::memory_order_release );
+                std::atomic_ref<uint32>( ring.header->magic ).store( Header::Magic, std::memory_order_release );
+            }
+            return ring;
+        }
+
+        static ValueRing open( const char* name )
+        {
+            int fd = shm_open( name, O_RDWR, 0600 );
+            if( fd < 0 )
+            {
+                return ValueRing();
+            }
+
+            struct stat status;
+            if( fstat( fd, &status ) != 0 || static_cast<size_t>( status.st_size ) <= sizeof( Header ) )
+            {
+                close( fd );
+                return ValueRing();
+            }
+
+            ValueRing ring = map( fd, static_cast<size_t>( status.st_size ) );
+            if( ring.header != nullptr )
+            {
+                if( std::atomic_ref<uint32>( ring.header->magic ).load( std::memory_order_acquire ) != Header::Magic )
+                {
+                    return ValueRing();
+                }
+                ring.mask = ring.header->capacity - 1;
+            }
+            return ring;
+        }
+
+        static void unlink( const char* name ) { shm_unlink( name ); }
+
+        ValueRing()
+            : header( nullptr )
+            , data( nullptr )
+            , mapped_size( 0 )
+            , mask( 0 )
+        {
+        }
+
+        ValueRing( ValueRing&& other )
+            : header( other.header )
+            , data( other.data )
+            , mapped_size( other.mapped_size )
+            , mask( other.mask )
+        {
+            other.header = nullptr;
+        }
+
+        ValueRing& operator=( ValueRing&& other )
+        {
+            std::swap( header, other.header );
+            std::swap( data, other.data );
+            std::swap( mapped_size, other.mapped_size );
+            std::swap( mask, other.mask );
+            return *this;
+        }
+
+        ~ValueRing()
+        {
+            if( header != nullptr )
+            {
+                munmap( header, mapped_size );
+            }
+        }
+
+        inline bool isValid() const { return header != nullptr; }
+
+        // producer side, blocks on a futex while the ring is full unless told not to
+        // a record larger than half the ring could never be claimed and is refused up front, even when blocking
+        bool send( const RingField* fields, uint32 count, bool block = true )
+        {
+            uint64 size = align( sizeof( RecordHeader ) + count * sizeof( Value ) );
+            for( uint32 i = 0; i < count; ++i )
+            {
+                if( fields[ i ].kind == RingField::String )
+                {
+                    size += align( sizeof( OutOfLine ) + fields[ i ].length );
+                }
+                else if( fields[ i ].kind == RingField::Array )
+                {
+                    size += align( sizeof( OutOfLine ) + fields[ i ].length * sizeof( Value ) );
+                }
+            }
+
+            if( size > header->capacity / 2 )
+            {
+                return false;
+            }
+
+            uint64 position;
+            uint64 padding;
+            while( !claim( size, position, padding ) )
+            {
+                if( !block )
+                {
+                    return false;
+                }
+                waitForRelease( padding + size );
+            }
+
+            if( padding != 0 )
+            {
+                RecordHeader* pad = getRecord( position );
+                pad->size = static_cast<uint32>( padding );
+                pad->count = PaddingRecord;
+                std::atomic_ref<uint64>( pad->sequence ).store( position + 1, std::memory_order_release );
+                position += padding;
+            }
+
+            RecordHeader* record = getRecord( position );
+            unsigned char* base = reinterpret_cast<unsigned char*>( record );
+            Value* words = reinterpret_cast<Value*>( record + 1 );
+            uint64 offset = align( sizeof( RecordHeader ) + count * sizeof( Value ) );
+
+            for( uint32 i = 0; i < count; ++i )
+            {
+                const RingField& field = fields[ i ];
+                if( field.kind == RingField::Scalar )
+                {
+                    nassert( !field.value.isReference(), "ValueRing", "Process local reference can not be sent" );
+                    words[ i ] = field.value;
+                    continue;
+                }
+
+                size_t bytes = field.kind == RingField::String ? field.length : field.length * sizeof( Value );
+                OutOfLine* payload = reinterpret_cast<OutOfLine*>( base + offset );
+                payload->kind = field.kind;
+                payload->length = field.length;
+                memcpy( payload + 1, field.data, bytes );
+
+                words[ i ] = Value( reinterpret_cast<void*>( offset ) );
+                offset += align( sizeof( OutOfLine ) + bytes );
+            }
+
+            record->size = static_cast<uint32>( size );
+            record->count = count;
+            std::atomic_ref<uint64>( record->sequence ).store( position + 1, std::memory_order_release );
+
+            header->commit_epoch.fetch_add( 1, std::memory_order_seq_cst );
+            if( header->consumer_waiting.load( std::memory_order_seq_cst ) != 0 )
+            {
+                futexWake( header->commit_epoch );
+            }
+
+            return true;
+        }
+
+        // consumer side, the record stays readable in place until release
+        bool tryReceive( Record& record )
+        {
+            while( true )
+            {
+                uint64 head = header->head.load( std::memory_order_relaxed );
+                RecordHeader* candidate = getRecord( head );
+                if( std::atomic_ref<uint64>( candidate->sequence ).load( std::memory_order_acquire ) != head + 1 )
+                {
+                    return false;
+                }
+
+                if( candidate->count != PaddingRecord )
+                {
+                    record = Record( candidate );
+                    return true;
+                }
+
+                advance( head, candidate->size );
+            }
+        }
+
+        Record receive()
+        {
+            Record record( nullptr );
+            while( true )
+            {
+                for( uint32 spin = 0; spin < SpinCount; ++spin )
+                {
+                    if( tryReceive( record ) )
+                    {
+                        return record;
+                    }
+                }
+
+                uint32 epoch = header->commit_epoch.load( std::memory_order_seq_cst );
+                header->consumer_waiting.store( 1, std::memory_order_seq_cst );
+                if( !tryReceive( record ) )
+                {
+                    futexWait( header->commit_epoch, epoch );
+                }
+                header->consumer_waiting.store( 0, std::memory_order_seq_cst );
+            }
+        }
+
+        void release( const Record& record )
+        {
+            advance( header->head.load( std::memory_order_relaxed ), record.header->size );
+        }
+
+    private:
+        static ValueRing map( int fd, size_t size )
+        {
+            void* memory = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+            close( fd );
+
+            ValueRing ring;
+            if( memory != MAP_FAILED )
+            {
+                ring.header = static_cast<Header*>( memory );
+                ring.data = static_cast<unsigned char*>( memory ) + sizeof( Header );
+                ring.mapped_size = size;
+            }
+            return ring;
+        }
+
+        static inline uint64 align( uint64 size ) { return ( size + 15 ) & ~uint64( 15 ); }
+
+        inline RecordHeader* getRecord( uint64 position ) { return reinterpret_cast<RecordHeader*>( data + ( position & mask ) ); }
+
+        // records never wrap, a claim that would cross the end also takes the tail as padding
+        bool claim( uint64 size, uint64& position, uint64& padding )
+        {
+            uint64 capacity = header->capacity;
+            position = header->reserve.load( std::memory_order_relaxed );
+
+            while( true )
+            {
+                uint64 offset = position & mask;
+                padding = offset + size > capacity ? capacity - offset : 0;
+                uint64 end = position + padding + size;
+
+                if( end - header->head.load( std::memory_order_acquire ) > capacity )
+                {
+                    return false;
+                }
+
+                if constexpr( Producers == RingProducers::Single )
+                {
+                    header->reserve.store( end, std::memory_order_relaxed );
+                    return true;
+                }
+                else if( header->reserve.compare_exchange_weak( position, end, std::memory_order_relaxed ) )
+                {
+                    return true;
+                }
+            }
+        }
+
+        void advance( uint64 head, uint64 size )
+        {
+            memset( getRecord( head ), 0, size );
+            header->head.store( head + size, std::memory_order_release );
+
+            header->release_epoch.fetch_add( 1, std::memory_order_seq_cst );
+            if( header->producers_waiting.load( std::memory_order_seq_cst ) != 0 )
+            {
+                futexWake( header->release_epoch );
+            }
+        }
+
+        // needed is what the failed claim asked for, the record plus the padding to the ring end,
+        // so the producer only retries once that much is free behind the current reservation
+        void waitForRelease( uint64 needed )
+        {
+            uint64 capacity = header->capacity;
+            for( uint32 spin = 0; spin < SpinCount; ++spin )
+            {
+                if( header->reserve.load( std::memory_order_relaxed ) - header->head.load( std::memory_order_acquire ) + needed <= capacity )
+                {
+                    return;
+                }
+            }
+
+            uint32 epoch = header->release_epoch.load( std::memory_order_seq_cst );
+            header->producers_waiting.fetch_add( 1, std::memory_order_seq_cst );
+            if( header->reserve.load( std::memory_order_seq_cst ) - header->head.load( std::memory_order_seq_cst ) + needed > capacity )
+            {
+                futexWait( header->release_epoch, epoch );
+            }
+            header->producers_waiting.fetch_sub( 1, std::memory_order_seq_cst );
+        }
+
+        // shared futexes, the private flavour std::atomic::wait uses does not work across processes
+        static void futexWait( std::atomic<uint32>& word, uint32 expected )
+        {
+            syscall( SYS_futex, reinterpret_cast<uint32*>( &word ), FUTEX_WAIT, expected, nullptr, nullptr, 0 );
+        }
+
+        static void futexWake( std::atomic<uint32>& word )
+        {
+            syscall( SYS_futex, reinterpret_cast<uint32*>( &word ), FUTEX_WAKE, 0x7fffffff, nullptr, nullptr, 0 );
+        }
+
+        Header* header;
+        unsigned char* data;
+        size_t mapped_size;
+        uint64 mask;
+    };
+}
+
+using Value = ::Nickel::System::Runtime::Alchemy::Value;
+using TypeId = ::Nickel::System::Runtime::Alchemy::TypeId;
+using RingField = ::Nickel::System::Runtime::Alchemy::RingField;
+using RingProducers = ::Nickel::System::Runtime::Alchemy::RingProducers;
+
+template<RingProducers Producers>
+using ValueRing = ::Nickel::System::Runtime::Alchemy::ValueRing<Producers>;
+
+static constexpr uint32 ProducerCount = 3;
+static constexpr uint32 RecordCount = 100000;
+
+// every producer sends ( id, sequence, name, samples ) records, the parent checks them all
+static void produce( const char* name, uint32 id )
+{
+    auto ring = ValueRing<RingProducers::Multiple>::open( name );
+    if( !ring.isValid() )
+    {
+        _exit( 1 );
+    }
+
+    Value samples[ 16 ];
+    for( uint32 i = 0; i < RecordCount; ++i )
+    {
+        for( uint32 j = 0; j < 16; ++j )
+        {
+            samples[ j ] = Value( double( i + j ) );
+        }
+
+        RingField fields[] =
+        {
+            RingField::scalar( Value( id ) ),
+            RingField::scalar( Value( i ) ),
+            RingField::string( "sample" ),
+            RingField::array( samples, 16 ),
+        };
+        ring.send( fields, 4 );
+    }
+
+    _exit( 0 );
+}
+
+int main( int argc, char** argv )
+{
+    const char* name = "/alchemy-value-ring";
+    auto ring = ValueRing<RingProducers::Multiple>::create( name, 1 << 20 );
+    if( !ring.isValid() )
+    {
+        return 1;
+    }
+
+    pid_t producers[ ProducerCount ];
+    for( uint32 id = 0; id < ProducerCount; ++id )
+    {
+        producers[ id ] = fork();
+        if( producers[ id ] == 0 )
+        {
+            produce( name, id );
+        }
+    }
+
+    uint32 next_sequence[ ProducerCount ] = {};
+    int result = 0;
+    for( uint32 i = 0; i < ProducerCount * RecordCount; ++i )
+    {
+        auto record = ring.receive();
+
+        uint32 id = record[ 0 ].getUInt();
+        uint32 sequence = record[ 1 ].getUInt();
+        result += sequence == next_sequence[ id ]++ ? 0 : 1;
+        result += record.isString( 2 ) && record.getString( 2 ) == "sample" ? 0 : 1;
+
+        uint32 length = 0;
+        const Value* samples = record.getArray( 3, length );
+        result += length == 16 && samples[ 15 ].getDouble() == double( sequence + 15 ) ? 0 : 1;
+
+        ring.release( record );
+    }
+
+    for( pid_t producer : producers )
+    {
+        int status = 0;
+        waitpid( producer, &status, 0 );
+        result += WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ? 0 : 1;
+    }
+
+    // the tagged constants are short layout words and must arrive as themselves, not as rebased payload offsets
+    RingField constants[] =
+    {
+        RingField::scalar( Value( nullptr ) ),
+        RingField::scalar( Value( true ) ),
+        RingField::scalar( Value( false ) ),
+        RingField::scalar( Value( TypeId( TypeId::Int ) ) ),
+        RingField::scalar( Value( Value::InvalidType ) ),
+    };
+    result += ring.send( constants, 5 ) ? 0 : 1;
+    {
+        auto record = ring.receive();
+        result += record[ 0 ].isNull() && !record[ 0 ].isReference() ? 0 : 1;
+        result += record[ 1 ].isBool() && record[ 1 ].getBool() ? 0 : 1;
+        result += record[ 2 ].isBool() && !record[ 2 ].getBool() ? 0 : 1;
+        result += record[ 3 ].isTypeId() && record[ 3 ].getTypeId().value == TypeId::Int ? 0 : 1;
+        result += record[ 4 ].isTypeId() && !record[ 4 ].isValid() ? 0 : 1;
+        ring.release( record );
+    }
+
+    // a blocking send of a record that can never fit returns instead of waiting for room forever
+    static Value oversized[ 65536 ];
+    RingField too_large = RingField::array( oversized, 65536 );
+    result += !ring.send( &too_large, 1 ) ? 0 : 1;
+
+    ValueRing<RingProducers::Multiple>::unlink( name );
+    return result == 0 ? 0 : 1;
+}
\ No newline at end of file
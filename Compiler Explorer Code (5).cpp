@@ -0,0 +1,3220 @@
+#include <cstdio>
+#include <concepts>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstring>
+#include <string_view>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+
+using uint8 = unsigned char;
+using uint16 = unsigned short;
+using int32 = int;
+using uint32 = unsigned int;
+using int64 = long long int;
+using uint64 = long long unsigned int;
+using std::nullptr_t;
+using std::size_t;
+
+#define nassert(...)
+
+namespace Nickel::System::Runtime::Alchemy
+{
+    struct TypeId
+    {
+        static constexpr uint32 Invalid = 0;
+        static constexpr uint32 Type = 1;
+        static constexpr uint32 Null = 2;
+        static constexpr uint32 Bool = 3;
+        static constexpr uint32 Int = 4;
+        static constexpr uint32 UInt = 5;
+        static constexpr uint32 Float = 6;
+        static constexpr uint32 Double = 7;
+
+        uint32 value;
+
+        constexpr TypeId()
+            : value( Invalid )
+        {
+        }
+
+        constexpr TypeId( uint32 value )
+            : value( value )
+        {
+        }
+
+        explicit operator uint32() const { return value; }
+        explicit operator bool() const { return value != 0; }
+
+        static constexpr const char* getName( uint32 type_id )
+        {
+            switch( type_id )
+            {
+                case Type: return "type";
+                case Null: return "null";
+                case Bool: return "bool";
+                case Int: return "int";
+                case UInt: return "uint";
+                case Float: return "float";
+                case Double: return "double";
+            }
+
+            return "(invalid)";
+        }
+    };
+
+    class Value
+    {
+        // tagged value layouts
+
+        // short layout ( 32bit )
+        // type: 0xffff0000 + 32bit type id
+        // null: 0xffff0001 + 00000000
+        // bool(true): 0xffff0002 + 00000001
+        // bool(false): 0xffff0002 + 00000000
+        // int: 0xffff0003 + 32bit payload
+        // uint: 0xffff0004 + 32bit payload
+        // float: 0xffff0005 + 32bit payload
+
+        // reference layout ( 48bit )
+        // reference: 0x0000 + 48bit payload(pointer)
+        // reference include string, tuple, array, function, object, cfunction, cobject
+
+        // long layout ( 64bit )
+        // double: range( 0x0001, 0xfffe ) + ( native_double_value + 0x0001000000000000 );
+
+        static constexpr uint64 LayoutMask = 0xffff000000000000;
+        static constexpr uint64 ShortLayout = 0xffff000000000000;
+        static constexpr uint64 ReferenceLayout = 0x0000000000000000;
+        
+        static constexpr uint64 LongValueTagMask = 0xffff000000000000;
+        static constexpr uint32 ReferenceTag = 0x0000000000000000;
+
+        static constexpr uint32 TypeIdTag = 0xffff0000;
+        static constexpr uint32 NullTag = 0xffff0001;
+        static constexpr uint32 BoolTag = 0xffff0002;
+        static constexpr uint32 IntTag = 0xffff0003;
+        static constexpr uint32 UIntTag = 0xffff0004;
+        static constexpr uint32 FloatTag = 0xffff0005;
+        
+        static constexpr uint64 DoubleEncodingOffset = 0x0001000000000000;
+        static constexpr uint64 ReferenceEncodingMask = 0x0000ffffffffffff;
+
+    public:
+        static constexpr uint64 InvalidType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Invalid;
+        static constexpr uint64 TypeType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Type;
+        static constexpr uint64 NullType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Null;
+        static constexpr uint64 BoolType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Bool;
+        static constexpr uint64 IntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Int;
+        static constexpr uint64 UIntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::UInt;
+        static constexpr uint64 FloatType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Float;
+        static constexpr uint64 DoubleType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Double;
+
+        static constexpr uint64 NullValue = uint64( NullTag ) << 32;
+        static constexpr uint64 TrueValue = ( uint64( BoolTag ) << 32 ) | 0x00000001;
+        static constexpr uint64 FalseValue = ( uint64( BoolTag ) << 32 ) | 0x00000000;
+
+    private:
+        union
+        {
+            uint64 data;
+
+            struct
+            {
+                union
+                {
+                    TypeId type_id;
+                    int32 int_value;
+                    uint32 uint_value;
+                    float float_value;
+                } value;
+
+                uint32 tag;
+
+            } short_layout;
+
+            struct
+            {
+                union
+                {
+                    double double_value;
+                    uint64 double_data;
+                } value;
+            } double_layout;
+
+            struct
+            {
+                void* reference_value;
+            } reference_layout;
+        };
+
+        static inline constexpr Value encodeDouble( double value )
+        {
+            Value v;
+            v.double_layout.value.double_value = value;
+            v.double_layout.value.double_data += DoubleEncodingOffset;
+
+            return v;
+        }
+
+        static inline constexpr double decodeDouble( Value value )
+        {
+            value.double_layout.value.double_data -= DoubleEncodingOffset;
+            return value.double_layout.value.double_value;
+        }
+
+    public:
+        constexpr Value()
+            : data { NullValue }
+        {
+        }
+
+        constexpr Value( uint64 data )
+            : data( data )
+        {
+        }
+
+        constexpr Value( TypeId value )
+        {
+            setTypeId( value );
+        }
+
+        constexpr Value( nullptr_t )
+        {
+            setNull();
+        }
+
+        constexpr Value( bool value )
+        {
+            setBool( value );
+        }
+
+        constexpr Value( int32 value )
+        {
+            setInt( value );
+        }
+
+        constexpr Value( uint32 value )
+        {
+            setUInt( value );
+        }
+
+        constexpr Value( float value )
+        {
+            setFloat( value );
+        }
+
+        constexpr Value( void* value )
+        {
+            setReference( value );
+        }
+
+        constexpr Value( double value )
+        {
+            setDouble( value );
+        }
+
+        explicit operator nullptr_t() const { nassert( isNull() ); return nullptr; }
+        explicit operator bool() const { nassert( isBool() ); return getBool(); }
+        //explicit operator int32() const { nassert( isInt() ); return getInt(); }
+        explicit operator uint32() const { nassert( isUInt() ); return getUInt(); }
+        explicit operator float() const { nassert( isFloat() ); return getFloat(); }
+        explicit operator void*() const { nassert( isReference() ); return getReference(); }
+        explicit operator double() const { nassert( isDouble() ); return getDouble(); }
+
+        inline constexpr bool isShortLayout() const { return ( data & LayoutMask ) == ShortLayout; }
+        inline constexpr bool isReferenceLayout() const { return ( data & LayoutMask ) == ReferenceLayout; }
+        inline constexpr bool isDoubleLayout() const { return !isShortLayout() && !isReferenceLayout(); }
+
+        inline constexpr bool isTypeId() const { return short_layout.tag == TypeIdTag; }
+        inline constexpr void setTypeId( TypeId value ) { short_layout = { { .type_id = value }, TypeIdTag }; }
+        inline constexpr TypeId getTypeId() const { return short_layout.value.type_id; }
+
+        inline constexpr bool isNull() const { return short_layout.tag == NullTag; }
+        inline constexpr void setNull() { data = NullValue; }
+        inline constexpr nullptr_t getNull() { return nullptr; }
+
+        inline constexpr bool isBool() const { return short_layout.tag == BoolTag; }
+        inline constexpr void setBool( bool value ) { data = value ? TrueValue : FalseValue; }
+        inline constexpr bool getBool() const { return data == TrueValue; }
+        inline constexpr void setTrue() { data = TrueValue; }
+        inline constexpr void setFalse() { data = FalseValue; }
+        inline constexpr bool isTrue() const { return data == TrueValue; }
+        inline constexpr bool isFalse() const { return data == FalseValue; }
+
+        inline constexpr bool isInt() const { return short_layout.tag == IntTag; }
+        inline constexpr void setInt( int32 value ) { short_layout = { { .int_value = value }, IntTag }; }
+        inline constexpr int32 getInt() const { return short_layout.value.int_value; }
+
+        inline constexpr bool isUInt() const { return short_layout.tag == UIntTag; }
+        inline constexpr void setUInt( uint32 value ) { short_layout = { { .uint_value = value }, UIntTag }; }
+        inline constexpr uint32 getUInt() const { return short_layout.value.uint_value; }
+
+        inline constexpr bool isFloat() const { return short_layout.tag == FloatTag; }
+        inline constexpr void setFloat( float value ) { short_layout = { { .float_value = value }, FloatTag }; }
+        inline constexpr float getFloat() const { return short_layout.value.float_value; }
+
+        inline constexpr bool isReference() const { return isReferenceLayout(); }
+        inline constexpr void setReference( void* value ) { reference_layout.reference_value = value; }
+        inline constexpr void* getReference() const { return reference_layout.reference_value; }
+
+        inline constexpr bool isDouble() const { return isDoubleLayout(); }
+        inline constexpr void setDouble( double value ) { *this = encodeDouble( value ); }
+        inline constexpr double getDouble() const { return decodeDouble( *this ); }
+
+        inline constexpr bool isNumeric() const { return isInt() || isUInt() || isFloat() || isDouble(); }
+        inline constexpr bool isValid() const { return data != InvalidType; }
+
+        inline constexpr TypeId getType() const
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return TypeId::Type;
+                    case NullTag:
+                        return TypeId::Null;
+                    case BoolTag:
+                        return TypeId::Bool;
+                    case IntTag:
+                        return TypeId::Int;
+                    case UIntTag:
+                        return TypeId::UInt;
+                    case FloatTag:
+                        return TypeId::Float;
+                    default:
+                        return TypeId::Invalid;
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                // TODO: implement abstract type deduction, do not support abstract value for now
+                return TypeId::Invalid;
+            }
+            
+            return TypeId::Double;
+        }
+
+        template<typename F>
+        constexpr auto apply( F f )
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return f( getTypeId() );
+                    case NullTag:
+                        return f( getNull() );
+                    case IntTag:
+                        return f( getInt() );
+                    case UIntTag:
+                        return f( getUInt() );
+                    case FloatTag:
+                        return f( getFloat() );
+                    default:
+                    {
+                        nassert( false, "Value", "Invalid tag, value corruption detected" );
+                        // return as if value is null
+                        return f( getNull() );
+                    }
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                return f( getReference() );
+            }
+
+            return f( getDouble() );
+        }
+    };
+
+    // every heap object starts with this header, its Value fields follow inline
+    // free chunks are objects of kind Free, so a space can always be walked linearly
+    // marking never writes here, mark bits live in a side bitmap
+    struct HeapObject
+    {
+        static constexpr uint16 Free = 0;
+        static constexpr uint16 Tuple = 1;
+        static constexpr uint16 Array = 2;
+        static constexpr uint16 String = 3;
+        static constexpr uint16 CObject = 4;
+
+        static constexpr uint16 Forwarded = 0x01;
+
+        static constexpr uint32 Alignment = 16;
+        // room for a forwarding pointer or a free list link behind the header
+        static constexpr uint32 MinimumSize = 32;
+
+        uint32 size;
+        uint16 kind;
+        uint16 flags;
+        uint32 field_count;
+        // granule offset from the old space base of the address compaction slides this object to
+        uint32 relocation;
+
+        inline Value* getFields() { return reinterpret_cast<Value*>( this + 1 ); }
+        inline char* getCharacters() { return reinterpret_cast<char*>( this + 1 ); }
+        inline HeapObject* getNext() { return reinterpret_cast<HeapObject*>( reinterpret_cast<unsigned char*>( this ) + size ); }
+
+        static inline uint32 getAllocationSize( uint32 field_count, uint32 byte_count )
+        {
+            uint32 size = ( sizeof( HeapObject ) + field_count * sizeof( Value ) + byte_count + Alignment - 1 ) & ~( Alignment - 1 );
+            return size < MinimumSize ? MinimumSize : size;
+        }
+
+        inline HeapObject* getForward() { return *reinterpret_cast<HeapObject**>( this + 1 ); }
+
+        inline void setFree( uint32 free_size )
+        {
+            size = free_size;
+            kind = Free;
+            flags = 0;
+            field_count = 0;
+        }
+
+        inline void setForward( HeapObject* target )
+        {
+            flags |= Forwarded;
+            *reinterpret_cast<HeapObject**>( this + 1 ) = target;
+        }
+    };
+
+    static_assert( sizeof( HeapObject ) == 16 );
+
+    // card geometry shared by the write barrier, the remembered set scan and the object start table
+    static constexpr uint32 CardShift = 9;
+    static constexpr size_t CardSize = size_t( 1 ) << CardShift;
+
+    // contiguous range inside the heap reservation, so any reference can be located by address arithmetic alone
+    // allocation takes an exact fit from the free bins, then first fit from the large list, then bumps the top
+    class OldSpace
+    {
+    public:
+        static constexpr uint32 BinCount = 128;
+        static constexpr uint32 MaxBinSize = BinCount * HeapObject::Alignment;
+        static constexpr uint8 NoStart = 0xff;
+        static constexpr size_t PageSize = 4096;
+
+        OldSpace( unsigned char* base, size_t reserved_size )
+            : base( base )
+            , top( base )
+            , reserved_size( reserved_size )
+        {
+            // per card, the offset of the first object starting in it, lets a dirty card find its objects
+            starts = static_cast<uint8*>( mmap( nullptr, reserved_size >> CardShift, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 ) );
+            memset( starts, NoStart, reserved_size >> CardShift );
+            clearFreeLists();
+        }
+
+        ~OldSpace()
+        {
+            munmap( starts, reserved_size >> CardShift );
+        }
+
+        OldSpace( const OldSpace& ) = delete;
+        OldSpace& operator=( const OldSpace& ) = delete;
+
+        inline bool contains( const void* pointer ) const { return pointer >= base && pointer < top; }
+        inline unsigned char* getBase() const { return base; }
+        inline unsigned char* getTop() const { return top; }
+
+        HeapObject* allocate( uint32 size )
+        {
+            HeapObject* object = nullptr;
+            if( size < MaxBinSize && bins[ size / HeapObject::Alignment ] != nullptr )
+            {
+                object = bins[ size / HeapObject::Alignment ];
+                bins[ size / HeapObject::Alignment ] = *reinterpret_cast<HeapObject**>( object->getFields() );
+                free_bytes -= size;
+            }
+            else if( ( object = takeLarge( size ) ) == nullptr )
+            {
+                nassert( top + size <= base + reserved_size, "OldSpace", "Old space exhausted" );
+                object = reinterpret_cast<HeapObject*>( top );
+                top += size;
+                recordStart( object );
+            }
+
+            object->size = size;
+            return object;
+        }
+
+        // turns [begin, begin + size) into one free chunk and files it
+        void addFree( unsigned char* begin, uint32 size )
+        {
+            HeapObject* chunk = reinterpret_cast<HeapObject*>( begin );
+            chunk->setFree( size );
+            recordStart( chunk );
+
+            HeapObject** list = size < MaxBinSize ? &bins[ size / HeapObject::Alignment ] : &large;
+            *reinterpret_cast<HeapObject**>( chunk->getFields() ) = *list;
+            *list = chunk;
+            free_bytes += size;
+        }
+
+        void clearFreeLists()
+        {
+            for( auto& bin : bins )
+            {
+                bin = nullptr;
+            }
+            large = nullptr;
+            free_bytes = 0;
+        }
+
+        inline size_t getFreeBytes() const { return free_bytes; }
+        inline size_t getUsedBytes() const { return top - base; }
+
+        // lowers the top and hands every whole page above it back to the kernel, they come back zeroed
+        void shrink( unsigned char* new_top )
+        {
+            nassert( new_top >= base && new_top <= top );
+            unsigned char* page = reinterpret_cast<unsigned char*>( ( reinterpret_cast<uintptr_t>( new_top ) + PageSize - 1 ) & ~( PageSize - 1 ) );
+            if( page < top )
+            {
+                madvise( page, top - page, MADV_DONTNEED );
+            }
+            top = new_top;
+        }
+
+        // entries only ever move down between sweeps, a sweep rebuilds them in address order
+        inline void recordStart( HeapObject* object )
+        {
+            size_t offset = reinterpret_cast<unsigned char*>( object ) - base;
+            uint8& entry = starts[ offset >> CardShift ];
+            uint8 start = static_cast<uint8>( ( offset & ( CardSize - 1 ) ) / HeapObject::Alignment );
+            if( entry == NoStart || start < entry )
+            {
+                entry = start;
+            }
+        }
+
+        void clearStarts()
+        {
+            memset( starts, NoStart, ( ( top - base ) >> CardShift ) + 1 );
+        }
+
+        // the object covering the first byte of a card, found by walking back to the nearest recorded start
+        // a start past the card's first byte means that byte belongs to an object begun in an earlier card
+        HeapObject* findObject( size_t card ) const
+        {
+            size_t start_card = card;
+            if( starts[ start_card ] != 0 )
+            {
+                nassert( start_card != 0 );
+                --start_card;
+                while( starts[ start_card ] == NoStart )
+                {
+                    nassert( start_card != 0 );
+                    --start_card;
+                }
+            }
+
+            unsigned char* card_begin = base + ( card << CardShift );
+            HeapObject* object = reinterpret_cast<HeapObject*>( base + ( start_card << CardShift ) + starts[ start_card ] * HeapObject::Alignment );
+            while( reinterpret_cast<unsigned char*>( object->getNext() ) <= card_begin )
+            {
+                object = object->getNext();
+            }
+            return object;
+        }
+
+        template<typename F>
+        void forEachObject( F f )
+        {
+            for( HeapObject* object = reinterpret_cast<HeapObject*>( base ); reinterpret_cast<unsigned char*>( object ) < top; )
+            {
+                HeapObject* next = object->getNext();
+                f( object );
+                object = next;
+            }
+        }
+
+    private:
+        HeapObject* takeLarge( uint32 size )
+        {
+            for( HeapObject** link = &large; *link != nullptr; link = reinterpret_cast<HeapObject**>( ( *link )->getFields() ) )
+            {
+                HeapObject* chunk = *link;
+                uint32 remainder = chunk->size - size;
+                if( chunk->size < size || ( remainder != 0 && remainder < HeapObject::MinimumSize ) )
+                {
+                    continue;
+                }
+
+                *link = *reinterpret_cast<HeapObject**>( chunk->getFields() );
+                free_bytes -= chunk->size;
+                if( remainder != 0 )
+                {
+                    addFree( reinterpret_cast<unsigned char*>( chunk ) + size, remainder );
+                }
+                return chunk;
+            }
+
+            return nullptr;
+        }
+
+        unsigned char* base;
+        unsigned char* top;
+        size_t reserved_size;
+        uint8* starts;
+
+        HeapObject* bins[ BinCount ];
+        HeapObject* large;
+        size_t free_bytes;
+    };
+
+    // one mark bit per allocation granule of the old space, kept away from the objects so that a cycle in a
+    // forked worker only dirties its own bitmap pages and the preloaded heap stays shared with the parent
+    class MarkBitmap
+    {
+    public:
+        static constexpr uint32 WordBits = 64;
+
+        MarkBitmap( const unsigned char* base, size_t covered_size )
+            : base( base )
+            , word_count( ( covered_size / HeapObject::Alignment + WordBits - 1 ) / WordBits )
+        {
+            words = static_cast<uint64*>( mmap( nullptr, word_count * sizeof( uint64 ), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 ) );
+            nassert( words != MAP_FAILED, "MarkBitmap", "Failed to reserve the mark bitmap" );
+        }
+
+        ~MarkBitmap()
+        {
+            munmap( words, word_count * sizeof( uint64 ) );
+        }
+
+        MarkBitmap( const MarkBitmap& ) = delete;
+        MarkBitmap& operator=( const MarkBitmap& ) = delete;
+
+        inline bool isMarked( const HeapObject* object ) const
+        {
+            size_t granule = getGranule( object );
+            return ( std::atomic_ref<uint64>( words[ granule / WordBits ] ).load( std::memory_order_relaxed ) & getBit( granule ) ) != 0;
+        }
+
+        // the plain load first keeps already marked objects off the locked instruction
+        inline bool tryMark( const HeapObject* object )
+        {
+            size_t granule = getGranule( object );
+            std::atomic_ref<uint64> word( words[ granule / WordBits ] );
+            uint64 bit = getBit( granule );
+            return ( word.load( std::memory_order_relaxed ) & bit ) == 0 && ( word.fetch_or( bit, std::memory_order_relaxed ) & bit ) == 0;
+        }
+
+        inline void mark( const HeapObject* object )
+        {
+            size_t granule = getGranule( object );
+            std::atomic_ref<uint64>( words[ granule / WordBits ] ).fetch_or( getBit( granule ), std::memory_order_relaxed );
+        }
+
+        // clears the words covering [begin, begin + size), begin is a multiple of WordBits granules
+        void clear( const unsigned char* begin, size_t size )
+        {
+            size_t first = getGranule( reinterpret_cast<const HeapObject*>( begin ) ) / WordBits;
+            size_t count = ( size / HeapObject::Alignment + WordBits - 1 ) / WordBits;
+            memset( words + first, 0, ( first + count < word_count ? count : word_count - first ) * sizeof( uint64 ) );
+        }
+
+    private:
+        inline size_t getGranule( const HeapObject* object ) const { return ( reinterpret_cast<const unsigned char*>( object ) - base ) / HeapObject::Alignment; }
+        static inline uint64 getBit( size_t granule ) { return uint64( 1 ) << ( granule % WordBits ); }
+
+        const unsigned char* base;
+        size_t word_count;
+        uint64* words;
+    };
+
+    // non-moving objects for pinned cobjects, external strings and anything whose address C++ holds on to
+    // segregated fit: every 64 KiB slab is cut into cells of one size class, free cells are Free objects linked
+    // through their first field. threads allocate from their own PinnedCache and trade whole batches with the
+    // central list of each class, which is the only place that takes a lock
+    class PinnedSpace
+    {
+    public:
+        static constexpr uint32 SlabShift = 16;
+        static constexpr size_t SlabSize = size_t( 1 ) << SlabShift;
+        static constexpr uint32 ClassCount = 16;
+        static constexpr uint32 ClassSizes[ ClassCount ] = { 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 768, 1024, 1536, 2048 };
+        static constexpr uint32 MaxSize = 2048;
+        static constexpr uint32 BatchSize = 32;
+        static constexpr uint8 NoClass = 0xff;
+
+        struct Statistics
+        {
+            size_t slabs = 0;
+            uint64 allocations = 0;
+            uint64 refills = 0;
+            uint64 returns = 0;
+            size_t free_cells = 0;
+            size_t live_cells = 0;
+        };
+
+        PinnedSpace( unsigned char* base, size_t reserved_size )
+            : base( base )
+            , top( base )
+            , reserved_size( reserved_size )
+        {
+            slab_classes = static_cast<uint8*>( mmap( nullptr, reserved_size >> SlabShift, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 ) );
+            memset( slab_classes, NoClass, reserved_size >> SlabShift );
+
+            uint32 size_class = 0;
+            for( uint32 granules = 0; granules <= MaxSize / HeapObject::Alignment; ++granules )
+            {
+                while( ClassSizes[ size_class ] < granules * HeapObject::Alignment )
+                {
+                    ++size_class;
+                }
+                class_lookup[ granules ] = static_cast<uint8>( size_class );
+            }
+        }
+
+        ~PinnedSpace()
+        {
+            munmap( slab_classes, reserved_size >> SlabShift );
+        }
+
+        PinnedSpace( const PinnedSpace& ) = delete;
+        PinnedSpace& operator=( const PinnedSpace& ) = delete;
+
+        inline bool contains( const void* pointer ) const { return pointer >= base && pointer < base + reserved_size; }
+        inline unsigned char* getBase() const { return base; }
+        inline size_t getUsedBytes() const { return top.load( std::memory_order_acquire ) - base; }
+        inline uint32 getClass( uint32 size ) const { return class_lookup[ size / HeapObject::Alignment ]; }
+        inline uint8 getSlabClass( size_t slab ) const { return slab_classes[ slab ]; }
+
+        // takes up to BatchSize cells off the central list, carving a fresh slab when it is empty
+        HeapObject* takeBatch( uint32 size_class, uint32& count, uint64 allocations )
+        {
+            Central& central = centrals[ size_class ];
+            std::lock_guard<std::mutex> lock( central.mutex );
+            central.statistics.allocations += allocations;
+            if( central.free == nullptr )
+            {
+                carveSlab( size_class, central );
+            }
+
+            HeapObject* batch = central.free;
+            HeapObject* last = batch;
+            count = 1;
+            while( count < BatchSize && getLink( last ) != nullptr )
+            {
+                last = getLink( last );
+                ++count;
+            }
+
+            central.free = getLink( last );
+            setLink( last, nullptr );
+            central.statistics.free_cells -= count;
+            ++central.statistics.refills;
+            return batch;
+        }
+
+        void returnBatch( uint32 size_class, HeapObject* first, HeapObject* last, uint32 count, uint64 allocations )
+        {
+            Central& central = centrals[ size_class ];
+            std::lock_guard<std::mutex> lock( central.mutex );
+            central.statistics.allocations += allocations;
+            setLink( last, central.free );
+            central.free = first;
+            central.statistics.free_cells += count;
+            ++central.statistics.returns;
+        }
+
+        // stop the world: unmarked cells go back to their central list, live cells are counted per class
+        template<typename IsLive>
+        void sweep( IsLive is_live )
+        {
+            for( auto& central : centrals )
+            {
+                central.statistics.live_cells = 0;
+            }
+
+            size_t slab_count = getUsedBytes() >> SlabShift;
+            for( size_t slab = 0; slab < slab_count; ++slab )
+            {
+                uint32 size_class = slab_classes[ slab ];
+                Central& central = centrals[ size_class ];
+                uint32 size = ClassSizes[ size_class ];
+                unsigned char* begin = base + ( slab << SlabShift );
+                unsigned char* end = begin + SlabSize / size * size;
+                for( unsigned char* cell = begin; cell < end; cell += size )
+                {
+                    HeapObject* object = reinterpret_cast<HeapObject*>( cell );
+                    if( object->kind == HeapObject::Free )
+                    {
+                        continue;
+                    }
+
+                    if( is_live( object ) )
+                    {
+                        ++central.statistics.live_cells;
+                        continue;
+                    }
+
+                    object->setFree( size );
+                    setLink( object, central.free );
+                    central.free = object;
+                    ++central.statistics.free_cells;
+                }
+            }
+        }
+
+        // cells in use, each slab holds a single class so the walk is plain stride arithmetic
+        template<typename F>
+        void forEachObject( F f )
+        {
+            size_t slab_count = getUsedBytes() >> SlabShift;
+            for( size_t slab = 0; slab < slab_count; ++slab )
+            {
+                uint32 size = ClassSizes[ slab_classes[ slab ] ];
+                unsigned char* begin = base + ( slab << SlabShift );
+                unsigned char* end = begin + SlabSize / size * size;
+                for( unsigned char* cell = begin; cell < end; cell += size )
+                {
+                    if( reinterpret_cast<HeapObject*>( cell )->kind != HeapObject::Free )
+                    {
+                        f( reinterpret_cast<HeapObject*>( cell ) );
+                    }
+                }
+            }
+        }
+
+        Statistics getStatistics( uint32 size_class )
+        {
+            Central& central = centrals[ size_class ];
+            std::lock_guard<std::mutex> lock( central.mutex );
+            return central.statistics;
+        }
+
+        static inline HeapObject* getLink( HeapObject* cell ) { return *reinterpret_cast<HeapObject**>( cell->getFields() ); }
+        static inline void setLink( HeapObject* cell, HeapObject* next ) { *reinterpret_cast<HeapObject**>( cell->getFields() ) = next; }
+
+    private:
+        struct alignas( 64 ) Central
+        {
+            std::mutex mutex;
+            HeapObject* free = nullptr;
+            Statistics statistics;
+        };
+
+        // cells are linked in address order, so a fresh batch hands out neighbouring addresses
+        void carveSlab( uint32 size_class, Central& central )
+        {
+            unsigned char* slab = top.fetch_add( SlabSize, std::memory_order_acq_rel );
+            nassert( slab + SlabSize <= base + reserved_size, "PinnedSpace", "Pinned space exhausted" );
+            slab_classes[ ( slab - base ) >> SlabShift ] = static_cast<uint8>( size_class );
+
+            uint32 size = ClassSizes[ size_class ];
+            uint32 cell_count = static_cast<uint32>( SlabSize / size );
+            for( uint32 i = cell_count; i-- != 0; )
+            {
+                HeapObject* cell = reinterpret_cast<HeapObject*>( slab + i * size );
+                cell->setFree( size );
+                setLink( cell, central.free );
+                central.free = cell;
+            }
+
+            central.statistics.free_cells += cell_count;
+            ++central.statistics.slabs;
+        }
+
+        unsigned char* base;
+        std::atomic<unsigned char*> top;
+        size_t reserved_size;
+        uint8* slab_classes;
+        uint8 class_lookup[ MaxSize / HeapObject::Alignment + 1 ];
+        Central centrals[ ClassCount ];
+    };
+
+    // per thread free lists in front of the pinned space, allocation is a pop with no atomics
+    class PinnedCache
+    {
+    public:
+        PinnedCache()
+        {
+            for( uint32 i = 0; i < PinnedSpace::ClassCount; ++i )
+            {
+                lists[ i ] = nullptr;
+                counts[ i ] = 0;
+                allocations[ i ] = 0;
+            }
+        }
+
+        inline HeapObject* allocate( PinnedSpace& space, uint32 size_class )
+        {
+            if( lists[ size_class ] == nullptr ) [[unlikely]]
+            {
+                lists[ size_class ] = space.takeBatch( size_class, counts[ size_class ], allocations[ size_class ] );
+                allocations[ size_class ] = 0;
+            }
+
+            HeapObject* cell = lists[ size_class ];
+            lists[ size_class ] = PinnedSpace::getLink( cell );
+            --counts[ size_class ];
+            ++allocations[ size_class ];
+            return cell;
+        }
+
+        // a freed cell goes to the front of its list, a cache holding two batches gives one back
+        inline void release( PinnedSpace& space, uint32 size_class, HeapObject* cell )
+        {
+            cell->setFree( PinnedSpace::ClassSizes[ size_class ] );
+            PinnedSpace::setLink( cell, lists[ size_class ] );
+            lists[ size_class ] = cell;
+            if( ++counts[ size_class ] >= 2 * PinnedSpace::BatchSize ) [[unlikely]]
+            {
+                flush( space, PinnedSpace::BatchSize );
+            }
+        }
+
+        // hands back everything above keep cells per class, in batches
+        void flush( PinnedSpace& space, uint32 keep )
+        {
+            for( uint32 size_class = 0; size_class < PinnedSpace::ClassCount; ++size_class )
+            {
+                while( counts[ size_class ] > keep )
+                {
+                    uint32 count = counts[ size_class ] - keep < PinnedSpace::BatchSize ? counts[ size_class ] - keep : PinnedSpace::BatchSize;
+                    HeapObject* first = lists[ size_class ];
+                    HeapObject* last = first;
+                    for( uint32 i = 1; i < count; ++i )
+                    {
+                        last = PinnedSpace::getLink( last );
+                    }
+
+                    lists[ size_class ] = PinnedSpace::getLink( last );
+                    counts[ size_class ] -= count;
+                    space.returnBatch( size_class, first, last, count, allocations[ size_class ] );
+                    allocations[ size_class ] = 0;
+                }
+            }
+        }
+
+    private:
+        HeapObject* lists[ PinnedSpace::ClassCount ];
+        uint32 counts[ PinnedSpace::ClassCount ];
+        uint64 allocations[ PinnedSpace::ClassCount ];
+    };
+
+    // bump allocated young generation, survivors of a scavenge are promoted straight into the old space
+    // threads claim whole buffers from it with one atomic add and allocate inside them without atomics
+    class Nursery
+    {
+    public:
+        Nursery( unsigned char* base, size_t size )
+            : base( base )
+            , top( base )
+            , end( base + size )
+        {
+        }
+
+        inline bool contains( const void* pointer ) const { return pointer >= base && pointer < end; }
+
+        // the top may run past the end when claims race, whoever overshoots gets nothing
+        inline unsigned char* claim( size_t size )
+        {
+            unsigned char* begin = top.fetch_add( size, std::memory_order_relaxed );
+            if( begin + size > end )
+            {
+                // the one claim straddling the end closes the gap it leaves behind
+                if( begin < end )
+                {
+                    reinterpret_cast<HeapObject*>( begin )->setFree( static_cast<uint32>( end - begin ) );
+                }
+                return nullptr;
+            }
+            return begin;
+        }
+
+        inline void reset() { top.store( base, std::memory_order_relaxed ); }
+        inline size_t getUsedBytes() const { unsigned char* used = top.load( std::memory_order_relaxed ); return ( used < end ? used : end ) - base; }
+
+        // only with every allocation buffer retired, their unused tails are filled with free objects
+        template<typename F>
+        void forEachObject( F f )
+        {
+            unsigned char* used = base + getUsedBytes();
+            for( unsigned char* object = base; object < used; object += reinterpret_cast<HeapObject*>( object )->size )
+            {
+                f( reinterpret_cast<HeapObject*>( object ) );
+            }
+        }
+
+    private:
+        unsigned char* base;
+        std::atomic<unsigned char*> top;
+        unsigned char* end;
+    };
+
+    // thread local allocation buffer carved out of the nursery, the common path is a compare and a bump
+    class AllocationBuffer
+    {
+    public:
+        static constexpr size_t Size = 32 * 1024;
+
+        inline HeapObject* allocate( uint32 size )
+        {
+            if( size > static_cast<size_t>( end - top ) )
+            {
+                return nullptr;
+            }
+
+            HeapObject* object = reinterpret_cast<HeapObject*>( top );
+            top += size;
+            object->size = size;
+            return object;
+        }
+
+        inline void reset( unsigned char* begin, size_t size )
+        {
+            top = begin;
+            end = begin + size;
+        }
+
+        // closes the unused tail with a free object, so the nursery stays walkable
+        void retire()
+        {
+            if( top != end )
+            {
+                reinterpret_cast<HeapObject*>( top )->setFree( static_cast<uint32>( end - top ) );
+            }
+            top = nullptr;
+            end = nullptr;
+        }
+
+    private:
+        unsigned char* top = nullptr;
+        unsigned char* end = nullptr;
+    };
+
+    // finalizers of dead objects run on a thread of their own, in batches, away from the pause that found them dead
+    // a pause hands everything over in one push and never waits, the backpressure falls on the allocation of new
+    // finalizable objects while the thread is too far behind
+    class FinalizerQueue
+    {
+    public:
+        using Finalizer = void (*)( void* payload );
+
+        struct Entry
+        {
+            Finalizer finalizer;
+            void* payload;
+        };
+
+        static constexpr size_t BatchSize = 64;
+        // allocation stops above the high mark until the thread is back under the low mark
+        static constexpr size_t HighWater = 16 * 1024;
+        static constexpr size_t LowWater = 4 * 1024;
+
+        FinalizerQueue()
+            : pending_count( 0 )
+            , thread( [this] { run(); } )
+        {
+        }
+
+        ~FinalizerQueue()
+        {
+            drain();
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                stopping = true;
+            }
+            wake.notify_one();
+            thread.join();
+        }
+
+        FinalizerQueue( const FinalizerQueue& ) = delete;
+        FinalizerQueue& operator=( const FinalizerQueue& ) = delete;
+
+        void push( std::vector<Entry>& entries )
+        {
+            if( entries.empty() )
+            {
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                pending.insert( pending.end(), entries.begin(), entries.end() );
+                queued += entries.size();
+                pending_count.store( pending.size(), std::memory_order_relaxed );
+            }
+            entries.clear();
+            wake.notify_one();
+        }
+
+        inline void throttle()
+        {
+            if( pending_count.load( std::memory_order_relaxed ) > HighWater ) [[unlikely]]
+            {
+                std::unique_lock<std::mutex> lock( mutex );
+                ++throttle_count;
+                progress.wait( lock, [this] { return pending.size() <= LowWater; } );
+            }
+        }
+
+        // returns once every finalizer queued before the call has run, for shutdown and tests
+        void drain()
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            uint64 target = queued;
+            progress.wait( lock, [this, target] { return finished >= target; } );
+        }
+
+        inline size_t getPendingCount() const { return pending_count.load( std::memory_order_relaxed ); }
+        inline uint64 getFinishedCount() { std::lock_guard<std::mutex> lock( mutex ); return finished; }
+        inline uint64 getThrottleCount() { std::lock_guard<std::mutex> lock( mutex ); return throttle_count; }
+
+    private:
+        void run()
+        {
+            std::vector<Entry> batch;
+            std::unique_lock<std::mutex> lock( mutex );
+            for( ;; )
+            {
+                wake.wait( lock, [this] { return stopping || !pending.empty(); } );
+                if( pending.empty() )
+                {
+                    return;
+                }
+
+                size_t count = pending.size() < BatchSize ? pending.size() : BatchSize;
+                batch.assign( pending.begin(), pending.begin() + count );
+                pending.erase( pending.begin(), pending.begin() + count );
+                pending_count.store( pending.size(), std::memory_order_relaxed );
+                lock.unlock();
+
+                for( const Entry& entry : batch )
+                {
+                    entry.finalizer( entry.payload );
+                }
+
+                lock.lock();
+                finished += count;
+                progress.notify_all();
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable progress;
+        std::deque<Entry> pending;
+        std::atomic<size_t> pending_count;
+        uint64 queued = 0;
+        uint64 finished = 0;
+        uint64 throttle_count = 0;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+    // Chase-Lev deque of grey objects, full deques spill into the collector's shared overflow list
+    class MarkDeque
+    {
+    public:
+        static constexpr int64 Capacity = 1 << 14;
+        static constexpr int64 Mask = Capacity - 1;
+
+        MarkDeque()
+            : top( 0 )
+            , bottom( 0 )
+            , buffer( new std::atomic<HeapObject*>[ Capacity ] )
+        {
+        }
+
+        bool push( HeapObject* object )
+        {
+            int64 b = bottom.load( std::memory_order_relaxed );
+            int64 t = top.load( std::memory_order_acquire );
+            if( b - t >= Capacity )
+            {
+                return false;
+            }
+
+            buffer[ b & Mask ].store( object, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+            bottom.store( b + 1, std::memory_order_relaxed );
+            return true;
+        }
+
+        HeapObject* pop()
+        {
+            int64 b = bottom.load( std::memory_order_relaxed ) - 1;
+            bottom.store( b, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            int64 t = top.load( std::memory_order_relaxed );
+
+            if( t > b )
+            {
+                bottom.store( b + 1, std::memory_order_relaxed );
+                return nullptr;
+            }
+
+            HeapObject* object = buffer[ b & Mask ].load( std::memory_order_relaxed );
+            if( t == b )
+            {
+                if( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+                {
+                    object = nullptr;
+                }
+                bottom.store( b + 1, std::memory_order_relaxed );
+            }
+
+            return object;
+        }
+
+        HeapObject* steal()
+        {
+            int64 t = top.load( std::memory_order_acquire );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            int64 b = bottom.load( std::memory_order_acquire );
+
+            if( t >= b )
+            {
+                return nullptr;
+            }
+
+            HeapObject* object = buffer[ t & Mask ].load( std::memory_order_relaxed );
+            if( !top.compare_exchange_strong( t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+            {
+                return nullptr;
+            }
+
+            return object;
+        }
+
+        inline bool isEmpty() const { return bottom.load( std::memory_order_acquire ) <= top.load( std::memory_order_acquire ); }
+
+    private:
+        alignas( 64 ) std::atomic<int64> top;
+        alignas( 64 ) std::atomic<int64> bottom;
+        std::unique_ptr<std::atomic<HeapObject*>[]> buffer;
+    };
+
+    // heap of one isolate: a single mutator thread, plus helper threads that only run during marking
+    // one reservation holds the nursery followed by the old space, the card table covers both
+    class Heap
+    {
+    public:
+        static constexpr uint32 PrefetchDistance = 8;
+        static constexpr size_t HugePageSize = size_t( 2 ) << 20;
+        static constexpr size_t NurserySize = size_t( 2 ) << 20;
+        static constexpr size_t OldSpaceSize = size_t( 1 ) << 30;
+        static constexpr size_t PinnedSize = size_t( 256 ) << 20;
+        static constexpr size_t ReservedSize = NurserySize + OldSpaceSize + PinnedSize;
+        static constexpr uint32 PretenureSize = 64 * 1024;
+        // a cycle compacts when the previous sweep left this much free space below the top, and at least this share of it
+        static constexpr size_t CompactionMinimumBytes = size_t( 1 ) << 20;
+        static constexpr size_t CompactionFreePercent = 25;
+
+        static constexpr uint8 CleanCard = 0;
+        static constexpr uint8 DirtyCard = 1;
+
+        using Finalizer = FinalizerQueue::Finalizer;
+
+        // keeps a local value alive and up to date across allocations that may move it
+        class Root
+        {
+        public:
+            explicit Root( Heap& heap, Value value = Value() )
+                : heap( heap )
+                , value( value )
+            {
+                heap.addRoot( &this->value );
+            }
+
+            ~Root()
+            {
+                heap.removeRoot( &value );
+            }
+
+            Root( const Root& ) = delete;
+            Root& operator=( const Root& ) = delete;
+
+            inline Root& operator=( Value other ) { value = other; return *this; }
+            inline operator Value() const { return value; }
+            inline Value get() const { return value; }
+
+        private:
+            Heap& heap;
+            Value value;
+        };
+
+        // allocation context for a thread other than the mutator, young objects only
+        // running out of nursery returns null, the owner then waits for the mutator to scavenge at a safepoint
+        class LocalAllocator
+        {
+        public:
+            explicit LocalAllocator( Heap& heap )
+                : heap( heap )
+            {
+                heap.addBuffer( &buffer );
+            }
+
+            ~LocalAllocator()
+            {
+                heap.removeBuffer( &buffer );
+                cache.flush( heap.pinned_space, 0 );
+            }
+
+            LocalAllocator( const LocalAllocator& ) = delete;
+            LocalAllocator& operator=( const LocalAllocator& ) = delete;
+
+            Value allocateTuple( uint32 field_count ) { return heap.allocateIn( buffer, HeapObject::Tuple, field_count, 0 ); }
+            Value allocateArray( uint32 field_count ) { return heap.allocateIn( buffer, HeapObject::Array, field_count, 0 ); }
+            Value allocatePinnedTuple( uint32 field_count ) { return heap.allocatePinned( cache, HeapObject::Tuple, field_count, 0 ); }
+
+        private:
+            Heap& heap;
+            AllocationBuffer buffer;
+            PinnedCache cache;
+        };
+
+        explicit Heap( uint32 marker_count = std::thread::hardware_concurrency() )
+            : reservation( reserve( ReservedSize, HugePageSize ) )
+            , cards( reserve( ReservedSize >> CardShift, OldSpace::PageSize ) )
+            , card_bias( reinterpret_cast<uintptr_t>( cards ) - ( reinterpret_cast<uintptr_t>( reservation ) >> CardShift ) )
+            , nursery( reservation, NurserySize )
+            , old_space( reservation + NurserySize, OldSpaceSize )
+            , pinned_space( reservation + NurserySize + OldSpaceSize, PinnedSize )
+            , mark_bits( reservation + NurserySize, OldSpaceSize + PinnedSize )
+            , marking( false )
+            , marker_epoch( 0 )
+            , markers_running( 0 )
+            , markers_active( 0 )
+            , stopping( false )
+            , overflow_size( 0 )
+            , compaction_pending( false )
+        {
+            useHugePages();
+            buffers.push_back( &mutator_buffer );
+
+            marker_count = marker_count == 0 ? 1 : marker_count;
+            for( uint32 i = 0; i < marker_count; ++i )
+            {
+                markers.emplace_back( new Marker() );
+            }
+
+            // marker 0 is the mutator thread itself
+            for( uint32 i = 1; i < marker_count; ++i )
+            {
+                markers[ i ]->thread = std::thread( [this, i] { runHelper( i ); } );
+            }
+        }
+
+        ~Heap()
+        {
+            stopping.store( true, std::memory_order_release );
+            marker_epoch.fetch_add( 1, std::memory_order_release );
+            marker_epoch.notify_all();
+
+            for( uint32 i = 1; i < markers.size(); ++i )
+            {
+                markers[ i ]->thread.join();
+            }
+
+            // nothing outlives the heap, so every object still waiting to be found dead releases its resource now
+            queueDeadFinalizable( []( HeapObject* ) { return false; } );
+            finalizers.drain();
+
+            munmap( cards, ReservedSize >> CardShift );
+            munmap( reservation, ReservedSize );
+        }
+
+        Heap( const Heap& ) = delete;
+        Heap& operator=( const Heap& ) = delete;
+
+        Value allocateTuple( uint32 field_count ) { return allocate( HeapObject::Tuple, field_count, 0 ); }
+        Value allocateArray( uint32 field_count ) { return allocate( HeapObject::Array, field_count, 0 ); }
+
+        Value allocateString( std::string_view text )
+        {
+            Value value = allocate( HeapObject::String, 0, static_cast<uint32>( text.size() + 1 ) );
+            char* characters = getObject( value )->getCharacters();
+            memcpy( characters, text.data(), text.size() );
+            characters[ text.size() ] = 0;
+            return value;
+        }
+
+        // a native resource: the finalizer is called with the payload on the finalizer thread some time after the
+        // object is found dead, never during the pause itself, or at the latest when the heap is destroyed
+        Value allocateObject( Finalizer finalizer, void* payload )
+        {
+            finalizers.throttle();
+            Value value = allocate( HeapObject::CObject, 0, sizeof( Finalizer ) + sizeof( void* ) );
+            char* bytes = getObject( value )->getCharacters();
+            memcpy( bytes, &finalizer, sizeof( Finalizer ) );
+            memcpy( bytes + sizeof( Finalizer ), &payload, sizeof( void* ) );
+            finalizable.push_back( getObject( value ) );
+            return value;
+        }
+
+        // runs every finalizer of an object already found dead
+        void drainFinalizers() { finalizers.drain(); }
+        inline size_t getPendingFinalizerCount() const { return finalizers.getPendingCount(); }
+
+        // never moved by any collection, for objects whose address leaves the heap
+        Value allocatePinnedTuple( uint32 field_count ) { return allocatePinned( mutator_cache, HeapObject::Tuple, field_count, 0 ); }
+
+        Value allocatePinnedString( std::string_view text )
+        {
+            Value value = allocatePinned( mutator_cache, HeapObject::String, 0, static_cast<uint32>( text.size() + 1 ) );
+            char* characters = getObject( value )->getCharacters();
+            memcpy( characters, text.data(), text.size() );
+            characters[ text.size() ] = 0;
+            return value;
+        }
+
+        inline bool isPinned( Value value ) const { return value.isReferenceLayout() && pinned_space.contains( value.getReference() ); }
+
+        // allocation counts only include what caches have published by trading a batch
+        PinnedSpace::Statistics getPinnedStatistics( uint32 size_class ) { return pinned_space.getStatistics( size_class ); }
+
+        // roots are slots owned by the embedder, they are rescanned at the end of every cycle
+        void addRoot( Value* slot ) { roots.push_back( slot ); }
+
+        void removeRoot( Value* slot )
+        {
+            for( size_t i = 0; i < roots.size(); ++i )
+            {
+                if( roots[ i ] == slot )
+                {
+                    roots[ i ] = roots.back();
+                    roots.pop_back();
+                    return;
+                }
+            }
+        }
+
+        static inline HeapObject* getObject( Value value ) { return static_cast<HeapObject*>( value.getReference() ); }
+
+        static inline Value readField( Value object, uint32 index )
+        {
+            nassert( index < getObject( object )->field_count );
+            return getObject( object )->getFields()[ index ];
+        }
+
+        // generational barrier: short and double stores are filtered by the layout test alone, reference
+        // stores dirty the slot's card unconditionally, one shift and one byte store with no branch on the target
+        // while an incremental cycle runs, the snapshot barrier also greys the overwritten reference
+        inline void writeField( Value object, uint32 index, Value value )
+        {
+            Value* slot = &getObject( object )->getFields()[ index ];
+            if( value.isReferenceLayout() )
+            {
+                *reinterpret_cast<uint8*>( card_bias + ( reinterpret_cast<uintptr_t>( slot ) >> CardShift ) ) = DirtyCard;
+            }
+            if( marking ) [[unlikely]]
+            {
+                shade( *slot );
+            }
+            *slot = value;
+        }
+
+        // what generated code needs to emit the barrier inline: card = bias + ( slot >> shift )
+        inline uintptr_t getCardBias() const { return card_bias; }
+        inline const bool* getMarkingFlag() const { return &marking; }
+
+        inline bool isCardDirty( Value object, uint32 index ) const
+        {
+            const Value* slot = &getObject( object )->getFields()[ index ];
+            return *reinterpret_cast<const uint8*>( card_bias + ( reinterpret_cast<uintptr_t>( slot ) >> CardShift ) ) == DirtyCard;
+        }
+
+        inline bool isYoung( Value value ) const { return value.isReferenceLayout() && nursery.contains( value.getReference() ); }
+
+        // stop the world collection, marking is spread over every marker thread
+        void collect()
+        {
+            if( !marking )
+            {
+                startMarking();
+            }
+            finishMarking();
+            reclaim();
+        }
+
+        // minor collection: live young objects are copied into the old space, the remembered set is
+        // the dirty cards, so only old objects written since the last scavenge are visited
+        void scavenge()
+        {
+            retireBuffers();
+            for( Value* root : roots )
+            {
+                *root = evacuate( *root );
+            }
+
+            scanDirtyCards();
+
+            while( !promoted.empty() )
+            {
+                HeapObject* object = promoted.back();
+                promoted.pop_back();
+
+                Value* fields = object->getFields();
+                for( uint32 i = 0; i < object->field_count; ++i )
+                {
+                    fields[ i ] = evacuate( fields[ i ] );
+                }
+            }
+
+            // a finalizable object left behind in the nursery is dead, a copied one is followed to the old space
+            queueDeadFinalizable( [this]( HeapObject*& object ) {
+                if( !nursery.contains( object ) )
+                {
+                    return true;
+                }
+                if( ( object->flags & HeapObject::Forwarded ) == 0 )
+                {
+                    return false;
+                }
+                object = object->getForward();
+                return true;
+            } );
+
+            nursery.reset();
+        }
+
+        // incremental cycle: start, then interleave bounded steps with script execution, then finish
+        // the snapshot is taken with an empty nursery, young objects allocated later count as live
+        void startMarking()
+        {
+            nassert( !marking );
+            scavenge();
+            marking = true;
+            for( Value* root : roots )
+            {
+                shade( *root );
+            }
+        }
+
+        // returns true once there is nothing left to trace on the mutator side
+        bool stepMarking( size_t budget )
+        {
+            nassert( marking );
+            while( budget-- != 0 && !mutator_worklist.empty() )
+            {
+                HeapObject* object = mutator_worklist.back();
+                mutator_worklist.pop_back();
+                scanIncremental( object );
+            }
+            return mutator_worklist.empty();
+        }
+
+        // the remaining pause: rescan roots, then drain what is left in parallel
+        void finishCollection()
+        {
+            finishMarking();
+            reclaim();
+        }
+
+        inline bool isMarking() const { return marking; }
+        inline size_t getYoungBytes() const { return nursery.getUsedBytes(); }
+        inline size_t getLiveObjectCount() const { return live_objects; }
+        inline size_t getLiveBytes() const { return live_bytes; }
+        inline size_t getOldSpaceBytes() const { return old_space.getUsedBytes(); }
+        inline bool isCompactionPending() const { return compaction_pending; }
+
+    private:
+        struct Marker
+        {
+            MarkDeque deque;
+            std::thread thread;
+        };
+
+        // trimmed to start on an alignment boundary, so huge pages can back the range from its first byte
+        static unsigned char* reserve( size_t size, size_t alignment )
+        {
+            void* memory = mmap( nullptr, size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+            nassert( memory != MAP_FAILED, "Heap", "Failed to reserve address space" );
+
+            uintptr_t begin = reinterpret_cast<uintptr_t>( memory );
+            uintptr_t aligned = ( begin + alignment - 1 ) & ~( alignment - 1 );
+            if( aligned != begin )
+            {
+                munmap( memory, aligned - begin );
+            }
+            if( aligned + size != begin + size + alignment )
+            {
+                munmap( reinterpret_cast<void*>( aligned + size ), begin + alignment - aligned );
+            }
+            return reinterpret_cast<unsigned char*>( aligned );
+        }
+
+        // transparent huge pages over the whole reservation when the kernel grants them on request, otherwise
+        // the nursery, which is touched end to end between scavenges, moves onto hugetlbfs pages if enough are free
+        void useHugePages()
+        {
+            char mode[ 64 ] = {};
+            if( FILE* file = fopen( "/sys/kernel/mm/transparent_hugepage/enabled", "r" ) )
+            {
+                if( fgets( mode, sizeof( mode ), file ) == nullptr )
+                {
+                    mode[ 0 ] = 0;
+                }
+                fclose( file );
+            }
+
+            if( strstr( mode, "[never]" ) == nullptr )
+            {
+                madvise( reservation, ReservedSize, MADV_HUGEPAGE );
+                return;
+            }
+
+            unsigned long free_pages = 0;
+            if( FILE* file = fopen( "/sys/kernel/mm/hugepages/hugepages-2048kB/free_hugepages", "r" ) )
+            {
+                if( fscanf( file, "%lu", &free_pages ) != 1 )
+                {
+                    free_pages = 0;
+                }
+                fclose( file );
+            }
+
+            if( free_pages * HugePageSize >= NurserySize )
+            {
+                void* memory = mmap( reservation, NurserySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0 );
+                if( memory == MAP_FAILED )
+                {
+                    mmap( reservation, NurserySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0 );
+                }
+            }
+        }
+
+        void addBuffer( AllocationBuffer* buffer )
+        {
+            std::lock_guard<std::mutex> lock( buffers_mutex );
+            buffers.push_back( buffer );
+        }
+
+        void removeBuffer( AllocationBuffer* buffer )
+        {
+            std::lock_guard<std::mutex> lock( buffers_mutex );
+            buffer->retire();
+            for( size_t i = 0; i < buffers.size(); ++i )
+            {
+                if( buffers[ i ] == buffer )
+                {
+                    buffers[ i ] = buffers.back();
+                    buffers.pop_back();
+                    return;
+                }
+            }
+        }
+
+        // every allocating thread is parked at a safepoint whenever the mutator collects
+        void retireBuffers()
+        {
+            std::lock_guard<std::mutex> lock( buffers_mutex );
+            for( AllocationBuffer* buffer : buffers )
+            {
+                buffer->retire();
+            }
+        }
+
+        // medium objects take a claim of their own instead of throwing away most of a buffer
+        inline HeapObject* allocateYoung( AllocationBuffer& buffer, uint32 size )
+        {
+            if( HeapObject* object = buffer.allocate( size ) ) [[likely]]
+            {
+                return object;
+            }
+
+            if( size > AllocationBuffer::Size / 4 )
+            {
+                HeapObject* object = reinterpret_cast<HeapObject*>( nursery.claim( size ) );
+                if( object != nullptr )
+                {
+                    object->size = size;
+                }
+                return object;
+            }
+
+            buffer.retire();
+            unsigned char* memory = nursery.claim( AllocationBuffer::Size );
+            if( memory == nullptr )
+            {
+                return nullptr;
+            }
+            buffer.reset( memory, AllocationBuffer::Size );
+            return buffer.allocate( size );
+        }
+
+        Value allocate( uint16 kind, uint32 field_count, uint32 byte_count )
+        {
+            uint32 size = HeapObject::getAllocationSize( field_count, byte_count );
+            HeapObject* object = nullptr;
+            if( size <= PretenureSize )
+            {
+                object = allocateYoung( mutator_buffer, size );
+                if( object == nullptr )
+                {
+                    scavenge();
+                    object = allocateYoung( mutator_buffer, size );
+                }
+            }
+            else
+            {
+                object = old_space.allocate( size );
+                // allocated black while marking, the cycle only reclaims what was dead at its start
+                if( marking )
+                {
+                    mark_bits.mark( object );
+                }
+            }
+
+            return initialize( object, kind, field_count );
+        }
+
+        Value allocateIn( AllocationBuffer& buffer, uint16 kind, uint32 field_count, uint32 byte_count )
+        {
+            uint32 size = HeapObject::getAllocationSize( field_count, byte_count );
+            nassert( size <= PretenureSize, "Heap", "Local allocators only place young objects" );
+            HeapObject* object = allocateYoung( buffer, size );
+            return object != nullptr ? initialize( object, kind, field_count ) : Value();
+        }
+
+        Value allocatePinned( PinnedCache& cache, uint16 kind, uint32 field_count, uint32 byte_count )
+        {
+            uint32 size = HeapObject::getAllocationSize( field_count, byte_count );
+            nassert( size <= PinnedSpace::MaxSize, "Heap", "Pinned object too large" );
+            HeapObject* object = cache.allocate( pinned_space, pinned_space.getClass( size ) );
+            if( marking )
+            {
+                mark_bits.mark( object );
+            }
+            return initialize( object, kind, field_count );
+        }
+
+        static inline Value initialize( HeapObject* object, uint16 kind, uint32 field_count )
+        {
+            object->kind = kind;
+            object->flags = 0;
+            object->field_count = field_count;
+
+            Value* fields = object->getFields();
+            for( uint32 i = 0; i < field_count; ++i )
+            {
+                fields[ i ] = Value();
+            }
+
+            return Value( static_cast<void*>( object ) );
+        }
+
+        Value evacuate( Value value )
+        {
+            if( !value.isReferenceLayout() || !nursery.contains( value.getReference() ) )
+            {
+                return value;
+            }
+
+            HeapObject* object = getObject( value );
+            if( ( object->flags & HeapObject::Forwarded ) != 0 )
+            {
+                return Value( static_cast<void*>( object->getForward() ) );
+            }
+
+            HeapObject* copy = old_space.allocate( object->size );
+            memcpy( static_cast<void*>( copy ), object, object->size );
+            if( marking )
+            {
+                mark_bits.mark( copy );
+            }
+            object->setForward( copy );
+            promoted.push_back( copy );
+
+            return Value( static_cast<void*>( copy ) );
+        }
+
+        // only the slots inside a dirty card are visited, a large array costs as many slots as were written near
+        // pinned cells are found by stride inside their slab, old objects through the object start table
+        void scanDirtyCards()
+        {
+            unsigned char* old_base = old_space.getBase();
+            scanCards( ( old_base - reservation ) >> CardShift, ( old_space.getTop() - reservation + CardSize - 1 ) >> CardShift,
+                [this, old_base]( unsigned char* card_begin ) {
+                    return std::make_pair( old_space.findObject( ( card_begin - old_base ) >> CardShift ), old_space.getTop() );
+                } );
+
+            unsigned char* pinned_base = pinned_space.getBase();
+            scanCards( ( pinned_base - reservation ) >> CardShift, ( pinned_base + pinned_space.getUsedBytes() - reservation ) >> CardShift,
+                [this, pinned_base]( unsigned char* card_begin ) {
+                    size_t slab = ( card_begin - pinned_base ) >> PinnedSpace::SlabShift;
+                    size_t size = PinnedSpace::ClassSizes[ pinned_space.getSlabClass( slab ) ];
+                    unsigned char* slab_begin = pinned_base + ( slab << PinnedSpace::SlabShift );
+                    unsigned char* cell = slab_begin + ( card_begin - slab_begin ) / size * size;
+                    return std::make_pair( reinterpret_cast<HeapObject*>( cell ), slab_begin + PinnedSpace::SlabSize / size * size );
+                } );
+        }
+
+        template<typename Find>
+        void scanCards( size_t first_card, size_t end_card, Find find )
+        {
+            for( size_t card = first_card; card < end_card; ++card )
+            {
+                // skip clean cards eight at a time
+                if( ( card & 7 ) == 0 && card + 8 <= end_card )
+                {
+                    uint64 word;
+                    memcpy( &word, cards + card, sizeof( word ) );
+                    if( word == 0 )
+                    {
+                        card += 7;
+                        continue;
+                    }
+                }
+
+                if( cards[ card ] == CleanCard )
+                {
+                    continue;
+                }
+                cards[ card ] = CleanCard;
+
+                unsigned char* card_begin = reservation + ( card << CardShift );
+                unsigned char* card_end = card_begin + CardSize;
+                auto [ object, limit ] = find( card_begin );
+                for( ; reinterpret_cast<unsigned char*>( object ) < card_end && reinterpret_cast<unsigned char*>( object ) < limit; object = object->getNext() )
+                {
+                    Value* fields = object->getFields();
+                    Value* begin = reinterpret_cast<Value*>( card_begin ) > fields ? reinterpret_cast<Value*>( card_begin ) : fields;
+                    Value* end = fields + object->field_count < reinterpret_cast<Value*>( card_end ) ? fields + object->field_count : reinterpret_cast<Value*>( card_end );
+                    for( Value* slot = begin; slot < end; ++slot )
+                    {
+                        *slot = evacuate( *slot );
+                    }
+                }
+            }
+        }
+
+        // mutator side grey set, plain vector since only the mutator touches it until the final pause
+        // young objects are never shaded, anything in the nursery was allocated after the snapshot
+        inline void shade( Value value )
+        {
+            if( value.isReferenceLayout() && value.getReference() != nullptr && !nursery.contains( value.getReference() ) )
+            {
+                HeapObject* object = getObject( value );
+                if( mark_bits.tryMark( object ) )
+                {
+                    mutator_worklist.push_back( object );
+                }
+            }
+        }
+
+        void scanIncremental( HeapObject* object )
+        {
+            Value* fields = object->getFields();
+            for( uint32 i = 0; i < object->field_count; ++i )
+            {
+                shade( fields[ i ] );
+            }
+        }
+
+        void finishMarking()
+        {
+            for( Value* root : roots )
+            {
+                shade( *root );
+            }
+
+            // grey objects are already marked, helpers only need to scan them
+            MarkDeque& deque = markers[ 0 ]->deque;
+            for( HeapObject* object : mutator_worklist )
+            {
+                pushGrey( deque, object );
+            }
+            mutator_worklist.clear();
+
+            markers_active.store( static_cast<uint32>( markers.size() ), std::memory_order_seq_cst );
+            markers_running.store( static_cast<uint32>( markers.size() ) - 1, std::memory_order_release );
+            marker_epoch.fetch_add( 1, std::memory_order_release );
+            marker_epoch.notify_all();
+
+            drain( 0 );
+
+            uint32 running = markers_running.load( std::memory_order_acquire );
+            while( running != 0 )
+            {
+                markers_running.wait( running, std::memory_order_acquire );
+                running = markers_running.load( std::memory_order_acquire );
+            }
+
+            marking = false;
+        }
+
+        void runHelper( uint32 index )
+        {
+            uint32 epoch = 0;
+            while( true )
+            {
+                marker_epoch.wait( epoch, std::memory_order_acquire );
+                epoch = marker_epoch.load( std::memory_order_acquire );
+                if( stopping.load( std::memory_order_acquire ) )
+                {
+                    return;
+                }
+
+                drain( index );
+
+                if( markers_running.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                {
+                    markers_running.notify_all();
+                }
+            }
+        }
+
+        inline void pushGrey( MarkDeque& deque, HeapObject* object )
+        {
+            if( !deque.push( object ) )
+            {
+                std::lock_guard<std::mutex> lock( overflow_mutex );
+                overflow.push_back( object );
+                overflow_size.store( overflow.size(), std::memory_order_release );
+            }
+        }
+
+        HeapObject* takeOverflow()
+        {
+            if( overflow_size.load( std::memory_order_acquire ) == 0 )
+            {
+                return nullptr;
+            }
+
+            std::lock_guard<std::mutex> lock( overflow_mutex );
+            if( overflow.empty() )
+            {
+                return nullptr;
+            }
+
+            HeapObject* object = overflow.back();
+            overflow.pop_back();
+            overflow_size.store( overflow.size(), std::memory_order_release );
+            return object;
+        }
+
+        HeapObject* findGrey( uint32 index )
+        {
+            if( HeapObject* object = markers[ index ]->deque.pop() )
+            {
+                return object;
+            }
+
+            if( HeapObject* object = takeOverflow() )
+            {
+                return object;
+            }
+
+            size_t count = markers.size();
+            for( size_t i = 1; i < count; ++i )
+            {
+                if( HeapObject* object = markers[ ( index + i ) % count ]->deque.steal() )
+                {
+                    return object;
+                }
+            }
+
+            return nullptr;
+        }
+
+        bool hasVisibleWork() const
+        {
+            if( overflow_size.load( std::memory_order_acquire ) != 0 )
+            {
+                return true;
+            }
+
+            for( auto& marker : markers )
+            {
+                if( !marker->deque.isEmpty() )
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // children are marked as soon as they are discovered and pushed grey; each popped object passes
+        // through a short fifo after a prefetch, so its fields are in cache by the time it is scanned
+        void drain( uint32 index )
+        {
+            MarkDeque& deque = markers[ index ]->deque;
+            HeapObject* window[ PrefetchDistance ];
+            uint32 window_head = 0;
+            uint32 window_size = 0;
+
+            while( true )
+            {
+                HeapObject* object = findGrey( index );
+                if( object != nullptr )
+                {
+                    __builtin_prefetch( object->getFields() );
+                    if( window_size < PrefetchDistance )
+                    {
+                        window[ ( window_head + window_size++ ) % PrefetchDistance ] = object;
+                        continue;
+                    }
+
+                    HeapObject* ready = window[ window_head ];
+                    window[ window_head ] = object;
+                    window_head = ( window_head + 1 ) % PrefetchDistance;
+                    scan( deque, ready );
+                    continue;
+                }
+
+                if( window_size != 0 )
+                {
+                    HeapObject* ready = window[ window_head ];
+                    window_head = ( window_head + 1 ) % PrefetchDistance;
+                    --window_size;
+                    scan( deque, ready );
+                    continue;
+                }
+
+                // idle: marking is over once every marker is idle, since only active markers create work
+                markers_active.fetch_sub( 1, std::memory_order_seq_cst );
+                while( true )
+                {
+                    if( markers_active.load( std::memory_order_seq_cst ) == 0 )
+                    {
+                        return;
+                    }
+
+                    if( hasVisibleWork() )
+                    {
+                        markers_active.fetch_add( 1, std::memory_order_seq_cst );
+                        break;
+                    }
+
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void scan( MarkDeque& deque, HeapObject* object )
+        {
+            Value* fields = object->getFields();
+            for( uint32 i = 0; i < object->field_count; ++i )
+            {
+                Value value = fields[ i ];
+                if( value.isReferenceLayout() && value.getReference() != nullptr && !nursery.contains( value.getReference() ) )
+                {
+                    HeapObject* child = getObject( value );
+                    __builtin_prefetch( child );
+                    if( mark_bits.tryMark( child ) )
+                    {
+                        pushGrey( deque, child );
+                    }
+                }
+            }
+        }
+
+        // rebuilds the free lists from scratch, adjacent dead objects coalesce into one chunk
+        void sweep()
+        {
+            old_space.clearFreeLists();
+            old_space.clearStarts();
+            live_objects = 0;
+            live_bytes = 0;
+
+            unsigned char* free_begin = nullptr;
+            old_space.forEachObject( [this, &free_begin]( HeapObject* object ) {
+                unsigned char* address = reinterpret_cast<unsigned char*>( object );
+                if( isLive( object ) )
+                {
+                    if( free_begin != nullptr )
+                    {
+                        old_space.addFree( free_begin, static_cast<uint32>( address - free_begin ) );
+                        free_begin = nullptr;
+                    }
+
+                    old_space.recordStart( object );
+                    ++live_objects;
+                    live_bytes += object->size;
+                }
+                else if( free_begin == nullptr )
+                {
+                    free_begin = address;
+                }
+            } );
+
+            mark_bits.clear( old_space.getBase(), old_space.getUsedBytes() );
+
+            // a free tail goes straight back to the kernel, free space scattered below the top needs a compaction
+            if( free_begin != nullptr )
+            {
+                releaseTail( free_begin );
+            }
+
+            size_t free_bytes = old_space.getFreeBytes();
+            compaction_pending = free_bytes >= CompactionMinimumBytes && free_bytes * 100 >= old_space.getUsedBytes() * CompactionFreePercent;
+        }
+
+        inline void reclaim()
+        {
+            // while the mark bits are still valid and the dead objects still intact
+            queueDeadFinalizable( [this]( HeapObject*& object ) { return nursery.contains( object ) || mark_bits.isMarked( object ); } );
+
+            if( compaction_pending )
+            {
+                compact();
+            }
+            else
+            {
+                sweep();
+            }
+
+            // pinned cells never move, they are swept either way, and an idle mutator cache gives most of itself back
+            pinned_space.sweep( [this]( HeapObject* object ) { return mark_bits.isMarked( object ); } );
+            mark_bits.clear( pinned_space.getBase(), pinned_space.getUsedBytes() );
+            mutator_cache.flush( pinned_space, PinnedSpace::BatchSize );
+        }
+
+        inline bool isLive( HeapObject* object ) const
+        {
+            return object->kind != HeapObject::Free && mark_bits.isMarked( object );
+        }
+
+        inline HeapObject* getRelocation( HeapObject* object ) const
+        {
+            return reinterpret_cast<HeapObject*>( old_space.getBase() + size_t( object->relocation ) * HeapObject::Alignment );
+        }
+
+        inline Value relocate( Value value ) const
+        {
+            if( !value.isReferenceLayout() || !old_space.contains( value.getReference() ) )
+            {
+                return value;
+            }
+            return Value( static_cast<void*>( getRelocation( getObject( value ) ) ) );
+        }
+
+        // sliding mark-compact of the old space, run after marking instead of a sweep
+        // live objects keep their address order, so whatever was allocated together stays together
+        void compact()
+        {
+            retireBuffers();
+            unsigned char* old_base = old_space.getBase();
+            unsigned char* cursor = old_base;
+            live_objects = 0;
+            live_bytes = 0;
+
+            // new addresses are handed out in address order, the header keeps them until the objects move
+            old_space.forEachObject( [this, old_base, &cursor]( HeapObject* object ) {
+                if( isLive( object ) )
+                {
+                    object->relocation = static_cast<uint32>( ( cursor - old_base ) / HeapObject::Alignment );
+                    cursor += object->size;
+                    ++live_objects;
+                    live_bytes += object->size;
+                }
+            } );
+
+            // every reference into the old space is rewritten before anything moves: roots, live old objects and
+            // the nursery, which is not empty after an incremental cycle. old to young edges dirty their new card
+            size_t first_card = ( old_base - reservation ) >> CardShift;
+            memset( cards + first_card, CleanCard, ( old_space.getUsedBytes() + CardSize - 1 ) >> CardShift );
+
+            for( Value* root : roots )
+            {
+                *root = relocate( *root );
+            }
+            for( HeapObject*& object : finalizable )
+            {
+                if( old_space.contains( object ) )
+                {
+                    object = getRelocation( object );
+                }
+            }
+
+            old_space.forEachObject( [this]( HeapObject* object ) {
+                if( !isLive( object ) )
+                {
+                    return;
+                }
+
+                Value* fields = object->getFields();
+                Value* target_fields = getRelocation( object )->getFields();
+                for( uint32 i = 0; i < object->field_count; ++i )
+                {
+                    fields[ i ] = relocate( fields[ i ] );
+                    if( isYoung( fields[ i ] ) )
+                    {
+                        *reinterpret_cast<uint8*>( card_bias + ( reinterpret_cast<uintptr_t>( target_fields + i ) >> CardShift ) ) = DirtyCard;
+                    }
+                }
+            } );
+
+            auto relocate_fields = [this]( HeapObject* object ) {
+                Value* fields = object->getFields();
+                for( uint32 i = 0; i < object->field_count; ++i )
+                {
+                    fields[ i ] = relocate( fields[ i ] );
+                }
+            };
+            nursery.forEachObject( relocate_fields );
+            pinned_space.forEachObject( [this, &relocate_fields]( HeapObject* object ) {
+                if( mark_bits.isMarked( object ) )
+                {
+                    relocate_fields( object );
+                }
+            } );
+
+            // objects only ever slide down, so moving them in address order never overwrites one not yet visited
+            old_space.clearFreeLists();
+            old_space.clearStarts();
+            old_space.forEachObject( [this]( HeapObject* object ) {
+                if( isLive( object ) )
+                {
+                    HeapObject* target = getRelocation( object );
+                    memmove( static_cast<void*>( target ), object, object->size );
+                    old_space.recordStart( target );
+                }
+            } );
+            mark_bits.clear( old_space.getBase(), old_space.getUsedBytes() );
+
+            releaseTail( cursor );
+            compaction_pending = false;
+        }
+
+        // keeps the finalizable objects that survive, the others hand their finalizer over in a single push
+        template<typename Survives>
+        void queueDeadFinalizable( Survives survives )
+        {
+            size_t kept = 0;
+            for( HeapObject* object : finalizable )
+            {
+                if( survives( object ) )
+                {
+                    finalizable[ kept++ ] = object;
+                    continue;
+                }
+
+                FinalizerQueue::Entry entry;
+                memcpy( &entry.finalizer, object->getCharacters(), sizeof( Finalizer ) );
+                memcpy( &entry.payload, object->getCharacters() + sizeof( Finalizer ), sizeof( void* ) );
+                dead_finalizable.push_back( entry );
+            }
+            finalizable.resize( kept );
+            finalizers.push( dead_finalizable );
+        }
+
+        // cards above the new top are cleaned, the old space will grow back into them
+        void releaseTail( unsigned char* new_top )
+        {
+            size_t begin = ( new_top - reservation + CardSize - 1 ) >> CardShift;
+            size_t end = ( old_space.getTop() - reservation + CardSize - 1 ) >> CardShift;
+            if( end > begin )
+            {
+                memset( cards + begin, CleanCard, end - begin );
+            }
+            old_space.shrink( new_top );
+        }
+
+        unsigned char* reservation;
+        uint8* cards;
+        uintptr_t card_bias;
+
+        Nursery nursery;
+        OldSpace old_space;
+        PinnedSpace pinned_space;
+        MarkBitmap mark_bits;
+        AllocationBuffer mutator_buffer;
+        PinnedCache mutator_cache;
+        std::mutex buffers_mutex;
+        std::vector<AllocationBuffer*> buffers;
+        std::vector<HeapObject*> promoted;
+        std::vector<Value*> roots;
+
+        bool marking;
+        std::vector<HeapObject*> mutator_worklist;
+
+        std::vector<std::unique_ptr<Marker>> markers;
+        std::atomic<uint32> marker_epoch;
+        std::atomic<uint32> markers_running;
+        std::atomic<uint32> markers_active;
+        std::atomic<bool> stopping;
+
+        std::mutex overflow_mutex;
+        std::vector<HeapObject*> overflow;
+        std::atomic<size_t> overflow_size;
+
+        size_t live_objects = 0;
+        size_t live_bytes = 0;
+        bool compaction_pending;
+
+        // finalizable objects not yet found dead, young and old
+        std::vector<HeapObject*> finalizable;
+        std::vector<FinalizerQueue::Entry> dead_finalizable;
+        FinalizerQueue finalizers;
+    };
+
+    // reference counted alternative to the tracing Heap, for embedders that need an object destroyed as soon as its
+    // last reference goes away. counts are biased towards the allocating thread: it counts with plain arithmetic,
+    // every other thread goes through an atomic shared count. decrements are logged and applied at the owner's
+    // next safepoint, and reference cycles are left to a synchronous trial deletion pass
+    class CountedHeap
+    {
+        struct Owner;
+
+    public:
+        static constexpr size_t SpaceSize = size_t( 256 ) << 20;
+        static constexpr uint32 DecrementBatch = 256;
+        static constexpr uint32 MaxMutators = 64;
+
+        using Finalizer = void (*)( void* payload );
+
+        // sits right in front of the object's HeapObject header
+        struct Counts
+        {
+            static constexpr uint8 Black = 0;
+            static constexpr uint8 Gray = 1;
+            static constexpr uint8 White = 2;
+
+            static constexpr int32 Merged = 0x01;
+            static constexpr int32 Queued = 0x02;
+            static constexpr int32 SharedOne = 0x04;
+
+            static constexpr uint8 Buffered = 0x01;
+            static constexpr uint8 Dead = 0x02;
+
+            uint32 biased;
+            // the shared count sits above the Merged and Queued bits, so a merge and the last foreign
+            // decrement agree on which of them took the object to zero
+            std::atomic<int32> shared;
+            uint16 owner;
+            uint8 color;
+            std::atomic<uint8> state;
+            // scratch count of the cycle collector
+            int32 trial;
+
+            inline bool isMerged() const { return ( shared.load( std::memory_order_acquire ) & Merged ) != 0; }
+
+            // only meaningful while every mutator is parked
+            inline int32 getTotal() const
+            {
+                int32 word = shared.load( std::memory_order_acquire );
+                return ( word & Merged ) != 0 ? word >> 2 : ( word >> 2 ) + static_cast<int32>( biased );
+            }
+        };
+
+        static_assert( sizeof( Counts ) == 16 );
+
+        // one per thread touching the heap, every count operation goes through the calling thread's mutator
+        class Mutator
+        {
+        public:
+            explicit Mutator( CountedHeap& heap )
+                : heap( heap )
+                , id( heap.acquireOwner() )
+                , owner( heap.owners[ id ] )
+            {
+            }
+
+            // objects still owned here are merged by the next cycle collection once they are queued, or by the
+            // next mutator handed the slot, which inherits them along with the queue
+            ~Mutator()
+            {
+                safepoint();
+                cache.flush( heap.space, 0 );
+                heap.releaseOwner( id );
+            }
+
+            Mutator( const Mutator& ) = delete;
+            Mutator& operator=( const Mutator& ) = delete;
+
+            // a new object carries the one reference held by the caller
+            Value allocateTuple( uint32 field_count ) { return allocate( HeapObject::Tuple, field_count, 0 ); }
+
+            Value allocateString( std::string_view text )
+            {
+                Value value = allocate( HeapObject::String, 0, static_cast<uint32>( text.size() + 1 ) );
+                char* characters = getObject( value )->getCharacters();
+                memcpy( characters, text.data(), text.size() );
+                characters[ text.size() ] = 0;
+                return value;
+            }
+
+            // the finalizer runs on the thread whose decrement frees the object, at that thread's safepoint
+            Value allocateObject( Finalizer finalizer, void* payload )
+            {
+                Value value = allocate( HeapObject::CObject, 0, sizeof( Finalizer ) + sizeof( void* ) );
+                char* bytes = getObject( value )->getCharacters();
+                memcpy( bytes, &finalizer, sizeof( Finalizer ) );
+                memcpy( bytes + sizeof( Finalizer ), &payload, sizeof( void* ) );
+                return value;
+            }
+
+            inline void retain( Value value )
+            {
+                if( !isCounted( value ) )
+                {
+                    return;
+                }
+
+                Counts& counts = getCounts( getObject( value ) );
+                if( counts.owner == id && !counts.isMerged() )
+                {
+                    ++counts.biased;
+                }
+                else
+                {
+                    counts.shared.fetch_add( Counts::SharedOne, std::memory_order_relaxed );
+                }
+            }
+
+            inline void release( Value value )
+            {
+                if( !isCounted( value ) )
+                {
+                    return;
+                }
+
+                decrements.push_back( getObject( value ) );
+                if( decrements.size() >= DecrementBatch ) [[unlikely]]
+                {
+                    safepoint();
+                }
+            }
+
+            // the stored value gains a reference, the overwritten one loses its reference at the next safepoint
+            inline void writeField( Value object, uint32 index, Value value )
+            {
+                Value* slot = &getObject( object )->getFields()[ index ];
+                retain( value );
+                Value old = *slot;
+                *slot = value;
+                release( old );
+            }
+
+            static inline Value readField( Value object, uint32 index )
+            {
+                nassert( index < getObject( object )->field_count );
+                return getObject( object )->getFields()[ index ];
+            }
+
+            static inline void* getPayload( Value object )
+            {
+                void* payload;
+                memcpy( &payload, getObject( object )->getCharacters() + sizeof( Finalizer ), sizeof( void* ) );
+                return payload;
+            }
+
+            // applies the logged decrements, then merges objects other threads drove below zero
+            void safepoint()
+            {
+                while( true )
+                {
+                    while( !decrements.empty() )
+                    {
+                        HeapObject* object = decrements.back();
+                        decrements.pop_back();
+                        decrement( object );
+                    }
+
+                    if( !owner.has_queued.load( std::memory_order_acquire ) )
+                    {
+                        return;
+                    }
+                    mergeQueued();
+                }
+            }
+
+            // objects this mutator allocated minus those it destroyed, threads that share objects see partial counts
+            inline size_t getLiveCount() const { return allocated - destroyed; }
+
+        private:
+            friend class CountedHeap;
+
+            Value allocate( uint16 kind, uint32 field_count, uint32 byte_count )
+            {
+                uint32 size = sizeof( Counts ) + HeapObject::getAllocationSize( field_count, byte_count );
+                nassert( size <= PinnedSpace::MaxSize, "CountedHeap", "Object too large" );
+                uint32 size_class = heap.space.getClass( size );
+                unsigned char* cell = reinterpret_cast<unsigned char*>( cache.allocate( heap.space, size_class ) );
+
+                Counts* counts = new( cell ) Counts;
+                counts->biased = 1;
+                counts->shared.store( 0, std::memory_order_relaxed );
+                counts->owner = id;
+                counts->color = Counts::Black;
+                counts->state.store( 0, std::memory_order_relaxed );
+                counts->trial = 0;
+
+                HeapObject* object = reinterpret_cast<HeapObject*>( cell + sizeof( Counts ) );
+                object->size = PinnedSpace::ClassSizes[ size_class ] - sizeof( Counts );
+                object->kind = kind;
+                object->flags = 0;
+                object->field_count = field_count;
+                Value* fields = object->getFields();
+                for( uint32 i = 0; i < field_count; ++i )
+                {
+                    fields[ i ] = Value();
+                }
+
+                ++allocated;
+                return Value( static_cast<void*>( object ) );
+            }
+
+            // owner decrements stay plain until the biased count drains, then the object is merged and shared
+            // a foreign decrement that takes the shared count below zero asks the owner to merge
+            void decrement( HeapObject* object )
+            {
+                Counts& counts = getCounts( object );
+                if( counts.owner == id && !counts.isMerged() )
+                {
+                    if( --counts.biased != 0 )
+                    {
+                        addCandidate( object );
+                        return;
+                    }
+
+                    // a queued object is freed when its queue entry is merged, never twice
+                    int32 word = counts.shared.fetch_or( Counts::Merged, std::memory_order_acq_rel );
+                    if( ( word >> 2 ) != 0 )
+                    {
+                        addCandidate( object );
+                    }
+                    else if( ( word & Counts::Queued ) == 0 )
+                    {
+                        destroy( object );
+                    }
+                    return;
+                }
+
+                int32 word = counts.shared.load( std::memory_order_relaxed );
+                int32 next;
+                do
+                {
+                    next = word - Counts::SharedOne;
+                    if( ( next & Counts::Merged ) == 0 && ( next >> 2 ) < 0 )
+                    {
+                        next |= Counts::Queued;
+                    }
+                }
+                while( !counts.shared.compare_exchange_weak( word, next, std::memory_order_acq_rel, std::memory_order_relaxed ) );
+
+                if( ( next & Counts::Merged ) != 0 && ( next >> 2 ) == 0 )
+                {
+                    destroy( object );
+                }
+                else if( ( next & Counts::Queued ) != 0 && ( word & Counts::Queued ) == 0 )
+                {
+                    heap.queue( counts.owner, object );
+                }
+                else
+                {
+                    addCandidate( object );
+                }
+            }
+
+            void mergeQueued()
+            {
+                std::vector<HeapObject*> queued;
+                {
+                    std::lock_guard<std::mutex> lock( owner.mutex );
+                    queued.swap( owner.queued );
+                    owner.has_queued.store( false, std::memory_order_release );
+                }
+
+                for( HeapObject* object : queued )
+                {
+                    if( merge( object ) )
+                    {
+                        destroy( object );
+                    }
+                }
+            }
+
+            // folds the biased count into the shared one, true when the object is left without references
+            static bool merge( HeapObject* object )
+            {
+                Counts& counts = getCounts( object );
+                int32 biased = static_cast<int32>( counts.biased );
+                counts.biased = 0;
+                int32 word = counts.shared.load( std::memory_order_relaxed );
+                int32 next;
+                do
+                {
+                    next = ( word + biased * Counts::SharedOne ) | Counts::Merged;
+                }
+                while( !counts.shared.compare_exchange_weak( word, next, std::memory_order_acq_rel, std::memory_order_relaxed ) );
+                return ( next >> 2 ) == 0;
+            }
+
+            // only objects with fields can close a cycle
+            inline void addCandidate( HeapObject* object )
+            {
+                if( object->field_count == 0 || ( getCounts( object ).state.fetch_or( Counts::Buffered, std::memory_order_acq_rel ) & Counts::Buffered ) != 0 )
+                {
+                    return;
+                }
+                owner.candidates.push_back( object );
+            }
+
+            // children are logged rather than released recursively, so a long chain cannot overflow the stack
+            // a cell still listed as a cycle candidate is left to the cycle collector to return
+            void destroy( HeapObject* object )
+            {
+                finalize( object );
+                Value* fields = object->getFields();
+                for( uint32 i = 0; i < object->field_count; ++i )
+                {
+                    if( isCounted( fields[ i ] ) )
+                    {
+                        decrements.push_back( getObject( fields[ i ] ) );
+                    }
+                }
+
+                ++destroyed;
+                Counts& counts = getCounts( object );
+                if( ( counts.state.fetch_or( Counts::Dead, std::memory_order_acq_rel ) & Counts::Buffered ) == 0 )
+                {
+                    freeCell( object );
+                }
+            }
+
+            inline void freeCell( HeapObject* object )
+            {
+                uint32 size = object->size + sizeof( Counts );
+                cache.release( heap.space, heap.space.getClass( size ), reinterpret_cast<HeapObject*>( &getCounts( object ) ) );
+            }
+
+            CountedHeap& heap;
+            uint16 id;
+            Owner& owner;
+            PinnedCache cache;
+            std::vector<HeapObject*> decrements;
+            size_t allocated = 0;
+            size_t destroyed = 0;
+        };
+
+        CountedHeap()
+            : base( reserve() )
+            , space( base, SpaceSize )
+            , owner_count( 0 )
+        {
+        }
+
+        ~CountedHeap()
+        {
+            munmap( base, SpaceSize );
+        }
+
+        CountedHeap( const CountedHeap& ) = delete;
+        CountedHeap& operator=( const CountedHeap& ) = delete;
+
+        // synchronous trial deletion over the candidates of every mutator, run with all other mutators parked
+        // the collector's own mutator applies the decrements and returns the cells
+        void collectCycles( Mutator& collector )
+        {
+            collector.safepoint();
+
+            // orphaned queues of retired mutators are merged here, their objects are not biased any more
+            uint32 count = owner_count.load( std::memory_order_acquire );
+            std::vector<HeapObject*> roots;
+            for( uint32 i = 0; i < count; ++i )
+            {
+                Owner& owner = owners[ i ];
+                std::lock_guard<std::mutex> lock( owner.mutex );
+                for( HeapObject* object : owner.queued )
+                {
+                    if( Mutator::merge( object ) )
+                    {
+                        collector.destroy( object );
+                    }
+                }
+                owner.queued.clear();
+                owner.has_queued.store( false, std::memory_order_relaxed );
+
+                roots.insert( roots.end(), owner.candidates.begin(), owner.candidates.end() );
+                owner.candidates.clear();
+            }
+            collector.safepoint();
+
+            // objects whose count reached zero while buffered are only returned now
+            std::vector<HeapObject*> gray_roots;
+            for( HeapObject* object : roots )
+            {
+                Counts& counts = getCounts( object );
+                uint8 state = counts.state.load( std::memory_order_relaxed );
+                if( ( state & Counts::Dead ) != 0 )
+                {
+                    collector.freeCell( object );
+                    continue;
+                }
+
+                counts.state.fetch_and( static_cast<uint8>( ~Counts::Buffered ), std::memory_order_relaxed );
+                if( counts.color != Counts::Gray )
+                {
+                    counts.color = Counts::Gray;
+                    counts.trial = counts.getTotal();
+                    gray_roots.push_back( object );
+                }
+            }
+
+            // trial deletion: subtract every reference that comes from inside the candidate subgraph
+            std::vector<HeapObject*> gray = gray_roots;
+            std::vector<HeapObject*> stack = gray_roots;
+            while( !stack.empty() )
+            {
+                HeapObject* object = stack.back();
+                stack.pop_back();
+                forEachChild( object, [&gray, &stack]( HeapObject* child ) {
+                    Counts& child_counts = getCounts( child );
+                    if( child_counts.color != Counts::Gray )
+                    {
+                        child_counts.color = Counts::Gray;
+                        child_counts.trial = child_counts.getTotal();
+                        gray.push_back( child );
+                        stack.push_back( child );
+                    }
+                    --child_counts.trial;
+                } );
+            }
+
+            // anything still referenced from outside, and everything it reaches, survives
+            for( HeapObject* object : gray )
+            {
+                Counts& counts = getCounts( object );
+                if( counts.color == Counts::Gray && counts.trial > 0 )
+                {
+                    counts.color = Counts::Black;
+                    stack.push_back( object );
+                    while( !stack.empty() )
+                    {
+                        HeapObject* live = stack.back();
+                        stack.pop_back();
+                        forEachChild( live, [&stack]( HeapObject* child ) {
+                            Counts& child_counts = getCounts( child );
+                            if( child_counts.color != Counts::Black )
+                            {
+                                child_counts.color = Counts::Black;
+                                stack.push_back( child );
+                            }
+                        } );
+                    }
+                }
+            }
+
+            // the rest is garbage held only by itself: finalize it, release what it holds outside the
+            // garbage, then return the cells
+            std::vector<HeapObject*> white;
+            for( HeapObject* object : gray )
+            {
+                Counts& counts = getCounts( object );
+                if( counts.color == Counts::Gray )
+                {
+                    counts.color = Counts::White;
+                    white.push_back( object );
+                }
+            }
+
+            for( HeapObject* object : white )
+            {
+                finalize( object );
+                forEachChild( object, [&collector]( HeapObject* child ) {
+                    if( getCounts( child ).color != Counts::White )
+                    {
+                        collector.decrements.push_back( child );
+                    }
+                } );
+            }
+            // merging orphaned queues can buffer an object again after the roots were taken, like destroy()
+            // such a cell is only marked dead and returned by the collection that finds it listed
+            for( HeapObject* object : white )
+            {
+                if( ( getCounts( object ).state.fetch_or( Counts::Dead, std::memory_order_acq_rel ) & Counts::Buffered ) == 0 )
+                {
+                    collector.freeCell( object );
+                }
+            }
+            collector.destroyed += white.size();
+            collector.safepoint();
+        }
+
+        inline static bool isCounted( Value value ) { return value.isReferenceLayout() && value.getReference() != nullptr; }
+        static inline HeapObject* getObject( Value value ) { return static_cast<HeapObject*>( value.getReference() ); }
+        static inline Counts& getCounts( HeapObject* object ) { return *reinterpret_cast<Counts*>( reinterpret_cast<unsigned char*>( object ) - sizeof( Counts ) ); }
+
+        // borrowed references only, for checks made while every mutator is parked
+        static inline int32 getCount( Value value ) { return getCounts( getObject( value ) ).getTotal(); }
+
+        PinnedSpace::Statistics getStatistics( uint32 size_class ) { return space.getStatistics( size_class ); }
+
+        // owner slots ever handed out, retired mutators give theirs back
+        inline uint32 getOwnerCount() const { return owner_count.load( std::memory_order_acquire ); }
+
+    private:
+        struct alignas( 64 ) Owner
+        {
+            std::mutex mutex;
+            std::vector<HeapObject*> queued;
+            std::atomic<bool> has_queued = false;
+            // touched by the owning thread, read by the cycle collector while it is parked
+            std::vector<HeapObject*> candidates;
+        };
+
+        static unsigned char* reserve()
+        {
+            void* memory = mmap( nullptr, SpaceSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+            nassert( memory != MAP_FAILED, "CountedHeap", "Failed to reserve address space" );
+            return static_cast<unsigned char*>( memory );
+        }
+
+        // slots of retired mutators are handed out again first, so only concurrently live mutators are bounded
+        uint16 acquireOwner()
+        {
+            std::lock_guard<std::mutex> lock( owners_mutex );
+            if( !free_owners.empty() )
+            {
+                uint16 id = free_owners.back();
+                free_owners.pop_back();
+                return id;
+            }
+
+            uint32 id = owner_count.load( std::memory_order_relaxed );
+            if( id == MaxMutators )
+            {
+                fprintf( stderr, "CountedHeap: more than %u live mutators\n", MaxMutators );
+                abort();
+            }
+            owner_count.store( id + 1, std::memory_order_release );
+            return static_cast<uint16>( id );
+        }
+
+        void releaseOwner( uint16 id )
+        {
+            std::lock_guard<std::mutex> lock( owners_mutex );
+            free_owners.push_back( id );
+        }
+
+        void queue( uint16 owner_id, HeapObject* object )
+        {
+            Owner& owner = owners[ owner_id ];
+            std::lock_guard<std::mutex> lock( owner.mutex );
+            owner.queued.push_back( object );
+            owner.has_queued.store( true, std::memory_order_release );
+        }
+
+        template<typename F>
+        static inline void forEachChild( HeapObject* object, F f )
+        {
+            Value* fields = object->getFields();
+            for( uint32 i = 0; i < object->field_count; ++i )
+            {
+                if( isCounted( fields[ i ] ) )
+                {
+                    f( getObject( fields[ i ] ) );
+                }
+            }
+        }
+
+        static inline void finalize( HeapObject* object )
+        {
+            if( object->kind == HeapObject::CObject )
+            {
+                Finalizer finalizer;
+                void* payload;
+                memcpy( &finalizer, object->getCharacters(), sizeof( Finalizer ) );
+                memcpy( &payload, object->getCharacters() + sizeof( Finalizer ), sizeof( void* ) );
+                finalizer( payload );
+            }
+        }
+
+        unsigned char* base;
+        PinnedSpace space;
+        std::atomic<uint32> owner_count;
+        Owner owners[ MaxMutators ];
+        std::mutex owners_mutex;
+        std::vector<uint16> free_owners;
+    };
+}
+
+using Value = ::Nickel::System::Runtime::Alchemy::Value;
+using Heap = ::Nickel::System::Runtime::Alchemy::Heap;
+using CountedHeap = ::Nickel::System::Runtime::Alchemy::CountedHeap;
+
+int main( int argc, char** argv )
+{
+    constexpr uint32 ListLength = 100000;
+
+    Heap heap( 4 );
+
+    // a list of ( index, name, next ) tuples, every other node also hangs off a side array
+    // the side array is large enough to be pretenured, so every node stored into it is an old to young edge
+    Heap::Root list( heap );
+    Heap::Root side( heap, heap.allocateArray( ListLength / 2 ) );
+
+    for( uint32 i = 0; i < ListLength; ++i )
+    {
+        Heap::Root node( heap, heap.allocateTuple( 3 ) );
+        heap.writeField( node, 0, Value( int32( i ) ) );
+        Value name = heap.allocateString( "node" );
+        heap.writeField( node, 1, name );
+        heap.writeField( node, 2, list );
+        list = node.get();
+
+        if( i % 2 == 0 )
+        {
+            heap.writeField( side, i / 2, node );
+        }
+    }
+
+    int result = 0;
+
+    // the nursery filled up several times on the way, every node must have survived through the cards
+    for( uint32 i = 0; i < ListLength / 2; ++i )
+    {
+        Value node = Heap::readField( side, i );
+        result += Heap::readField( node, 0 ).getInt() == int32( i * 2 ) ? 0 : 1;
+    }
+
+    heap.collect();
+    result += heap.getLiveObjectCount() == 2 * ListLength + 1 ? 0 : 1;
+
+    // storing scalars never dirties a card
+    heap.scavenge();
+    Heap::Root first( heap, Heap::readField( side, 0 ) );
+    heap.writeField( side, 0, Value( 1.5 ) );
+    heap.writeField( side, 1, Value( int32( 7 ) ) );
+    result += heap.isCardDirty( side, 0 ) ? 1 : 0;
+    heap.writeField( side, 0, heap.allocateString( "young" ) );
+    result += heap.isCardDirty( side, 0 ) ? 0 : 1;
+    heap.writeField( side, 0, first );
+    first = Value();
+
+    // dropping the list head keeps what the side array still reaches: node 99996 and its whole tail
+    list = Value();
+    for( uint32 i = 0; i < ListLength / 2; ++i )
+    {
+        if( i % 2 == 1 )
+        {
+            heap.writeField( side, i, Value() );
+        }
+    }
+    heap.collect();
+    result += heap.getLiveObjectCount() == 2 * ( ListLength - 3 ) + 1 ? 0 : 1;
+
+    // incremental cycle: unlinking a node that is only reachable through the snapshot must not lose it
+    list = heap.allocateTuple( 1 );
+    Heap::Root hidden( heap, heap.allocateTuple( 1 ) );
+    heap.writeField( list, 0, hidden );
+    heap.writeField( hidden, 0, heap.allocateString( "hidden" ) );
+    heap.collect();
+    size_t before = heap.getLiveObjectCount();
+
+    heap.startMarking();
+    heap.stepMarking( 1 );
+    hidden = Value();
+    heap.writeField( list, 0, Value() );
+    while( !heap.stepMarking( 64 ) )
+    {
+    }
+    heap.finishCollection();
+    result += heap.getLiveObjectCount() == before ? 0 : 1;
+
+    // the next cycle reclaims it
+    heap.collect();
+    result += heap.getLiveObjectCount() == before - 2 ? 0 : 1;
+
+    // a spike of promoted objects with only every eighth one kept leaves the old space fragmented after the sweep,
+    // the next cycle slides the survivors together and gives the pages above them back
+    constexpr uint32 SpikeCount = 131072;
+    side = Value();
+    list = Value();
+    Heap::Root spike( heap, heap.allocateArray( SpikeCount ) );
+    for( uint32 i = 0; i < SpikeCount; ++i )
+    {
+        Value tuple = heap.allocateTuple( 4 );
+        heap.writeField( tuple, 0, Value( int32( i ) ) );
+        heap.writeField( spike, i, tuple );
+    }
+    heap.scavenge();
+    size_t peak = heap.getOldSpaceBytes();
+
+    // a pinned tuple keeps its address through the compaction, while what it points at moves
+    Heap::Root pinned( heap, heap.allocatePinnedTuple( 2 ) );
+    void* pinned_address = pinned.get().getReference();
+    heap.writeField( pinned, 1, Heap::readField( spike, 4096 ) );
+
+    for( uint32 i = 0; i < SpikeCount; ++i )
+    {
+        if( i % 8 != 0 )
+        {
+            heap.writeField( spike, i, Value() );
+        }
+    }
+    Value young = heap.allocateTuple( 1 );
+    heap.writeField( young, 0, Value( int32( 5 ) ) );
+    heap.writeField( pinned, 0, young );
+    heap.collect();
+    result += heap.isCompactionPending() ? 0 : 1;
+    size_t live = heap.getLiveObjectCount();
+
+    heap.collect();
+    result += !heap.isCompactionPending() && heap.getLiveObjectCount() == live ? 0 : 1;
+    result += heap.getOldSpaceBytes() == heap.getLiveBytes() && heap.getOldSpaceBytes() < peak / 2 ? 0 : 1;
+    for( uint32 i = 0; i < SpikeCount; i += 8 )
+    {
+        result += Heap::readField( Heap::readField( spike, i ), 0 ).getInt() == int32( i ) ? 0 : 1;
+    }
+    result += pinned.get().getReference() == pinned_address ? 0 : 1;
+    result += Heap::readField( Heap::readField( pinned, 0 ), 0 ).getInt() == 5 && !heap.isYoung( Heap::readField( pinned, 0 ) ) ? 0 : 1;
+    result += Heap::readField( Heap::readField( pinned, 1 ), 0 ).getInt() == 4096 ? 0 : 1;
+
+    // dead pinned cells go back to their class and are handed out again without carving new slabs
+    constexpr uint32 SmallClass = 0;
+    for( uint32 i = 0; i < 10000; ++i )
+    {
+        heap.allocatePinnedString( "external" );
+    }
+    heap.collect();
+    auto statistics = heap.getPinnedStatistics( SmallClass );
+    result += statistics.live_cells == 1 ? 0 : 1;
+    for( uint32 i = 0; i < 10000; ++i )
+    {
+        heap.allocatePinnedString( "external" );
+    }
+    heap.collect();
+    result += heap.getPinnedStatistics( SmallClass ).slabs == statistics.slabs ? 0 : 1;
+
+    // helper threads fill their own buffers in the nursery while the mutator is parked, then hand the objects over
+    constexpr uint32 HelperCount = 4;
+    constexpr uint32 HelperObjectCount = 2000;
+    heap.scavenge();
+    std::vector<Value> made( HelperCount * HelperObjectCount );
+    std::vector<std::thread> helpers;
+    for( uint32 t = 0; t < HelperCount; ++t )
+    {
+        helpers.emplace_back( [&heap, &made, t] {
+            Heap::LocalAllocator allocator( heap );
+            for( uint32 i = 0; i < HelperObjectCount; ++i )
+            {
+                Value tuple = allocator.allocateTuple( 3 );
+                heap.writeField( tuple, 0, Value( int32( t * HelperObjectCount + i ) ) );
+                made[ t * HelperObjectCount + i ] = tuple;
+            }
+        } );
+    }
+    for( auto& helper : helpers )
+    {
+        helper.join();
+    }
+
+    Heap::Root handed( heap, heap.allocateArray( HelperCount * HelperObjectCount ) );
+    for( uint32 i = 0; i < HelperCount * HelperObjectCount; ++i )
+    {
+        heap.writeField( handed, i, made[ i ] );
+    }
+    heap.collect();
+    for( uint32 i = 0; i < HelperCount * HelperObjectCount; ++i )
+    {
+        result += Heap::readField( Heap::readField( handed, i ), 0 ).getInt() == int32( i ) ? 0 : 1;
+    }
+
+    // helper threads hand their cached cells back in batches when their allocators go away
+    std::vector<std::thread> pinners;
+    for( uint32 t = 0; t < HelperCount; ++t )
+    {
+        pinners.emplace_back( [&heap] {
+            Heap::LocalAllocator allocator( heap );
+            for( uint32 i = 0; i < 100; ++i )
+            {
+                allocator.allocatePinnedTuple( 2 );
+            }
+        } );
+    }
+    for( auto& pinner : pinners )
+    {
+        pinner.join();
+    }
+    result += heap.getPinnedStatistics( SmallClass ).returns >= statistics.returns + HelperCount ? 0 : 1;
+
+    // finalizers run on their own thread: pauses only queue them, a drain waits for all queued so far
+    // the count outlives the heap, whose destructor drains whatever is still queued
+    static std::atomic<int32> finalized( 0 );
+    Heap::Finalizer count_finalized = []( void* payload ) { static_cast<std::atomic<int32>*>( payload )->fetch_add( 1 ); };
+    {
+        Heap::Root kept( heap, heap.allocateObject( count_finalized, &finalized ) );
+        for( uint32 i = 0; i < 10000; ++i )
+        {
+            heap.allocateObject( count_finalized, &finalized );
+        }
+        heap.scavenge();
+        heap.drainFinalizers();
+        result += finalized.load() == 10000 ? 0 : 1;
+
+        // promoted, then dead in the old space, some of them across a compaction
+        Heap::Root holders( heap, heap.allocateArray( 1000 ) );
+        for( uint32 i = 0; i < 1000; ++i )
+        {
+            heap.writeField( holders, i, heap.allocateObject( count_finalized, &finalized ) );
+        }
+        heap.scavenge();
+        for( uint32 i = 0; i < 1000; i += 2 )
+        {
+            heap.writeField( holders, i, Value() );
+        }
+        heap.collect();
+        heap.drainFinalizers();
+        result += finalized.load() == 10500 ? 0 : 1;
+
+        holders = Value();
+        kept = Value();
+        heap.collect();
+        heap.drainFinalizers();
+        result += finalized.load() == 11001 && heap.getPendingFinalizerCount() == 0 ? 0 : 1;
+    }
+
+    // objects still alive when their heap goes away are finalized by its destructor
+    {
+        Heap scoped( 1 );
+        Heap::Root live( scoped, scoped.allocateObject( count_finalized, &finalized ) );
+        scoped.allocateObject( count_finalized, &finalized );
+    }
+    result += finalized.load() == 11003 ? 0 : 1;
+
+    // counted mode: a handle is closed at the safepoint right after its last reference is dropped
+    CountedHeap counted;
+    CountedHeap::Mutator mutator( counted );
+    std::atomic<int32> closed( 0 );
+    CountedHeap::Finalizer close = []( void* payload ) { static_cast<std::atomic<int32>*>( payload )->fetch_add( 1 ); };
+
+    Value holder = mutator.allocateTuple( 1 );
+    Value handle = mutator.allocateObject( close, &closed );
+    mutator.writeField( holder, 0, handle );
+    mutator.release( handle );
+    mutator.safepoint();
+    result += closed.load() == 0 ? 0 : 1;
+    mutator.release( holder );
+    mutator.safepoint();
+    result += closed.load() == 1 && mutator.getLiveCount() == 0 ? 0 : 1;
+
+    // a cycle outlives its last outside reference until trial deletion runs, what it points out to survives
+    Value first_node = mutator.allocateTuple( 2 );
+    Value second_node = mutator.allocateTuple( 2 );
+    mutator.writeField( first_node, 0, second_node );
+    mutator.writeField( second_node, 0, first_node );
+    Value guard = mutator.allocateObject( close, &closed );
+    mutator.writeField( first_node, 1, guard );
+    mutator.release( guard );
+    Value outside = mutator.allocateTuple( 1 );
+    mutator.writeField( second_node, 1, outside );
+    mutator.release( first_node );
+    mutator.release( second_node );
+    mutator.safepoint();
+    result += closed.load() == 1 && mutator.getLiveCount() == 4 ? 0 : 1;
+    counted.collectCycles( mutator );
+    result += closed.load() == 2 && mutator.getLiveCount() == 1 && CountedHeap::getCount( outside ) == 1 ? 0 : 1;
+    mutator.release( outside );
+    mutator.safepoint();
+    result += mutator.getLiveCount() == 0 ? 0 : 1;
+
+    // foreign threads count atomically, the last reference dropped on one of them is merged by the owner
+    // the owner hands one reference to each thread and drops its own before any of them starts
+    Value shared = mutator.allocateTuple( 1 );
+    for( uint32 t = 0; t < HelperCount; ++t )
+    {
+        mutator.retain( shared );
+    }
+    mutator.release( shared );
+    mutator.safepoint();
+
+    std::vector<std::thread> sharers;
+    for( uint32 t = 0; t < HelperCount; ++t )
+    {
+        sharers.emplace_back( [&counted, shared] {
+            CountedHeap::Mutator local( counted );
+            for( uint32 i = 0; i < 1000; ++i )
+            {
+                local.retain( shared );
+                local.release( shared );
+            }
+            local.release( shared );
+        } );
+    }
+    for( auto& sharer : sharers )
+    {
+        sharer.join();
+    }
+    result += mutator.getLiveCount() == 1 ? 0 : 1;
+    mutator.safepoint();
+    result += mutator.getLiveCount() == 0 ? 0 : 1;
+
+    // a cycle whose last outside reference is an object of a retired mutator: merging that orphan during
+    // collection logs the decrement that buffers the cycle again, after the roots were taken
+    Value orphan;
+    std::thread retired( [&counted, &orphan] {
+        CountedHeap::Mutator local( counted );
+        orphan = local.allocateTuple( 1 );
+    } );
+    retired.join();
+
+    Value cycle_head = mutator.allocateTuple( 2 );
+    Value cycle_tail = mutator.allocateTuple( 1 );
+    mutator.writeField( cycle_head, 0, cycle_tail );
+    mutator.writeField( cycle_tail, 0, cycle_head );
+    Value cycle_guard = mutator.allocateObject( close, &closed );
+    mutator.writeField( cycle_head, 1, cycle_guard );
+    mutator.release( cycle_guard );
+    mutator.writeField( orphan, 0, cycle_head );
+    mutator.release( cycle_head );
+    mutator.release( cycle_tail );
+    mutator.safepoint();
+    counted.collectCycles( mutator );
+    result += closed.load() == 2 ? 0 : 1;
+
+    mutator.retain( cycle_tail );
+    mutator.release( cycle_tail );
+    mutator.release( orphan );
+    mutator.safepoint();
+    counted.collectCycles( mutator );
+    result += closed.load() == 3 ? 0 : 1;
+
+    // the head is still listed as a candidate, so its cell is held back until the next collection returns it
+    Value early[ 3 ];
+    for( Value& value : early )
+    {
+        value = mutator.allocateTuple( 2 );
+        result += value.getReference() != cycle_head.getReference() ? 0 : 1;
+    }
+    counted.collectCycles( mutator );
+    Value late = mutator.allocateTuple( 2 );
+    result += late.getReference() == cycle_head.getReference() && closed.load() == 3 ? 0 : 1;
+    for( Value value : early )
+    {
+        mutator.release( value );
+    }
+    mutator.release( late );
+    mutator.safepoint();
+
+    // short lived threads reuse the slots of retired mutators instead of running past the owner table
+    uint32 owner_slots = counted.getOwnerCount();
+    Value visited = mutator.allocateTuple( 1 );
+    for( uint32 t = 0; t < CountedHeap::MaxMutators * 2; ++t )
+    {
+        std::thread worker( [&counted, visited] {
+            CountedHeap::Mutator local( counted );
+            local.retain( visited );
+            Value scratch = local.allocateTuple( 1 );
+            local.writeField( scratch, 0, visited );
+            local.release( scratch );
+            local.release( visited );
+        } );
+        worker.join();
+    }
+    counted.collectCycles( mutator );
+    result += counted.getOwnerCount() <= owner_slots + 1 && CountedHeap::getCount( visited ) == 1 ? 0 : 1;
+    mutator.release( visited );
+    mutator.safepoint();
+
+    return result;
+}
\ No newline at end of file
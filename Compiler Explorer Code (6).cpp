@@ -0,0 +1,1975 @@
+#include <cstdio>
+#include <concepts>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+using uint8 = unsigned char;
+using uint16 = unsigned short;
+using int32 = int;
+using uint32 = unsigned int;
+using int64 = long long int;
+using uint64 = long long unsigned int;
+using std::nullptr_t;
+using std::size_t;
+
+#define nassert(...)
+
+namespace Nickel::System::Runtime::Alchemy
+{
+    struct TypeId
+    {
+        static constexpr uint32 Invalid = 0;
+        static constexpr uint32 Type = 1;
+        static constexpr uint32 Null = 2;
+        static constexpr uint32 Bool = 3;
+        static constexpr uint32 Int = 4;
+        static constexpr uint32 UInt = 5;
+        static constexpr uint32 Float = 6;
+        static constexpr uint32 Double = 7;
+
+        uint32 value;
+
+        constexpr TypeId()
+            : value( Invalid )
+        {
+        }
+
+        constexpr TypeId( uint32 value )
+            : value( value )
+        {
+        }
+
+        explicit operator uint32() const { return value; }
+        explicit operator bool() const { return value != 0; }
+
+        static constexpr const char* getName( uint32 type_id )
+        {
+            switch( type_id )
+            {
+                case Type: return "type";
+                case Null: return "null";
+                case Bool: return "bool";
+                case Int: return "int";
+                case UInt: return "uint";
+                case Float: return "float";
+                case Double: return "double";
+            }
+
+            return "(invalid)";
+        }
+    };
+
+    class Value
+    {
+        // tagged value layouts
+
+        // short layout ( 32bit )
+        // type: 0xffff0000 + 32bit type id
+        // null: 0xffff0001 + 00000000
+        // bool(true): 0xffff0002 + 00000001
+        // bool(false): 0xffff0002 + 00000000
+        // int: 0xffff0003 + 32bit payload
+        // uint: 0xffff0004 + 32bit payload
+        // float: 0xffff0005 + 32bit payload
+
+        // reference layout ( 48bit )
+        // reference: 0x0000 + 48bit payload(pointer)
+        // reference include string, tuple, array, function, object, cfunction, cobject
+
+        // long layout ( 64bit )
+        // double: range( 0x0001, 0xfffe ) + ( native_double_value + 0x0001000000000000 );
+
+        static constexpr uint64 LayoutMask = 0xffff000000000000;
+        static constexpr uint64 ShortLayout = 0xffff000000000000;
+        static constexpr uint64 ReferenceLayout = 0x0000000000000000;
+        
+        static constexpr uint64 LongValueTagMask = 0xffff000000000000;
+        static constexpr uint32 ReferenceTag = 0x0000000000000000;
+
+        static constexpr uint32 TypeIdTag = 0xffff0000;
+        static constexpr uint32 NullTag = 0xffff0001;
+        static constexpr uint32 BoolTag = 0xffff0002;
+        static constexpr uint32 IntTag = 0xffff0003;
+        static constexpr uint32 UIntTag = 0xffff0004;
+        static constexpr uint32 FloatTag = 0xffff0005;
+        
+        static constexpr uint64 DoubleEncodingOffset = 0x0001000000000000;
+        static constexpr uint64 ReferenceEncodingMask = 0x0000ffffffffffff;
+
+    public:
+        static constexpr uint64 InvalidType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Invalid;
+        static constexpr uint64 TypeType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Type;
+        static constexpr uint64 NullType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Null;
+        static constexpr uint64 BoolType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Bool;
+        static constexpr uint64 IntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Int;
+        static constexpr uint64 UIntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::UInt;
+        static constexpr uint64 FloatType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Float;
+        static constexpr uint64 DoubleType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Double;
+
+        static constexpr uint64 NullValue = uint64( NullTag ) << 32;
+        static constexpr uint64 TrueValue = ( uint64( BoolTag ) << 32 ) | 0x00000001;
+        static constexpr uint64 FalseValue = ( uint64( BoolTag ) << 32 ) | 0x00000000;
+
+    private:
+        union
+        {
+            uint64 data;
+
+            struct
+            {
+                union
+                {
+                    TypeId type_id;
+                    int32 int_value;
+                    uint32 uint_value;
+                    float float_value;
+                } value;
+
+                uint32 tag;
+
+            } short_layout;
+
+            struct
+            {
+                union
+                {
+                    double double_value;
+                    uint64 double_data;
+                } value;
+            } double_layout;
+
+            struct
+            {
+                void* reference_value;
+            } reference_layout;
+        };
+
+        static inline constexpr Value encodeDouble( double value )
+        {
+            Value v;
+            v.double_layout.value.double_value = value;
+            v.double_layout.value.double_data += DoubleEncodingOffset;
+
+            return v;
+        }
+
+        static inline constexpr double decodeDouble( Value value )
+        {
+            value.double_layout.value.double_data -= DoubleEncodingOffset;
+            return value.double_layout.value.double_value;
+        }
+
+    public:
+        constexpr Value()
+            : data { NullValue }
+        {
+        }
+
+        constexpr Value( uint64 data )
+            : data( data )
+        {
+        }
+
+        constexpr Value( TypeId value )
+        {
+            setTypeId( value );
+        }
+
+        constexpr Value( nullptr_t )
+        {
+            setNull();
+        }
+
+        constexpr Value( bool value )
+        {
+            setBool( value );
+        }
+
+        constexpr Value( int32 value )
+        {
+            setInt( value );
+        }
+
+        constexpr Value( uint32 value )
+        {
+            setUInt( value );
+        }
+
+        constexpr Value( float value )
+        {
+            setFloat( value );
+        }
+
+        constexpr Value( void* value )
+        {
+            setReference( value );
+        }
+
+        constexpr Value( double value )
+        {
+            setDouble( value );
+        }
+
+        explicit operator nullptr_t() const { nassert( isNull() ); return nullptr; }
+        explicit operator bool() const { nassert( isBool() ); return getBool(); }
+        //explicit operator int32() const { nassert( isInt() ); return getInt(); }
+        explicit operator uint32() const { nassert( isUInt() ); return getUInt(); }
+        explicit operator float() const { nassert( isFloat() ); return getFloat(); }
+        explicit operator void*() const { nassert( isReference() ); return getReference(); }
+        explicit operator double() const { nassert( isDouble() ); return getDouble(); }
+
+        inline constexpr bool isShortLayout() const { return ( data & LayoutMask ) == ShortLayout; }
+        inline constexpr bool isReferenceLayout() const { return ( data & LayoutMask ) == ReferenceLayout; }
+        inline constexpr bool isDoubleLayout() const { return !isShortLayout() && !isReferenceLayout(); }
+
+        inline constexpr bool isTypeId() const { return short_layout.tag == TypeIdTag; }
+        inline constexpr void setTypeId( TypeId value ) { short_layout = { { .type_id = value }, TypeIdTag }; }
+        inline constexpr TypeId getTypeId() const { return short_layout.value.type_id; }
+
+        inline constexpr bool isNull() const { return short_layout.tag == NullTag; }
+        inline constexpr void setNull() { data = NullValue; }
+        inline constexpr nullptr_t getNull() { return nullptr; }
+
+        inline constexpr bool isBool() const { return short_layout.tag == BoolTag; }
+        inline constexpr void setBool( bool value ) { data = value ? TrueValue : FalseValue; }
+        inline constexpr bool getBool() const { return data == TrueValue; }
+        inline constexpr void setTrue() { data = TrueValue; }
+        inline constexpr void setFalse() { data = FalseValue; }
+        inline constexpr bool isTrue() const { return data == TrueValue; }
+        inline constexpr bool isFalse() const { return data == FalseValue; }
+
+        inline constexpr bool isInt() const { return short_layout.tag == IntTag; }
+        inline constexpr void setInt( int32 value ) { short_layout = { { .int_value = value }, IntTag }; }
+        inline constexpr int32 getInt() const { return short_layout.value.int_value; }
+
+        inline constexpr bool isUInt() const { return short_layout.tag == UIntTag; }
+        inline constexpr void setUInt( uint32 value ) { short_layout = { { .uint_value = value }, UIntTag }; }
+        inline constexpr uint32 getUInt() const { return short_layout.value.uint_value; }
+
+        inline constexpr bool isFloat() const { return short_layout.tag == FloatTag; }
+        inline constexpr void setFloat( float value ) { short_layout = { { .float_value = value }, FloatTag }; }
+        inline constexpr float getFloat() const { return short_layout.value.float_value; }
+
+        inline constexpr bool isReference() const { return isReferenceLayout(); }
+        inline constexpr void setReference( void* value ) { reference_layout.reference_value = value; }
+        inline constexpr void* getReference() const { return reference_layout.reference_value; }
+
+        inline constexpr bool isDouble() const { return isDoubleLayout(); }
+        inline constexpr void setDouble( double value ) { *this = encodeDouble( value ); }
+        inline constexpr double getDouble() const { return decodeDouble( *this ); }
+
+        inline constexpr bool isNumeric() const { return isInt() || isUInt() || isFloat() || isDouble(); }
+        inline constexpr bool isValid() const { return data != InvalidType; }
+
+        inline constexpr TypeId getType() const
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return TypeId::Type;
+                    case NullTag:
+                        return TypeId::Null;
+                    case BoolTag:
+                        return TypeId::Bool;
+                    case IntTag:
+                        return TypeId::Int;
+                    case UIntTag:
+                        return TypeId::UInt;
+                    case FloatTag:
+                        return TypeId::Float;
+                    default:
+                        return TypeId::Invalid;
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                // TODO: implement abstract type deduction, do not support abstract value for now
+                return TypeId::Invalid;
+            }
+            
+            return TypeId::Double;
+        }
+
+        template<typename F>
+        constexpr auto apply( F f )
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return f( getTypeId() );
+                    case NullTag:
+                        return f( getNull() );
+                    case IntTag:
+                        return f( getInt() );
+                    case UIntTag:
+                        return f( getUInt() );
+                    case FloatTag:
+                        return f( getFloat() );
+                    default:
+                    {
+                        nassert( false, "Value", "Invalid tag, value corruption detected" );
+                        // return as if value is null
+                        return f( getNull() );
+                    }
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                return f( getReference() );
+            }
+
+            return f( getDouble() );
+        }
+    };
+
+    // aggregates built by compiled code, fields follow the header inline
+    struct Object
+    {
+        static constexpr uint32 Tuple = 1;
+        static constexpr uint32 Array = 2;
+        // one field, a captured variable that some closure or its owner assigns after capture
+        static constexpr uint32 Box = 3;
+        // the captured values, the function index sits in the kind above KindBits so the header alone tells
+        // which code a closure runs
+        static constexpr uint32 Closure = 4;
+        static constexpr uint32 KindBits = 8;
+        static constexpr uint32 KindMask = ( 1u << KindBits ) - 1;
+
+        uint32 kind;
+        uint32 field_count;
+
+        static inline constexpr uint32 getClosureKind( uint32 function ) { return Closure | ( function << KindBits ); }
+
+        inline Value* getFields() { return reinterpret_cast<Value*>( this + 1 ); }
+        inline bool isClosure() const { return ( kind & KindMask ) == Closure; }
+        inline uint32 getFunction() const { return kind >> KindBits; }
+        // kind and field count read as one word
+        inline uint64 getHeader() const
+        {
+            uint64 header;
+            memcpy( &header, this, sizeof( header ) );
+            return header;
+        }
+    };
+
+    static_assert( sizeof( Object ) == 8 );
+
+    // bump arena behind the interpreter, objects live until it is reset
+    class ObjectHeap
+    {
+    public:
+        static constexpr size_t ChunkSize = 1 << 20;
+
+        Object* allocate( uint32 kind, uint32 field_count )
+        {
+            size_t size = ( sizeof( Object ) + field_count * sizeof( Value ) + 15 ) & ~size_t( 15 );
+            if( chunks.empty() || used + size > ChunkSize )
+            {
+                chunks.emplace_back( new unsigned char[ ChunkSize ] );
+                used = 0;
+            }
+
+            Object* object = reinterpret_cast<Object*>( chunks.back().get() + used );
+            used += size;
+            object->kind = kind;
+            object->field_count = field_count;
+            ++allocation_count;
+            return object;
+        }
+
+        void reset()
+        {
+            chunks.clear();
+            used = 0;
+        }
+
+        inline uint64 getAllocationCount() const { return allocation_count; }
+
+    private:
+        std::vector<std::unique_ptr<unsigned char[]>> chunks;
+        size_t used = 0;
+        uint64 allocation_count = 0;
+    };
+
+    // a compiled function that folded a global, programs sharing one Globals number their functions alike
+    struct Dependent
+    {
+        uint32 program;
+        uint32 function;
+
+        bool operator==( const Dependent& ) const = default;
+    };
+
+    // what compiled code assumed about a global
+    struct Cell
+    {
+        uint32 definitions = 0;
+        // written by compiled code, its value is never folded
+        bool assigned = false;
+        // functions that folded the current value into their constants
+        std::vector<Dependent> dependents;
+    };
+
+    // globals live in a dense slot array, names are resolved to slots once, when code is compiled
+    // a global defined once by the host and never assigned by code is constant and folded by the compiler,
+    // redefining it, or compiling code that assigns it, invalidates the functions that folded it, which are
+    // recompiled before their program's next call. any number of programs may share one Globals
+    class Globals
+    {
+    public:
+        // every program gets its own invalidation list
+        uint32 attach()
+        {
+            invalidated.emplace_back();
+            detached.push_back( false );
+            return static_cast<uint32>( invalidated.size() - 1 );
+        }
+
+        void detach( uint32 program )
+        {
+            invalidated[ program ].clear();
+            detached[ program ] = true;
+        }
+
+        uint32 resolve( const std::string& name )
+        {
+            auto [ it, inserted ] = names.try_emplace( name, static_cast<uint32>( slots.size() ) );
+            if( inserted )
+            {
+                slots.emplace_back();
+                cells.emplace_back();
+            }
+            return it->second;
+        }
+
+        void define( const std::string& name, Value value )
+        {
+            uint32 slot = resolve( name );
+            Cell& cell = cells[ slot ];
+            slots[ slot ] = value;
+            if( cell.definitions++ > 0 )
+            {
+                invalidate( cell );
+            }
+        }
+
+        // code that writes the global was compiled, whoever folded it has to load it from now on
+        void markAssigned( uint32 slot )
+        {
+            Cell& cell = cells[ slot ];
+            if( !cell.assigned )
+            {
+                cell.assigned = true;
+                invalidate( cell );
+            }
+        }
+
+        inline bool isConstant( uint32 slot ) const { return cells[ slot ].definitions == 1 && !cells[ slot ].assigned; }
+
+        void addDependent( uint32 slot, uint32 program, uint32 function )
+        {
+            std::vector<Dependent>& dependents = cells[ slot ].dependents;
+            Dependent dependent = { program, function };
+            if( std::find( dependents.begin(), dependents.end(), dependent ) == dependents.end() )
+            {
+                dependents.push_back( dependent );
+            }
+        }
+
+        // functions of a program whose folded globals changed since its last call, each listed once
+        std::vector<uint32> takeInvalidated( uint32 program )
+        {
+            std::vector<uint32> functions;
+            functions.swap( invalidated[ program ] );
+            std::sort( functions.begin(), functions.end() );
+            functions.erase( std::unique( functions.begin(), functions.end() ), functions.end() );
+            return functions;
+        }
+
+        inline Value get( const std::string& name ) { return slots[ resolve( name ) ]; }
+        inline Value getSlot( uint32 slot ) const { return slots[ slot ]; }
+        // stable while code runs, slots are only added by the compiler and the host
+        inline Value* getSlots() { return slots.data(); }
+
+    private:
+        std::unordered_map<std::string, uint32> names;
+        std::vector<Value> slots;
+        std::vector<Cell> cells;
+        std::vector<std::vector<uint32>> invalidated;
+        std::vector<bool> detached;
+
+        void invalidate( Cell& cell )
+        {
+            for( const Dependent& dependent : cell.dependents )
+            {
+                if( !detached[ dependent.program ] )
+                {
+                    invalidated[ dependent.program ].push_back( dependent.function );
+                }
+            }
+            cell.dependents.clear();
+        }
+    };
+
+    // syntax tree of one function, variables are numbered per function with the parameters first
+    struct Node
+    {
+        enum class Kind : uint8
+        {
+            Constant,
+            Local,
+            Let,
+            Assign,
+            Unpack,
+            Add,
+            Subtract,
+            Multiply,
+            Less,
+            If,
+            While,
+            Sequence,
+            Tuple,
+            Array,
+            Field,
+            SetField,
+            Call,
+            Return,
+            Closure,
+            Upvalue,
+            SetUpvalue,
+            Apply,
+            Global,
+            SetGlobal,
+        };
+
+        Kind kind;
+        Value constant;
+        // variable of Local, Let and Assign, field of Field and SetField, callee of Call, function of Closure,
+        // capture of Upvalue and SetUpvalue, name of Global and SetGlobal
+        uint32 index = 0;
+        // Unpack holds its value followed by one Local per target, Apply its callee followed by the arguments
+        std::vector<Node*> children;
+    };
+
+    struct FunctionNode
+    {
+        static constexpr uint32 None = ~0u;
+
+        // a closure reads variables of the function it is created in, copied or boxed when it is created
+        uint32 parent = None;
+        std::vector<uint32> captures;
+        uint32 parameter_count = 0;
+        uint32 variable_count = 0;
+        uint32 result_count = 1;
+        Node* body = nullptr;
+    };
+
+    // owns the nodes of a program and hands out variables, scripts are built through it until there is a parser
+    class Syntax
+    {
+    public:
+        uint32 addFunction( uint32 parameter_count, uint32 result_count = 1 )
+        {
+            FunctionNode& function = functions.emplace_back();
+            function.parameter_count = parameter_count;
+            function.result_count = result_count;
+            function.variable_count = parameter_count;
+            return static_cast<uint32>( functions.size() - 1 );
+        }
+
+        uint32 addClosure( uint32 parent, uint32 parameter_count )
+        {
+            uint32 function = addFunction( parameter_count );
+            functions[ function ].parent = parent;
+            return function;
+        }
+
+        uint32 addCapture( uint32 function, uint32 variable )
+        {
+            functions[ function ].captures.push_back( variable );
+            return static_cast<uint32>( functions[ function ].captures.size() - 1 );
+        }
+
+        uint32 addVariable( uint32 function ) { return functions[ function ].variable_count++; }
+        void setBody( uint32 function, Node* body ) { functions[ function ].body = body; }
+
+        Node* constant( Value value ) { Node* node = make( Node::Kind::Constant, {} ); node->constant = value; return node; }
+        Node* local( uint32 variable ) { return make( Node::Kind::Local, {}, variable ); }
+        Node* let( uint32 variable, Node* value ) { return make( Node::Kind::Let, { value }, variable ); }
+        Node* assign( uint32 variable, Node* value ) { return make( Node::Kind::Assign, { value }, variable ); }
+
+        Node* unpack( std::vector<uint32> variables, Node* value )
+        {
+            Node* node = make( Node::Kind::Unpack, { value } );
+            for( uint32 variable : variables )
+            {
+                node->children.push_back( local( variable ) );
+            }
+            return node;
+        }
+
+        Node* add( Node* lhs, Node* rhs ) { return make( Node::Kind::Add, { lhs, rhs } ); }
+        Node* subtract( Node* lhs, Node* rhs ) { return make( Node::Kind::Subtract, { lhs, rhs } ); }
+        Node* multiply( Node* lhs, Node* rhs ) { return make( Node::Kind::Multiply, { lhs, rhs } ); }
+        Node* less( Node* lhs, Node* rhs ) { return make( Node::Kind::Less, { lhs, rhs } ); }
+        Node* branch( Node* condition, Node* then, Node* otherwise ) { return make( Node::Kind::If, { condition, then, otherwise } ); }
+        Node* loop( Node* condition, Node* body ) { return make( Node::Kind::While, { condition, body } ); }
+        Node* sequence( std::vector<Node*> statements ) { return make( Node::Kind::Sequence, std::move( statements ) ); }
+        Node* tuple( std::vector<Node*> elements ) { return make( Node::Kind::Tuple, std::move( elements ) ); }
+        Node* array( std::vector<Node*> elements ) { return make( Node::Kind::Array, std::move( elements ) ); }
+        Node* field( Node* object, uint32 index ) { return make( Node::Kind::Field, { object }, index ); }
+        Node* setField( Node* object, uint32 index, Node* value ) { return make( Node::Kind::SetField, { object, value }, index ); }
+        Node* call( uint32 function, std::vector<Node*> arguments ) { return make( Node::Kind::Call, std::move( arguments ), function ); }
+        Node* ret( Node* value ) { return make( Node::Kind::Return, { value } ); }
+        Node* ret( std::vector<Node*> values ) { return make( Node::Kind::Return, std::move( values ) ); }
+        Node* closure( uint32 function ) { return make( Node::Kind::Closure, {}, function ); }
+        Node* upvalue( uint32 capture ) { return make( Node::Kind::Upvalue, {}, capture ); }
+        Node* global( const std::string& name ) { return make( Node::Kind::Global, {}, addName( name ) ); }
+
+        Node* setGlobal( const std::string& name, Node* value )
+        {
+            uint32 index = addName( name );
+            assigned[ index ] = true;
+            return make( Node::Kind::SetGlobal, { value }, index );
+        }
+        Node* setUpvalue( uint32 capture, Node* value ) { return make( Node::Kind::SetUpvalue, { value }, capture ); }
+
+        Node* apply( Node* callee, std::vector<Node*> arguments )
+        {
+            arguments.insert( arguments.begin(), callee );
+            return make( Node::Kind::Apply, std::move( arguments ) );
+        }
+
+        inline const std::deque<FunctionNode>& getFunctions() const { return functions; }
+        inline const std::vector<std::string>& getNames() const { return names; }
+        inline bool isAssigned( uint32 name ) const { return assigned[ name ]; }
+
+    private:
+        Node* make( Node::Kind kind, std::vector<Node*> children, uint32 index = 0 )
+        {
+            Node& node = nodes.emplace_back();
+            node.kind = kind;
+            node.index = index;
+            node.children = std::move( children );
+            return &node;
+        }
+
+        uint32 addName( const std::string& name )
+        {
+            auto it = std::find( names.begin(), names.end(), name );
+            if( it != names.end() )
+            {
+                return static_cast<uint32>( it - names.begin() );
+            }
+            names.push_back( name );
+            assigned.push_back( false );
+            return static_cast<uint32>( names.size() - 1 );
+        }
+
+        std::deque<Node> nodes;
+        std::deque<FunctionNode> functions;
+        // globals the program mentions, by name index
+        std::vector<std::string> names;
+        std::vector<bool> assigned;
+    };
+
+    // register bytecode: a is the destination register unless noted, b and c are registers, constants,
+    // field indices, callees or jump targets depending on the opcode
+    enum class Opcode : uint8
+    {
+        LoadConstant,   // a = constants[ b ]
+        Move,           // a = b
+        Add,            // a = b + c
+        Subtract,       // a = b - c
+        Multiply,       // a = b * c
+        Less,           // a = b < c
+        Jump,           // goto b
+        JumpIfFalse,    // if !a goto b
+        NewTuple,       // a = tuple of c registers from b
+        NewArray,       // a = array of c registers from b
+        GetField,       // a = b[ c ]
+        SetField,       // a[ b ] = c
+        Call,           // a.. = functions[ b ]( c registers from a ), results replace the arguments
+        Return,         // return b registers from a
+        NewBox,         // a = box holding a
+        LoadBox,        // a = b's value
+        StoreBox,       // a's value = b
+        NewClosure,     // a = closure of functions[ b ] capturing c registers from a
+        LoadUpvalue,    // a = upvalues[ b ]
+        CallValue,      // a + 1 = a( c registers from a + 1 ) through call cache b, the closure returns a single value
+        LoadGlobal,     // a = globals[ b ]
+        StoreGlobal,    // globals[ b ] = a
+    };
+
+    struct Bytecode
+    {
+        Opcode opcode;
+        uint8 a;
+        uint16 b;
+        uint16 c;
+    };
+
+    struct Function;
+
+    // the closure headers a CallValue site has seen with a target taking exactly its argument count. a hit is
+    // one compare of the callee's header word, which holds the closure kind, its function and capture count,
+    // and enters the cached target without the kind, function table or arity checks. past Entries targets the
+    // site stops remembering
+    struct CallCache
+    {
+        static constexpr uint32 Entries = 4;
+
+        struct Entry
+        {
+            uint64 header;
+            Function* target;
+        };
+
+        Entry entries[ Entries ];
+        uint32 count = 0;
+        bool megamorphic = false;
+    };
+
+    struct Function
+    {
+        std::vector<Bytecode> code;
+        std::vector<Value> constants;
+        std::vector<CallCache> call_caches;
+        uint32 parameter_count = 0;
+        uint32 result_count = 1;
+        uint32 register_count = 0;
+    };
+
+    // which variables only ever hold a fixed size aggregate literal, or the results of a multiple value call,
+    // that is read and written by constant index
+    // such a variable never escapes: it is not passed, returned, stored, copied or compared, so its fields can
+    // live in consecutive frame registers and the aggregate is never built
+    class EscapeAnalysis
+    {
+    public:
+        static constexpr uint32 Escapes = ~0u;
+
+        EscapeAnalysis( const FunctionNode& function, const std::deque<FunctionNode>& functions )
+            : functions( functions )
+            , widths( function.variable_count, 0 )
+        {
+            // parameters arrive as whole values
+            for( uint32 i = 0; i < function.parameter_count; ++i )
+            {
+                widths[ i ] = Escapes;
+            }
+            visit( function.body, nullptr );
+
+            // an index past the literal reads something the aggregate never had, leave that to the heap path
+            for( const Node* access : accesses )
+            {
+                uint32 variable = access->children[ 0 ]->index;
+                if( widths[ variable ] != Escapes && access->index >= widths[ variable ] )
+                {
+                    widths[ variable ] = Escapes;
+                }
+            }
+        }
+
+        // field count of a scalar replaced variable, 0 for an ordinary one
+        inline uint32 getWidth( uint32 variable ) const { return widths[ variable ] == Escapes ? 0 : widths[ variable ]; }
+
+    private:
+        // fields a definition produces without building anything, 0 for any other value
+        uint32 getProducedWidth( const Node* value ) const
+        {
+            switch( value->kind )
+            {
+                case Node::Kind::Tuple:
+                case Node::Kind::Array:
+                    return static_cast<uint32>( value->children.size() );
+                case Node::Kind::Call:
+                    return functions[ value->index ].result_count > 1 ? functions[ value->index ].result_count : 0;
+                default:
+                    return 0;
+            }
+        }
+
+        void define( uint32 variable, const Node* value )
+        {
+            uint32 width = getProducedWidth( value );
+            if( width == 0 )
+            {
+                widths[ variable ] = Escapes;
+                return;
+            }
+
+            if( widths[ variable ] != 0 && widths[ variable ] != width )
+            {
+                widths[ variable ] = Escapes;
+                return;
+            }
+            if( widths[ variable ] == 0 )
+            {
+                widths[ variable ] = width;
+            }
+        }
+
+        void visit( const Node* node, const Node* parent )
+        {
+            switch( node->kind )
+            {
+                case Node::Kind::Local:
+                {
+                    // the only uses that keep a variable in registers are constant index loads and stores
+                    bool accessed = parent != nullptr && ( parent->kind == Node::Kind::Field || parent->kind == Node::Kind::SetField ) && parent->children[ 0 ] == node;
+                    if( !accessed )
+                    {
+                        widths[ node->index ] = Escapes;
+                    }
+                    else
+                    {
+                        accesses.push_back( parent );
+                    }
+                    break;
+                }
+                case Node::Kind::Let:
+                case Node::Kind::Assign:
+                    define( node->index, node->children[ 0 ] );
+                    break;
+                case Node::Kind::Unpack:
+                    // the targets receive single values
+                    for( size_t i = 1; i < node->children.size(); ++i )
+                    {
+                        widths[ node->children[ i ]->index ] = Escapes;
+                    }
+                    visit( node->children[ 0 ], node );
+                    return;
+                case Node::Kind::Closure:
+                    for( uint32 variable : functions[ node->index ].captures )
+                    {
+                        widths[ variable ] = Escapes;
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            for( const Node* child : node->children )
+            {
+                visit( child, node );
+            }
+        }
+
+        const std::deque<FunctionNode>& functions;
+        std::vector<uint32> widths;
+        // Field and SetField nodes whose object is a plain variable
+        std::vector<const Node*> accesses;
+    };
+
+    // closures are flat: a capture is copied into the closure when it is created, unless the variable can change
+    // afterwards, then the owner keeps it in a box for its whole life and the closure copies the box
+    class CaptureAnalysis
+    {
+    public:
+        explicit CaptureAnalysis( const std::deque<FunctionNode>& functions )
+            : functions( functions )
+            , boxed( functions.size() )
+        {
+            std::vector<std::vector<uint32>> definitions( functions.size() );
+            for( size_t i = 0; i < functions.size(); ++i )
+            {
+                boxed[ i ].assign( functions[ i ].variable_count, false );
+                definitions[ i ].assign( functions[ i ].variable_count, 0 );
+                std::fill_n( definitions[ i ].begin(), functions[ i ].parameter_count, 1 );
+                std::vector<bool> captured( functions[ i ].variable_count, false );
+                count( functions[ i ].body, false, captured, definitions[ i ] );
+            }
+
+            for( size_t i = 0; i < functions.size(); ++i )
+            {
+                const FunctionNode& closure = functions[ i ];
+                if( closure.parent == FunctionNode::None )
+                {
+                    continue;
+                }
+
+                std::vector<bool> assigned( closure.captures.size(), false );
+                findAssigned( closure.body, assigned );
+                for( size_t capture = 0; capture < closure.captures.size(); ++capture )
+                {
+                    uint32 variable = closure.captures[ capture ];
+                    if( assigned[ capture ] || definitions[ closure.parent ][ variable ] > 1 )
+                    {
+                        boxed[ closure.parent ][ variable ] = true;
+                    }
+                }
+            }
+        }
+
+        inline bool isBoxed( uint32 function, uint32 variable ) const { return boxed[ function ][ variable ]; }
+
+        inline bool isUpvalueBoxed( uint32 function, uint32 capture ) const
+        {
+            return boxed[ functions[ function ].parent ][ functions[ function ].captures[ capture ] ];
+        }
+
+    private:
+        // walks in evaluation order, a definition that may run again or that follows a closure capturing the
+        // variable counts twice, so the closure sees the value through a box instead of a stale copy
+        void count( const Node* node, bool in_loop, std::vector<bool>& captured, std::vector<uint32>& definitions ) const
+        {
+            bool loop = in_loop || node->kind == Node::Kind::While;
+            for( const Node* child : node->children )
+            {
+                count( child, loop, captured, definitions );
+            }
+
+            auto define = [&]( uint32 variable ) { definitions[ variable ] += loop || captured[ variable ] ? 2 : 1; };
+            if( node->kind == Node::Kind::Let || node->kind == Node::Kind::Assign )
+            {
+                define( node->index );
+            }
+            else if( node->kind == Node::Kind::Unpack )
+            {
+                for( size_t i = 1; i < node->children.size(); ++i )
+                {
+                    define( node->children[ i ]->index );
+                }
+            }
+            else if( node->kind == Node::Kind::Closure )
+            {
+                for( uint32 variable : functions[ node->index ].captures )
+                {
+                    captured[ variable ] = true;
+                }
+            }
+        }
+
+        static void findAssigned( const Node* node, std::vector<bool>& assigned )
+        {
+            if( node->kind == Node::Kind::SetUpvalue )
+            {
+                assigned[ node->index ] = true;
+            }
+
+            for( const Node* child : node->children )
+            {
+                findAssigned( child, assigned );
+            }
+        }
+
+        const std::deque<FunctionNode>& functions;
+        std::vector<std::vector<bool>> boxed;
+    };
+
+    // one pass per function: every variable owns a register, or a run of consecutive registers when escape
+    // analysis scalar replaced it, temporaries are stacked above the variables and popped after each node
+    class Compiler
+    {
+    public:
+        static constexpr uint32 MaxRegisters = 256;
+
+        struct Options
+        {
+            bool escape_analysis = true;
+        };
+
+        // program is the id Globals gave the caller, it tells whose functions to recompile when a folded global changes
+        static std::vector<Function> compile( const Syntax& syntax, Globals& globals, uint32 program, Options options )
+        {
+            std::vector<uint32> slots = resolve( syntax, globals );
+            CaptureAnalysis captures( syntax.getFunctions() );
+            std::vector<Function> functions;
+            for( uint32 i = 0; i < syntax.getFunctions().size(); ++i )
+            {
+                functions.push_back( Compiler( program, i, syntax.getFunctions(), captures, globals, slots, options ).finish() );
+            }
+            return functions;
+        }
+
+        static Function compile( const Syntax& syntax, Globals& globals, uint32 program, uint32 function, Options options )
+        {
+            std::vector<uint32> slots = resolve( syntax, globals );
+            CaptureAnalysis captures( syntax.getFunctions() );
+            return Compiler( program, function, syntax.getFunctions(), captures, globals, slots, options ).finish();
+        }
+
+    private:
+        // slot of every global name the program mentions
+        static std::vector<uint32> resolve( const Syntax& syntax, Globals& globals )
+        {
+            std::vector<uint32> slots;
+            for( uint32 name = 0; name < syntax.getNames().size(); ++name )
+            {
+                slots.push_back( globals.resolve( syntax.getNames()[ name ] ) );
+                if( syntax.isAssigned( name ) )
+                {
+                    globals.markAssigned( slots.back() );
+                }
+            }
+            return slots;
+        }
+
+        Compiler( uint32 program, uint32 index, const std::deque<FunctionNode>& functions, const CaptureAnalysis& captures, Globals& globals, const std::vector<uint32>& slots, Options options )
+            : program( program )
+            , index( index )
+            , node( functions[ index ] )
+            , functions( functions )
+            , captures( captures )
+            , globals( globals )
+            , slots( slots )
+            , analysis( node, functions )
+            , registers( node.variable_count )
+            , widths( node.variable_count )
+        {
+            uint32 next = 0;
+            for( uint32 variable = 0; variable < node.variable_count; ++variable )
+            {
+                registers[ variable ] = next;
+                widths[ variable ] = options.escape_analysis ? analysis.getWidth( variable ) : 0;
+                next += widths[ variable ] != 0 ? widths[ variable ] : 1;
+            }
+
+            top = next;
+            function.parameter_count = node.parameter_count;
+            function.result_count = node.result_count;
+            function.register_count = next;
+        }
+
+        Function finish()
+        {
+            // a boxed variable holds its box from entry, parameters are boxed with their argument
+            for( uint32 variable = 0; variable < node.variable_count; ++variable )
+            {
+                if( captures.isBoxed( index, variable ) )
+                {
+                    if( variable >= node.parameter_count )
+                    {
+                        emit( Opcode::LoadConstant, registers[ variable ], addConstant( Value() ), 0 );
+                    }
+                    emit( Opcode::NewBox, registers[ variable ], 0, 0 );
+                }
+            }
+
+            uint32 result = allocate( node.result_count );
+            compile( node.body, result );
+            // falling off the end returns nulls
+            for( uint32 i = 0; i < node.result_count; ++i )
+            {
+                emit( Opcode::LoadConstant, result + i, addConstant( Value() ), 0 );
+            }
+            emit( Opcode::Return, result, node.result_count, 0 );
+            return std::move( function );
+        }
+
+        uint32 allocate( uint32 count )
+        {
+            uint32 first = top;
+            top += count;
+            nassert( top <= MaxRegisters, "Compiler", "Too many registers" );
+            if( top > function.register_count )
+            {
+                function.register_count = top;
+            }
+            return first;
+        }
+
+        inline size_t emit( Opcode opcode, uint32 a, uint32 b, uint32 c )
+        {
+            function.code.push_back( { opcode, static_cast<uint8>( a ), static_cast<uint16>( b ), static_cast<uint16>( c ) } );
+            return function.code.size() - 1;
+        }
+
+        inline void patch( size_t jump ) { function.code[ jump ].b = static_cast<uint16>( function.code.size() ); }
+
+        uint32 addConstant( Value value )
+        {
+            function.constants.push_back( value );
+            return static_cast<uint32>( function.constants.size() - 1 );
+        }
+
+        inline bool isReplaced( const Node* node ) const { return node->kind == Node::Kind::Local && widths[ node->index ] != 0; }
+        inline bool isBoxed( const Node* node ) const { return node->kind == Node::Kind::Local && captures.isBoxed( index, node->index ); }
+        inline uint32 getResultCount( const Node* node ) const { return node->kind == Node::Kind::Call ? functions[ node->index ].result_count : 1; }
+
+        // arguments go to the top of the frame, which becomes the bottom of the callee's, and the results come
+        // back in the same registers
+        uint32 results( const Node* call )
+        {
+            uint32 count = static_cast<uint32>( call->children.size() );
+            uint32 first = allocate( std::max( { count, getResultCount( call ), 1u } ) );
+            for( uint32 i = 0; i < count; ++i )
+            {
+                compile( call->children[ i ], first + i );
+            }
+            emit( Opcode::Call, first, call->index, count );
+            return first;
+        }
+
+        // the register holding the node's value, a plain variable is read in place
+        uint32 operand( const Node* node )
+        {
+            if( node->kind == Node::Kind::Local && !isReplaced( node ) && !isBoxed( node ) )
+            {
+                return registers[ node->index ];
+            }
+
+            uint32 temporary = allocate( 1 );
+            compile( node, temporary );
+            return temporary;
+        }
+
+        void compile( const Node* node, uint32 target )
+        {
+            uint32 mark = top;
+            switch( node->kind )
+            {
+                case Node::Kind::Constant:
+                    emit( Opcode::LoadConstant, target, addConstant( node->constant ), 0 );
+                    break;
+                case Node::Kind::Local:
+                    nassert( !isReplaced( node ), "Compiler", "Scalar replaced variable used as a whole" );
+                    if( isBoxed( node ) )
+                    {
+                        emit( Opcode::LoadBox, target, registers[ node->index ], 0 );
+                    }
+                    else if( registers[ node->index ] != target )
+                    {
+                        emit( Opcode::Move, target, registers[ node->index ], 0 );
+                    }
+                    break;
+                case Node::Kind::Let:
+                case Node::Kind::Assign:
+                    define( node->index, node->children[ 0 ] );
+                    break;
+                case Node::Kind::Unpack:
+                    unpack( node );
+                    break;
+                case Node::Kind::Add:
+                case Node::Kind::Subtract:
+                case Node::Kind::Multiply:
+                case Node::Kind::Less:
+                {
+                    static constexpr Opcode Opcodes[] = { Opcode::Add, Opcode::Subtract, Opcode::Multiply, Opcode::Less };
+                    uint32 lhs = operand( node->children[ 0 ] );
+                    uint32 rhs = operand( node->children[ 1 ] );
+                    emit( Opcodes[ static_cast<uint32>( node->kind ) - static_cast<uint32>( Node::Kind::Add ) ], target, lhs, rhs );
+                    break;
+                }
+                case Node::Kind::If:
+                {
+                    size_t skip_then = emit( Opcode::JumpIfFalse, operand( node->children[ 0 ] ), 0, 0 );
+                    top = mark;
+                    compile( node->children[ 1 ], target );
+                    size_t skip_else = emit( Opcode::Jump, 0, 0, 0 );
+                    patch( skip_then );
+                    compile( node->children[ 2 ], target );
+                    patch( skip_else );
+                    break;
+                }
+                case Node::Kind::While:
+                {
+                    size_t head = function.code.size();
+                    size_t exit = emit( Opcode::JumpIfFalse, operand( node->children[ 0 ] ), 0, 0 );
+                    top = mark;
+                    compile( node->children[ 1 ], allocate( 1 ) );
+                    emit( Opcode::Jump, 0, static_cast<uint32>( head ), 0 );
+                    patch( exit );
+                    break;
+                }
+                case Node::Kind::Sequence:
+                    for( const Node* statement : node->children )
+                    {
+                        compile( statement, target );
+                    }
+                    break;
+                case Node::Kind::Tuple:
+                case Node::Kind::Array:
+                {
+                    uint32 count = static_cast<uint32>( node->children.size() );
+                    uint32 first = allocate( count );
+                    for( uint32 i = 0; i < count; ++i )
+                    {
+                        compile( node->children[ i ], first + i );
+                    }
+                    emit( node->kind == Node::Kind::Tuple ? Opcode::NewTuple : Opcode::NewArray, target, first, count );
+                    break;
+                }
+                case Node::Kind::Field:
+                    if( isReplaced( node->children[ 0 ] ) )
+                    {
+                        emit( Opcode::Move, target, registers[ node->children[ 0 ]->index ] + node->index, 0 );
+                    }
+                    else if( getResultCount( node->children[ 0 ] ) > node->index && getResultCount( node->children[ 0 ] ) > 1 )
+                    {
+                        emit( Opcode::Move, target, results( node->children[ 0 ] ) + node->index, 0 );
+                    }
+                    else
+                    {
+                        emit( Opcode::GetField, target, operand( node->children[ 0 ] ), node->index );
+                    }
+                    break;
+                case Node::Kind::SetField:
+                    if( isReplaced( node->children[ 0 ] ) )
+                    {
+                        compile( node->children[ 1 ], registers[ node->children[ 0 ]->index ] + node->index );
+                    }
+                    else
+                    {
+                        uint32 object = operand( node->children[ 0 ] );
+                        emit( Opcode::SetField, object, node->index, operand( node->children[ 1 ] ) );
+                    }
+                    break;
+                case Node::Kind::Call:
+                {
+                    uint32 first = results( node );
+                    uint32 count = getResultCount( node );
+                    if( count > 1 )
+                    {
+                        // the results are used as a whole, only now do they need a tuple
+                        emit( Opcode::NewTuple, target, first, count );
+                    }
+                    else if( first != target )
+                    {
+                        emit( Opcode::Move, target, first, 0 );
+                    }
+                    break;
+                }
+                case Node::Kind::Closure:
+                {
+                    // a boxed capture's register already holds the box, either way the closure copies the register
+                    const FunctionNode& closure = functions[ node->index ];
+                    uint32 count = static_cast<uint32>( closure.captures.size() );
+                    uint32 first = allocate( std::max( count, 1u ) );
+                    for( uint32 i = 0; i < count; ++i )
+                    {
+                        emit( Opcode::Move, first + i, registers[ closure.captures[ i ] ], 0 );
+                    }
+                    emit( Opcode::NewClosure, first, node->index, count );
+                    emit( Opcode::Move, target, first, 0 );
+                    break;
+                }
+                case Node::Kind::Upvalue:
+                    emit( Opcode::LoadUpvalue, target, node->index, 0 );
+                    if( captures.isUpvalueBoxed( index, node->index ) )
+                    {
+                        emit( Opcode::LoadBox, target, target, 0 );
+                    }
+                    break;
+                case Node::Kind::SetUpvalue:
+                {
+                    nassert( captures.isUpvalueBoxed( index, node->index ), "Compiler", "Assigned capture is not boxed" );
+                    uint32 box = allocate( 1 );
+                    emit( Opcode::LoadUpvalue, box, node->index, 0 );
+                    emit( Opcode::StoreBox, box, operand( node->children[ 0 ] ), 0 );
+                    break;
+                }
+                case Node::Kind::Apply:
+                {
+                    uint32 count = static_cast<uint32>( node->children.size() - 1 );
+                    uint32 first = allocate( count + 1 );
+                    for( uint32 i = 0; i <= count; ++i )
+                    {
+                        compile( node->children[ i ], first + i );
+                    }
+                    function.call_caches.emplace_back();
+                    emit( Opcode::CallValue, first, static_cast<uint32>( function.call_caches.size() - 1 ), count );
+                    emit( Opcode::Move, target, first + 1, 0 );
+                    break;
+                }
+                case Node::Kind::Global:
+                {
+                    uint32 slot = slots[ node->index ];
+                    if( globals.isConstant( slot ) )
+                    {
+                        globals.addDependent( slot, program, index );
+                        emit( Opcode::LoadConstant, target, addConstant( globals.getSlot( slot ) ), 0 );
+                    }
+                    else
+                    {
+                        emit( Opcode::LoadGlobal, target, slot, 0 );
+                    }
+                    break;
+                }
+                case Node::Kind::SetGlobal:
+                    emit( Opcode::StoreGlobal, operand( node->children[ 0 ] ), slots[ node->index ], 0 );
+                    break;
+                case Node::Kind::Return:
+                {
+                    uint32 count = static_cast<uint32>( node->children.size() );
+                    if( count == 1 && function.result_count > 1 && getResultCount( node->children[ 0 ] ) == function.result_count )
+                    {
+                        // a tail of another multiple value call forwards its registers
+                        emit( Opcode::Return, results( node->children[ 0 ] ), function.result_count, 0 );
+                    }
+                    else if( count == 1 )
+                    {
+                        emit( Opcode::Return, operand( node->children[ 0 ] ), 1, 0 );
+                    }
+                    else
+                    {
+                        nassert( count == function.result_count, "Compiler", "Wrong number of results" );
+                        uint32 first = allocate( count );
+                        for( uint32 i = 0; i < count; ++i )
+                        {
+                            compile( node->children[ i ], first + i );
+                        }
+                        emit( Opcode::Return, first, count, 0 );
+                    }
+                    break;
+                }
+            }
+            top = mark;
+        }
+
+        // a scalar replaced definition writes the literal's elements straight into the variable's registers
+        void define( uint32 variable, const Node* value )
+        {
+            if( captures.isBoxed( index, variable ) )
+            {
+                emit( Opcode::StoreBox, registers[ variable ], operand( value ), 0 );
+                return;
+            }
+            if( widths[ variable ] == 0 )
+            {
+                compile( value, registers[ variable ] );
+                return;
+            }
+
+            // elements may read the variable's own fields, so they are evaluated before any is stored
+            uint32 width = widths[ variable ];
+            uint32 first = value->kind == Node::Kind::Call ? results( value ) : allocate( width );
+            for( uint32 i = 0; value->kind != Node::Kind::Call && i < width; ++i )
+            {
+                compile( value->children[ i ], first + i );
+            }
+            for( uint32 i = 0; i < width; ++i )
+            {
+                emit( Opcode::Move, registers[ variable ] + i, first + i, 0 );
+            }
+        }
+
+        // destructuring takes a call's results or a literal's elements where they are computed, anything else
+        // is an aggregate read field by field
+        void unpack( const Node* node )
+        {
+            const Node* value = node->children[ 0 ];
+            uint32 count = static_cast<uint32>( node->children.size() - 1 );
+            uint32 first;
+            if( value->kind == Node::Kind::Call && getResultCount( value ) >= count )
+            {
+                first = results( value );
+            }
+            else if( ( value->kind == Node::Kind::Tuple || value->kind == Node::Kind::Array ) && value->children.size() >= count )
+            {
+                first = allocate( static_cast<uint32>( value->children.size() ) );
+                for( uint32 i = 0; i < value->children.size(); ++i )
+                {
+                    compile( value->children[ i ], first + i );
+                }
+            }
+            else
+            {
+                uint32 object = operand( value );
+                first = allocate( count );
+                for( uint32 i = 0; i < count; ++i )
+                {
+                    emit( Opcode::GetField, first + i, object, i );
+                }
+            }
+
+            for( uint32 i = 0; i < count; ++i )
+            {
+                uint32 variable = node->children[ i + 1 ]->index;
+                emit( captures.isBoxed( index, variable ) ? Opcode::StoreBox : Opcode::Move, registers[ variable ], first + i, 0 );
+            }
+        }
+
+        uint32 program;
+        uint32 index;
+        const FunctionNode& node;
+        const std::deque<FunctionNode>& functions;
+        const CaptureAnalysis& captures;
+        Globals& globals;
+        const std::vector<uint32>& slots;
+        EscapeAnalysis analysis;
+        std::vector<uint32> registers;
+        std::vector<uint32> widths;
+        uint32 top;
+        Function function;
+    };
+
+    // the compiled functions of a syntax and the globals they were compiled against
+    class Program
+    {
+    public:
+        Program( const Syntax& syntax, Globals& globals, Compiler::Options options )
+            : syntax( syntax )
+            , globals( globals )
+            , options( options )
+            , id( globals.attach() )
+            , functions( Compiler::compile( syntax, globals, id, options ) )
+        {
+        }
+
+        ~Program()
+        {
+            globals.detach( id );
+        }
+
+        Program( const Program& ) = delete;
+        Program& operator=( const Program& ) = delete;
+
+        // globals only change between calls from the host, so stale functions are never running here
+        void refresh()
+        {
+            for( uint32 function : globals.takeInvalidated( id ) )
+            {
+                functions[ function ] = Compiler::compile( syntax, globals, id, function, options );
+                ++recompile_count;
+            }
+        }
+
+        inline const std::vector<Function>& getFunctions() const { return functions; }
+        inline std::vector<Function>& getFunctions() { return functions; }
+        inline Globals& getGlobals() { return globals; }
+        inline uint32 getRecompileCount() const { return recompile_count; }
+
+    private:
+        const Syntax& syntax;
+        Globals& globals;
+        Compiler::Options options;
+        uint32 id;
+        std::vector<Function> functions;
+        uint32 recompile_count = 0;
+    };
+
+    // register window interpreter, a callee's frame starts at the caller's argument registers and leaves its
+    // results there
+    class Interpreter
+    {
+    public:
+        static constexpr size_t StackSize = 1 << 16;
+
+        Interpreter( Program& program, ObjectHeap& heap )
+            : program( program )
+            , functions( program.getFunctions() )
+            , heap( heap )
+            , stack( StackSize )
+        {
+        }
+
+        Value call( uint32 function, std::initializer_list<Value> arguments )
+        {
+            program.refresh();
+            globals = program.getGlobals().getSlots();
+            std::copy( arguments.begin(), arguments.end(), stack.begin() );
+            execute( functions[ function ], stack.data(), nullptr );
+            return stack[ 0 ];
+        }
+
+        // further results of the last call
+        inline Value getResult( uint32 index ) const { return stack[ index ]; }
+        // CallValues that missed their site's cache, or had none to hit
+        inline uint64 getGenericCallCount() const { return generic_call_count; }
+
+    private:
+        static inline double toDouble( Value value ) { return value.isInt() ? value.getInt() : value.getDouble(); }
+
+        template<typename F>
+        static inline Value arithmetic( Value lhs, Value rhs, F f )
+        {
+            if( lhs.isInt() && rhs.isInt() ) [[likely]]
+            {
+                return Value( static_cast<int32>( f( int64( lhs.getInt() ), int64( rhs.getInt() ) ) ) );
+            }
+            return Value( f( toDouble( lhs ), toDouble( rhs ) ) );
+        }
+
+        static inline Object* toObject( Value value ) { return static_cast<Object*>( value.getReference() ); }
+
+        static inline Function* lookup( const CallCache& cache, uint64 header )
+        {
+            for( uint32 i = 0; i < cache.count; ++i )
+            {
+                if( cache.entries[ i ].header == header )
+                {
+                    return cache.entries[ i ].target;
+                }
+            }
+            return nullptr;
+        }
+
+        // the generic path: the callee has to be a closure and the arguments have to fit its parameters
+        void callValue( CallCache& cache, Value callee, Value* arguments, uint32 count )
+        {
+            ++generic_call_count;
+            if( !callee.isReference() || !toObject( callee )->isClosure() )
+            {
+                // calling anything else yields null
+                arguments[ 0 ] = Value();
+                return;
+            }
+
+            Object* closure = toObject( callee );
+            uint32 index = closure->getFunction();
+            nassert( index < functions.size(), "Interpreter", "Bad closure" );
+            Function& target = functions[ index ];
+            if( count == target.parameter_count && !cache.megamorphic )
+            {
+                if( cache.count < CallCache::Entries )
+                {
+                    cache.entries[ cache.count++ ] = { closure->getHeader(), &target };
+                }
+                else
+                {
+                    cache.megamorphic = true;
+                }
+            }
+
+            // missing arguments are null, extra ones are never read
+            if( count < target.parameter_count )
+            {
+                std::fill( arguments + count, arguments + target.parameter_count, Value() );
+            }
+            execute( target, arguments, closure->getFields() );
+        }
+
+        void execute( Function& function, Value* registers, const Value* upvalues )
+        {
+            nassert( registers + function.register_count <= stack.data() + stack.size(), "Interpreter", "Stack overflow" );
+            const Value* constants = function.constants.data();
+            for( const Bytecode* pc = function.code.data(); ; ++pc )
+            {
+                switch( pc->opcode )
+                {
+                    case Opcode::LoadConstant:
+                        registers[ pc->a ] = constants[ pc->b ];
+                        break;
+                    case Opcode::Move:
+                        registers[ pc->a ] = registers[ pc->b ];
+                        break;
+                    case Opcode::Add:
+                        registers[ pc->a ] = arithmetic( registers[ pc->b ], registers[ pc->c ], []( auto lhs, auto rhs ) { return lhs + rhs; } );
+                        break;
+                    case Opcode::Subtract:
+                        registers[ pc->a ] = arithmetic( registers[ pc->b ], registers[ pc->c ], []( auto lhs, auto rhs ) { return lhs - rhs; } );
+                        break;
+                    case Opcode::Multiply:
+                        registers[ pc->a ] = arithmetic( registers[ pc->b ], registers[ pc->c ], []( auto lhs, auto rhs ) { return lhs * rhs; } );
+                        break;
+                    case Opcode::Less:
+                        registers[ pc->a ] = Value( toDouble( registers[ pc->b ] ) < toDouble( registers[ pc->c ] ) );
+                        break;
+                    case Opcode::Jump:
+                        pc = function.code.data() + pc->b - 1;
+                        break;
+                    case Opcode::JumpIfFalse:
+                        if( registers[ pc->a ].isFalse() )
+                        {
+                            pc = function.code.data() + pc->b - 1;
+                        }
+                        break;
+                    case Opcode::NewTuple:
+                    case Opcode::NewArray:
+                    {
+                        Object* object = heap.allocate( pc->opcode == Opcode::NewTuple ? Object::Tuple : Object::Array, pc->c );
+                        std::copy( registers + pc->b, registers + pc->b + pc->c, object->getFields() );
+                        registers[ pc->a ] = Value( static_cast<void*>( object ) );
+                        break;
+                    }
+                    case Opcode::GetField:
+                        registers[ pc->a ] = toObject( registers[ pc->b ] )->getFields()[ pc->c ];
+                        break;
+                    case Opcode::SetField:
+                        toObject( registers[ pc->a ] )->getFields()[ pc->b ] = registers[ pc->c ];
+                        break;
+                    case Opcode::Call:
+                        execute( functions[ pc->b ], registers + pc->a, nullptr );
+                        break;
+                    case Opcode::Return:
+                        // results move down to the frame base, the sources never sit below their destinations
+                        for( uint32 i = 0; i < pc->b; ++i )
+                        {
+                            registers[ i ] = registers[ pc->a + i ];
+                        }
+                        return;
+                    case Opcode::NewBox:
+                    {
+                        Object* box = heap.allocate( Object::Box, 1 );
+                        box->getFields()[ 0 ] = registers[ pc->a ];
+                        registers[ pc->a ] = Value( static_cast<void*>( box ) );
+                        break;
+                    }
+                    case Opcode::LoadBox:
+                        registers[ pc->a ] = toObject( registers[ pc->b ] )->getFields()[ 0 ];
+                        break;
+                    case Opcode::StoreBox:
+                        toObject( registers[ pc->a ] )->getFields()[ 0 ] = registers[ pc->b ];
+                        break;
+                    case Opcode::NewClosure:
+                    {
+                        Object* closure = heap.allocate( Object::getClosureKind( pc->b ), pc->c );
+                        std::copy( registers + pc->a, registers + pc->a + pc->c, closure->getFields() );
+                        registers[ pc->a ] = Value( static_cast<void*>( closure ) );
+                        break;
+                    }
+                    case Opcode::LoadUpvalue:
+                        registers[ pc->a ] = upvalues[ pc->b ];
+                        break;
+                    case Opcode::LoadGlobal:
+                        registers[ pc->a ] = globals[ pc->b ];
+                        break;
+                    case Opcode::StoreGlobal:
+                        globals[ pc->b ] = registers[ pc->a ];
+                        break;
+                    case Opcode::CallValue:
+                    {
+                        CallCache& cache = function.call_caches[ pc->b ];
+                        Value callee = registers[ pc->a ];
+                        if( callee.isReference() ) [[likely]]
+                        {
+                            Object* closure = toObject( callee );
+                            if( Function* target = lookup( cache, closure->getHeader() ) )
+                            {
+                                execute( *target, registers + pc->a + 1, closure->getFields() );
+                                break;
+                            }
+                        }
+                        callValue( cache, callee, registers + pc->a + 1, pc->c );
+                        break;
+                    }
+                }
+            }
+        }
+
+        Program& program;
+        std::vector<Function>& functions;
+        ObjectHeap& heap;
+        std::vector<Value> stack;
+        Value* globals = nullptr;
+        uint64 generic_call_count = 0;
+    };
+}
+
+using Value = ::Nickel::System::Runtime::Alchemy::Value;
+using Syntax = ::Nickel::System::Runtime::Alchemy::Syntax;
+using Compiler = ::Nickel::System::Runtime::Alchemy::Compiler;
+using Interpreter = ::Nickel::System::Runtime::Alchemy::Interpreter;
+using ObjectHeap = ::Nickel::System::Runtime::Alchemy::ObjectHeap;
+using Globals = ::Nickel::System::Runtime::Alchemy::Globals;
+using Program = ::Nickel::System::Runtime::Alchemy::Program;
+using Opcode = ::Nickel::System::Runtime::Alchemy::Opcode;
+using Bytecode = ::Nickel::System::Runtime::Alchemy::Bytecode;
+using CallCache = ::Nickel::System::Runtime::Alchemy::CallCache;
+using Node = ::Nickel::System::Runtime::Alchemy::Node;
+using Object = ::Nickel::System::Runtime::Alchemy::Object;
+
+int main( int argc, char** argv )
+{
+    Syntax syntax;
+
+    // distanceSquared( x1, y1, x2, y2 ): three temporary pairs, none of them leaves the function
+    uint32 distance = syntax.addFunction( 4 );
+    {
+        uint32 p = syntax.addVariable( distance );
+        uint32 q = syntax.addVariable( distance );
+        uint32 d = syntax.addVariable( distance );
+        syntax.setBody( distance, syntax.sequence( {
+            syntax.let( p, syntax.tuple( { syntax.local( 0 ), syntax.local( 1 ) } ) ),
+            syntax.let( q, syntax.tuple( { syntax.local( 2 ), syntax.local( 3 ) } ) ),
+            syntax.let( d, syntax.tuple( {
+                syntax.subtract( syntax.field( syntax.local( q ), 0 ), syntax.field( syntax.local( p ), 0 ) ),
+                syntax.subtract( syntax.field( syntax.local( q ), 1 ), syntax.field( syntax.local( p ), 1 ) ) } ) ),
+            syntax.ret( syntax.add(
+                syntax.multiply( syntax.field( syntax.local( d ), 0 ), syntax.field( syntax.local( d ), 0 ) ),
+                syntax.multiply( syntax.field( syntax.local( d ), 1 ), syntax.field( syntax.local( d ), 1 ) ) ) ),
+        } ) );
+    }
+
+    // run( n ): sum of distanceSquared( i, 1, 4, i + 2 ) for i below n
+    uint32 run = syntax.addFunction( 1 );
+    {
+        uint32 i = syntax.addVariable( run );
+        uint32 total = syntax.addVariable( run );
+        syntax.setBody( run, syntax.sequence( {
+            syntax.let( i, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.let( total, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.loop( syntax.less( syntax.local( i ), syntax.local( 0 ) ), syntax.sequence( {
+                syntax.assign( total, syntax.add( syntax.local( total ), syntax.call( distance, {
+                    syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ), syntax.constant( Value( int32( 4 ) ) ),
+                    syntax.add( syntax.local( i ), syntax.constant( Value( int32( 2 ) ) ) ) } ) ) ),
+                syntax.assign( i, syntax.add( syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+            } ) ),
+            syntax.ret( syntax.local( total ) ),
+        } ) );
+    }
+
+    // accumulate( n ): a two slot array updated in place, ( sum of i, count )
+    uint32 accumulate = syntax.addFunction( 1 );
+    {
+        uint32 i = syntax.addVariable( accumulate );
+        uint32 state = syntax.addVariable( accumulate );
+        syntax.setBody( accumulate, syntax.sequence( {
+            syntax.let( i, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.let( state, syntax.array( { syntax.constant( Value( int32( 0 ) ) ), syntax.constant( Value( int32( 0 ) ) ) } ) ),
+            syntax.loop( syntax.less( syntax.local( i ), syntax.local( 0 ) ), syntax.sequence( {
+                syntax.setField( syntax.local( state ), 0, syntax.add( syntax.field( syntax.local( state ), 0 ), syntax.local( i ) ) ),
+                syntax.setField( syntax.local( state ), 1, syntax.add( syntax.field( syntax.local( state ), 1 ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+                syntax.assign( i, syntax.add( syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+            } ) ),
+            syntax.ret( syntax.add( syntax.field( syntax.local( state ), 0 ), syntax.field( syntax.local( state ), 1 ) ) ),
+        } ) );
+    }
+
+    // makePair( a, b ): the pair is returned, so it has to be built
+    uint32 make_pair = syntax.addFunction( 2 );
+    {
+        uint32 pair = syntax.addVariable( make_pair );
+        syntax.setBody( make_pair, syntax.sequence( {
+            syntax.let( pair, syntax.tuple( { syntax.local( 0 ), syntax.local( 1 ) } ) ),
+            syntax.ret( syntax.local( pair ) ),
+        } ) );
+    }
+
+    // step( x, y ): ( x + y, y + 1 ) and walk( n ) feeding it back through destructuring
+    uint32 step = syntax.addFunction( 2, 2 );
+    syntax.setBody( step, syntax.ret( { syntax.add( syntax.local( 0 ), syntax.local( 1 ) ), syntax.add( syntax.local( 1 ), syntax.constant( Value( int32( 1 ) ) ) ) } ) );
+
+    uint32 walk = syntax.addFunction( 1 );
+    {
+        uint32 i = syntax.addVariable( walk );
+        uint32 x = syntax.addVariable( walk );
+        uint32 y = syntax.addVariable( walk );
+        syntax.setBody( walk, syntax.sequence( {
+            syntax.let( i, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.let( x, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.let( y, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.loop( syntax.less( syntax.local( i ), syntax.local( 0 ) ), syntax.sequence( {
+                syntax.unpack( { x, y }, syntax.call( step, { syntax.local( x ), syntax.local( y ) } ) ),
+                syntax.assign( i, syntax.add( syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+            } ) ),
+            syntax.ret( syntax.local( x ) ),
+        } ) );
+    }
+
+    // triple( a ): ( a, 2a, 3a ), summed through a variable that is only indexed, or kept whole
+    uint32 triple = syntax.addFunction( 1, 3 );
+    syntax.setBody( triple, syntax.ret( {
+        syntax.local( 0 ),
+        syntax.multiply( syntax.local( 0 ), syntax.constant( Value( int32( 2 ) ) ) ),
+        syntax.multiply( syntax.local( 0 ), syntax.constant( Value( int32( 3 ) ) ) ) } ) );
+
+    uint32 spread = syntax.addFunction( 1 );
+    {
+        uint32 t = syntax.addVariable( spread );
+        syntax.setBody( spread, syntax.sequence( {
+            syntax.let( t, syntax.call( triple, { syntax.local( 0 ) } ) ),
+            syntax.ret( syntax.add( syntax.add( syntax.field( syntax.local( t ), 0 ), syntax.field( syntax.local( t ), 1 ) ), syntax.field( syntax.local( t ), 2 ) ) ),
+        } ) );
+    }
+
+    uint32 keep = syntax.addFunction( 1 );
+    {
+        uint32 t = syntax.addVariable( keep );
+        syntax.setBody( keep, syntax.sequence( {
+            syntax.let( t, syntax.call( triple, { syntax.local( 0 ) } ) ),
+            syntax.ret( syntax.local( t ) ),
+        } ) );
+    }
+
+    // forward( x, y ): returns step's results without touching them
+    uint32 forward = syntax.addFunction( 2, 2 );
+    syntax.setBody( forward, syntax.ret( syntax.call( step, { syntax.local( 0 ), syntax.local( 1 ) } ) ) );
+
+    // reduce( f, n ): folds f( acc, i ) over i below n
+    uint32 reduce = syntax.addFunction( 2 );
+    {
+        uint32 i = syntax.addVariable( reduce );
+        uint32 acc = syntax.addVariable( reduce );
+        syntax.setBody( reduce, syntax.sequence( {
+            syntax.let( i, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.let( acc, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.loop( syntax.less( syntax.local( i ), syntax.local( 1 ) ), syntax.sequence( {
+                syntax.assign( acc, syntax.apply( syntax.local( 0 ), { syntax.local( acc ), syntax.local( i ) } ) ),
+                syntax.assign( i, syntax.add( syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+            } ) ),
+            syntax.ret( syntax.local( acc ) ),
+        } ) );
+    }
+
+    // sumScaled( n, k ): the closure copies k, which never changes
+    uint32 sum_scaled = syntax.addFunction( 2 );
+    uint32 scale = syntax.addClosure( sum_scaled, 2 );
+    {
+        uint32 k = syntax.addCapture( scale, 1 );
+        syntax.setBody( scale, syntax.ret( syntax.add( syntax.local( 0 ), syntax.multiply( syntax.local( 1 ), syntax.upvalue( k ) ) ) ) );
+        syntax.setBody( sum_scaled, syntax.ret( syntax.call( reduce, { syntax.closure( scale ), syntax.local( 0 ) } ) ) );
+    }
+
+    // countCalls( n ): the closure bumps its owner's counter, so the counter lives in a box
+    uint32 count_calls = syntax.addFunction( 1 );
+    uint32 counter = syntax.addClosure( count_calls, 2 );
+    {
+        uint32 calls = syntax.addVariable( count_calls );
+        uint32 captured = syntax.addCapture( counter, calls );
+        syntax.setBody( counter, syntax.sequence( {
+            syntax.setUpvalue( captured, syntax.add( syntax.upvalue( captured ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+            syntax.ret( syntax.add( syntax.local( 0 ), syntax.local( 1 ) ) ),
+        } ) );
+        syntax.setBody( count_calls, syntax.sequence( {
+            syntax.let( calls, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.call( reduce, { syntax.closure( counter ), syntax.local( 0 ) } ),
+            syntax.ret( syntax.local( calls ) ),
+        } ) );
+    }
+
+    // scaled( n ): n times a global the host defines once, bump(): counts its calls in a global
+    uint32 scaled = syntax.addFunction( 1 );
+    syntax.setBody( scaled, syntax.ret( syntax.multiply( syntax.local( 0 ), syntax.global( "scale" ) ) ) );
+    uint32 bump = syntax.addFunction( 0 );
+    syntax.setBody( bump, syntax.setGlobal( "hits", syntax.add( syntax.global( "hits" ), syntax.constant( Value( int32( 1 ) ) ) ) ) );
+
+    // spin( n ): reduces with five different closures, so reduce's call site runs out of entries
+    uint32 spin = syntax.addFunction( 1 );
+    {
+        std::vector<Node*> terms;
+        for( int32 k = 1; k <= 5; ++k )
+        {
+            uint32 addend = syntax.addClosure( spin, 2 );
+            syntax.setBody( addend, syntax.ret( syntax.add( syntax.local( 0 ), syntax.constant( Value( k ) ) ) ) );
+            terms.push_back( syntax.call( reduce, { syntax.closure( addend ), syntax.local( 0 ) } ) );
+        }
+
+        Node* sum = terms[ 0 ];
+        for( size_t i = 1; i < terms.size(); ++i )
+        {
+            sum = syntax.add( sum, terms[ i ] );
+        }
+        syntax.setBody( spin, syntax.ret( sum ) );
+    }
+
+    // lateCapture(): the closure is created before x's only definition, which sits in a loop, so x lives in a box
+    uint32 late_capture = syntax.addFunction( 0 );
+    uint32 read_late = syntax.addClosure( late_capture, 0 );
+    {
+        uint32 x = syntax.addVariable( late_capture );
+        uint32 f = syntax.addVariable( late_capture );
+        uint32 i = syntax.addVariable( late_capture );
+        uint32 captured = syntax.addCapture( read_late, x );
+        syntax.setBody( read_late, syntax.ret( syntax.upvalue( captured ) ) );
+        syntax.setBody( late_capture, syntax.sequence( {
+            syntax.let( f, syntax.closure( read_late ) ),
+            syntax.let( i, syntax.constant( Value( int32( 0 ) ) ) ),
+            syntax.loop( syntax.less( syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ) ), syntax.sequence( {
+                syntax.let( x, syntax.constant( Value( int32( 20 ) ) ) ),
+                syntax.assign( i, syntax.add( syntax.local( i ), syntax.constant( Value( int32( 1 ) ) ) ) ),
+            } ) ),
+            syntax.ret( syntax.apply( syntax.local( f ), {} ) ),
+        } ) );
+    }
+
+    constexpr int32 Count = 1000;
+    int32 expected = 0;
+    for( int32 i = 0; i < Count; ++i )
+    {
+        expected += ( 4 - i ) * ( 4 - i ) + ( i + 1 ) * ( i + 1 );
+    }
+
+    int result = 0;
+
+    ObjectHeap heap;
+    Compiler::Options plain;
+    plain.escape_analysis = false;
+    Globals heap_globals;
+    Program heap_program( syntax, heap_globals, plain );
+    Interpreter heap_interpreter( heap_program, heap );
+    result += heap_interpreter.call( run, { Value( Count ) } ).getInt() == expected ? 0 : 1;
+    result += heap.getAllocationCount() == uint64( 3 * Count ) ? 0 : 1;
+
+    ObjectHeap frame_heap;
+    Globals globals;
+    globals.define( "scale", Value( int32( 3 ) ) );
+    globals.define( "hits", Value( int32( 0 ) ) );
+    Program program( syntax, globals, Compiler::Options() );
+    Interpreter interpreter( program, frame_heap );
+    result += interpreter.call( run, { Value( Count ) } ).getInt() == expected ? 0 : 1;
+    result += interpreter.call( accumulate, { Value( Count ) } ).getInt() == Count * ( Count - 1 ) / 2 + Count ? 0 : 1;
+    result += interpreter.call( walk, { Value( Count ) } ).getInt() == Count * ( Count - 1 ) / 2 ? 0 : 1;
+    result += interpreter.call( spread, { Value( int32( 7 ) ) } ).getInt() == 42 ? 0 : 1;
+    result += interpreter.call( forward, { Value( int32( 3 ) ), Value( int32( 4 ) ) } ).getInt() == 7 && interpreter.getResult( 1 ).getInt() == 5 ? 0 : 1;
+    result += frame_heap.getAllocationCount() == 0 ? 0 : 1;
+
+    // one closure for the copied capture, a closure and a box for the assigned one
+    result += interpreter.call( sum_scaled, { Value( Count ), Value( int32( 3 ) ) } ).getInt() == 3 * Count * ( Count - 1 ) / 2 ? 0 : 1;
+    result += frame_heap.getAllocationCount() == 1 ? 0 : 1;
+    result += interpreter.call( count_calls, { Value( Count ) } ).getInt() == Count ? 0 : 1;
+    result += frame_heap.getAllocationCount() == 3 ? 0 : 1;
+
+    // two closures through reduce's call site so far, each took the generic path once and hit after that
+    const CallCache& reduce_cache = program.getFunctions()[ reduce ].call_caches[ 0 ];
+    result += reduce_cache.count == 2 && !reduce_cache.megamorphic && interpreter.getGenericCallCount() == 2 ? 0 : 1;
+
+    // five more kinds: two fill the cache and keep hitting, the other three always go the generic way
+    result += interpreter.call( spin, { Value( Count ) } ).getInt() == 15 * Count ? 0 : 1;
+    result += reduce_cache.megamorphic && interpreter.getGenericCallCount() == uint64( 2 + 2 + 3 * Count ) ? 0 : 1;
+
+    // the constant global is folded until the host redefines it, the assigned one always goes through its slot
+    auto loadsGlobal = [ & ]( uint32 function )
+    {
+        const std::vector<Bytecode>& code = program.getFunctions()[ function ].code;
+        return std::any_of( code.begin(), code.end(), []( const Bytecode& bytecode ) { return bytecode.opcode == Opcode::LoadGlobal; } );
+    };
+    result += interpreter.call( scaled, { Value( int32( 7 ) ) } ).getInt() == 21 && !loadsGlobal( scaled ) ? 0 : 1;
+    globals.define( "scale", Value( int32( 5 ) ) );
+    result += interpreter.call( scaled, { Value( int32( 7 ) ) } ).getInt() == 35 && loadsGlobal( scaled ) && program.getRecompileCount() == 1 ? 0 : 1;
+    interpreter.call( bump, {} );
+    interpreter.call( bump, {} );
+    result += globals.get( "hits" ).getInt() == 2 && loadsGlobal( bump ) ? 0 : 1;
+
+    Value pair = interpreter.call( make_pair, { Value( int32( 3 ) ), Value( int32( 4 ) ) } );
+    result += frame_heap.getAllocationCount() == 9 && static_cast<Object*>( pair.getReference() )->getFields()[ 1 ].getInt() == 4 ? 0 : 1;
+
+    Value kept = interpreter.call( keep, { Value( int32( 5 ) ) } );
+    result += frame_heap.getAllocationCount() == 10 && static_cast<Object*>( kept.getReference() )->getFields()[ 2 ].getInt() == 15 ? 0 : 1;
+
+    // programs sharing globals each recompile only their own functions, and compiling code that assigns a
+    // global unfolds it in every program that folded it
+    Globals shared_globals;
+    shared_globals.define( "offset", Value( int32( 10 ) ) );
+    shared_globals.define( "base", Value( int32( 1 ) ) );
+
+    Syntax reader_syntax;
+    uint32 read_base = reader_syntax.addFunction( 0 );
+    reader_syntax.setBody( read_base, reader_syntax.ret( reader_syntax.global( "base" ) ) );
+    uint32 read_offset = reader_syntax.addFunction( 1 );
+    reader_syntax.setBody( read_offset, reader_syntax.ret( reader_syntax.add( reader_syntax.local( 0 ), reader_syntax.global( "offset" ) ) ) );
+    Program reader( reader_syntax, shared_globals, Compiler::Options() );
+    Interpreter reader_interpreter( reader, frame_heap );
+    result += reader_interpreter.call( read_offset, { Value( int32( 1 ) ) } ).getInt() == 11 ? 0 : 1;
+
+    Syntax writer_syntax;
+    uint32 write_offset = writer_syntax.addFunction( 1 );
+    writer_syntax.setBody( write_offset, writer_syntax.setGlobal( "offset", writer_syntax.local( 0 ) ) );
+    uint32 scaled_base = writer_syntax.addFunction( 0 );
+    writer_syntax.setBody( scaled_base, writer_syntax.ret( writer_syntax.multiply( writer_syntax.global( "base" ), writer_syntax.constant( Value( int32( 100 ) ) ) ) ) );
+    Program writer( writer_syntax, shared_globals, Compiler::Options() );
+    Interpreter writer_interpreter( writer, frame_heap );
+    writer_interpreter.call( write_offset, { Value( int32( 20 ) ) } );
+    result += reader_interpreter.call( read_offset, { Value( int32( 1 ) ) } ).getInt() == 21 && reader.getRecompileCount() == 1 ? 0 : 1;
+
+    // base is folded by the reader's first function and the writer's second one
+    shared_globals.define( "base", Value( int32( 2 ) ) );
+    result += reader_interpreter.call( read_base, {} ).getInt() == 2 && writer_interpreter.call( scaled_base, {} ).getInt() == 200 ? 0 : 1;
+    result += reader.getRecompileCount() == 2 && writer.getRecompileCount() == 1 ? 0 : 1;
+
+    result += interpreter.call( late_capture, {} ).getInt() == 20 ? 0 : 1;
+
+    return result;
+}
\ No newline at end of file
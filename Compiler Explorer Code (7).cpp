@@ -0,0 +1,2826 @@
+#include <cstdio>
+#include <concepts>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <initializer_list>
+#include <new>
+#include <bit>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <sys/mman.h>
+
+using uint8 = unsigned char;
+using uint16 = unsigned short;
+using int32 = int;
+using uint32 = unsigned int;
+using int64 = long long int;
+using uint64 = long long unsigned int;
+using std::nullptr_t;
+using std::size_t;
+
+#define nassert(...)
+
+namespace Nickel::System::Runtime::Alchemy
+{
+    struct TypeId
+    {
+        static constexpr uint32 Invalid = 0;
+        static constexpr uint32 Type = 1;
+        static constexpr uint32 Null = 2;
+        static constexpr uint32 Bool = 3;
+        static constexpr uint32 Int = 4;
+        static constexpr uint32 UInt = 5;
+        static constexpr uint32 Float = 6;
+        static constexpr uint32 Double = 7;
+
+        uint32 value;
+
+        constexpr TypeId()
+            : value( Invalid )
+        {
+        }
+
+        constexpr TypeId( uint32 value )
+            : value( value )
+        {
+        }
+
+        explicit operator uint32() const { return value; }
+        explicit operator bool() const { return value != 0; }
+
+        static constexpr const char* getName( uint32 type_id )
+        {
+            switch( type_id )
+            {
+                case Type: return "type";
+                case Null: return "null";
+                case Bool: return "bool";
+                case Int: return "int";
+                case UInt: return "uint";
+                case Float: return "float";
+                case Double: return "double";
+            }
+
+            return "(invalid)";
+        }
+    };
+
+    class Value
+    {
+        // tagged value layouts
+
+        // short layout ( 32bit )
+        // type: 0xffff0000 + 32bit type id
+        // null: 0xffff0001 + 00000000
+        // bool(true): 0xffff0002 + 00000001
+        // bool(false): 0xffff0002 + 00000000
+        // int: 0xffff0003 + 32bit payload
+        // uint: 0xffff0004 + 32bit payload
+        // float: 0xffff0005 + 32bit payload
+
+        // reference layout ( 48bit )
+        // reference: 0x0000 + 48bit payload(pointer)
+        // reference include string, tuple, array, function, object, cfunction, cobject
+
+        // long layout ( 64bit )
+        // double: range( 0x0001, 0xfffe ) + ( native_double_value + 0x0001000000000000 );
+
+        static constexpr uint64 LayoutMask = 0xffff000000000000;
+        static constexpr uint64 ShortLayout = 0xffff000000000000;
+        static constexpr uint64 ReferenceLayout = 0x0000000000000000;
+        
+        static constexpr uint64 LongValueTagMask = 0xffff000000000000;
+        static constexpr uint32 ReferenceTag = 0x0000000000000000;
+
+        static constexpr uint32 TypeIdTag = 0xffff0000;
+        static constexpr uint32 NullTag = 0xffff0001;
+        static constexpr uint32 BoolTag = 0xffff0002;
+        static constexpr uint32 IntTag = 0xffff0003;
+        static constexpr uint32 UIntTag = 0xffff0004;
+        static constexpr uint32 FloatTag = 0xffff0005;
+        
+        static constexpr uint64 DoubleEncodingOffset = 0x0001000000000000;
+        static constexpr uint64 ReferenceEncodingMask = 0x0000ffffffffffff;
+
+    public:
+        static constexpr uint64 InvalidType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Invalid;
+        static constexpr uint64 TypeType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Type;
+        static constexpr uint64 NullType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Null;
+        static constexpr uint64 BoolType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Bool;
+        static constexpr uint64 IntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Int;
+        static constexpr uint64 UIntType = ( uint64( TypeIdTag ) << 32 ) | TypeId::UInt;
+        static constexpr uint64 FloatType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Float;
+        static constexpr uint64 DoubleType = ( uint64( TypeIdTag ) << 32 ) | TypeId::Double;
+
+        static constexpr uint64 NullValue = uint64( NullTag ) << 32;
+        static constexpr uint64 TrueValue = ( uint64( BoolTag ) << 32 ) | 0x00000001;
+        static constexpr uint64 FalseValue = ( uint64( BoolTag ) << 32 ) | 0x00000000;
+
+    private:
+        union
+        {
+            uint64 data;
+
+            struct
+            {
+                union
+                {
+                    TypeId type_id;
+                    int32 int_value;
+                    uint32 uint_value;
+                    float float_value;
+                } value;
+
+                uint32 tag;
+
+            } short_layout;
+
+            struct
+            {
+                union
+                {
+                    double double_value;
+                    uint64 double_data;
+                } value;
+            } double_layout;
+
+            struct
+            {
+                void* reference_value;
+            } reference_layout;
+        };
+
+        static inline constexpr Value encodeDouble( double value )
+        {
+            Value v;
+            v.double_layout.value.double_value = value;
+            v.double_layout.value.double_data += DoubleEncodingOffset;
+
+            return v;
+        }
+
+        static inline constexpr double decodeDouble( Value value )
+        {
+            value.double_layout.value.double_data -= DoubleEncodingOffset;
+            return value.double_layout.value.double_value;
+        }
+
+    public:
+        constexpr Value()
+            : data { NullValue }
+        {
+        }
+
+        constexpr Value( uint64 data )
+            : data( data )
+        {
+        }
+
+        constexpr Value( TypeId value )
+        {
+            setTypeId( value );
+        }
+
+        constexpr Value( nullptr_t )
+        {
+            setNull();
+        }
+
+        constexpr Value( bool value )
+        {
+            setBool( value );
+        }
+
+        constexpr Value( int32 value )
+        {
+            setInt( value );
+        }
+
+        constexpr Value( uint32 value )
+        {
+            setUInt( value );
+        }
+
+        constexpr Value( float value )
+        {
+            setFloat( value );
+        }
+
+        constexpr Value( void* value )
+        {
+            setReference( value );
+        }
+
+        constexpr Value( double value )
+        {
+            setDouble( value );
+        }
+
+        explicit operator nullptr_t() const { nassert( isNull() ); return nullptr; }
+        explicit operator bool() const { nassert( isBool() ); return getBool(); }
+        //explicit operator int32() const { nassert( isInt() ); return getInt(); }
+        explicit operator uint32() const { nassert( isUInt() ); return getUInt(); }
+        explicit operator float() const { nassert( isFloat() ); return getFloat(); }
+        explicit operator void*() const { nassert( isReference() ); return getReference(); }
+        explicit operator double() const { nassert( isDouble() ); return getDouble(); }
+
+        inline constexpr bool isShortLayout() const { return ( data & LayoutMask ) == ShortLayout; }
+        inline constexpr bool isReferenceLayout() const { return ( data & LayoutMask ) == ReferenceLayout; }
+        inline constexpr bool isDoubleLayout() const { return !isShortLayout() && !isReferenceLayout(); }
+
+        inline constexpr bool isTypeId() const { return short_layout.tag == TypeIdTag; }
+        inline constexpr void setTypeId( TypeId value ) { short_layout = { { .type_id = value }, TypeIdTag }; }
+        inline constexpr TypeId getTypeId() const { return short_layout.value.type_id; }
+
+        inline constexpr bool isNull() const { return short_layout.tag == NullTag; }
+        inline constexpr void setNull() { data = NullValue; }
+        inline constexpr nullptr_t getNull() { return nullptr; }
+
+        inline constexpr bool isBool() const { return short_layout.tag == BoolTag; }
+        inline constexpr void setBool( bool value ) { data = value ? TrueValue : FalseValue; }
+        inline constexpr bool getBool() const { return data == TrueValue; }
+        inline constexpr void setTrue() { data = TrueValue; }
+        inline constexpr void setFalse() { data = FalseValue; }
+        inline constexpr bool isTrue() const { return data == TrueValue; }
+        inline constexpr bool isFalse() const { return data == FalseValue; }
+
+        inline constexpr bool isInt() const { return short_layout.tag == IntTag; }
+        inline constexpr void setInt( int32 value ) { short_layout = { { .int_value = value }, IntTag }; }
+        inline constexpr int32 getInt() const { return short_layout.value.int_value; }
+
+        inline constexpr bool isUInt() const { return short_layout.tag == UIntTag; }
+        inline constexpr void setUInt( uint32 value ) { short_layout = { { .uint_value = value }, UIntTag }; }
+        inline constexpr uint32 getUInt() const { return short_layout.value.uint_value; }
+
+        inline constexpr bool isFloat() const { return short_layout.tag == FloatTag; }
+        inline constexpr void setFloat( float value ) { short_layout = { { .float_value = value }, FloatTag }; }
+        inline constexpr float getFloat() const { return short_layout.value.float_value; }
+
+        inline constexpr bool isReference() const { return isReferenceLayout(); }
+        inline constexpr void setReference( void* value ) { reference_layout.reference_value = value; }
+        inline constexpr void* getReference() const { return reference_layout.reference_value; }
+
+        inline constexpr bool isDouble() const { return isDoubleLayout(); }
+        inline constexpr void setDouble( double value ) { *this = encodeDouble( value ); }
+        inline constexpr double getDouble() const { return decodeDouble( *this ); }
+
+        inline constexpr bool isNumeric() const { return isInt() || isUInt() || isFloat() || isDouble(); }
+        inline constexpr bool isValid() const { return data != InvalidType; }
+
+        inline constexpr TypeId getType() const
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return TypeId::Type;
+                    case NullTag:
+                        return TypeId::Null;
+                    case BoolTag:
+                        return TypeId::Bool;
+                    case IntTag:
+                        return TypeId::Int;
+                    case UIntTag:
+                        return TypeId::UInt;
+                    case FloatTag:
+                        return TypeId::Float;
+                    default:
+                        return TypeId::Invalid;
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                // TODO: implement abstract type deduction, do not support abstract value for now
+                return TypeId::Invalid;
+            }
+            
+            return TypeId::Double;
+        }
+
+        template<typename F>
+        constexpr auto apply( F f )
+        {
+            if( isShortLayout() )
+            {
+                switch( short_layout.tag )
+                {
+                    case TypeIdTag:
+                        return f( getTypeId() );
+                    case NullTag:
+                        return f( getNull() );
+                    case IntTag:
+                        return f( getInt() );
+                    case UIntTag:
+                        return f( getUInt() );
+                    case FloatTag:
+                        return f( getFloat() );
+                    default:
+                    {
+                        nassert( false, "Value", "Invalid tag, value corruption detected" );
+                        // return as if value is null
+                        return f( getNull() );
+                    }
+                }
+            }
+            else if( isReferenceLayout() )
+            {
+                return f( getReference() );
+            }
+
+            return f( getDouble() );
+        }
+    };
+
+    // owner tokens of transients, never reused, a node published by a persistent update carries 0
+    struct Owner
+    {
+        static inline uint64 acquire()
+        {
+            static std::atomic<uint64> next( 1 );
+            return next.fetch_add( 1, std::memory_order_relaxed );
+        }
+    };
+
+    // a node of a persistent vector, 32 values in a leaf or 32 subtrees in a branch
+    struct VectorNode
+    {
+        static constexpr uint32 Bits = 5;
+        static constexpr uint32 Width = 1 << Bits;
+
+        VectorNode( uint64 owner, bool leaf )
+            : references( 1 )
+            , count( 0 )
+            , leaf( leaf )
+            , owner( owner )
+            , sizes( nullptr )
+            , children {}
+        {
+        }
+
+        std::atomic<uint32> references;
+        uint32 count;
+        bool leaf;
+        uint64 owner;
+        // cumulative element counts of the children of a relaxed branch, one that concatenation left with a
+        // child other than the last not full, null for a balanced branch
+        uint32* sizes;
+        union
+        {
+            VectorNode* children[ Width ];
+            Value values[ Width ];
+        };
+    };
+
+    // relaxed radix balanced tree: index lookups of a balanced branch are a shift and a mask, a relaxed branch
+    // scans its size table. versions share every node an update did not touch, an update copies one path,
+    // and concatenation merges the two trees along the seam instead of copying either
+    class PersistentVector
+    {
+    public:
+        using Node = VectorNode;
+        static constexpr uint32 Bits = Node::Bits;
+        static constexpr uint32 Width = Node::Width;
+
+        class Transient;
+
+        PersistentVector() = default;
+
+        PersistentVector( const PersistentVector& other )
+            : root( retain( other.root ) )
+            , size( other.size )
+            , shift( other.shift )
+        {
+        }
+
+        PersistentVector( PersistentVector&& other ) noexcept
+            : root( std::exchange( other.root, nullptr ) )
+            , size( std::exchange( other.size, 0 ) )
+            , shift( std::exchange( other.shift, 0 ) )
+        {
+        }
+
+        PersistentVector& operator=( PersistentVector other )
+        {
+            std::swap( root, other.root );
+            std::swap( size, other.size );
+            std::swap( shift, other.shift );
+            return *this;
+        }
+
+        ~PersistentVector() { release( root ); }
+
+        inline size_t getSize() const { return size; }
+        inline uint32 getDepth() const { return root == nullptr ? 0 : shift / Bits + 1; }
+
+        Value get( size_t index ) const
+        {
+            nassert( index < size, "PersistentVector", "Index out of range" );
+            const Node* node = root;
+            for( uint32 level = shift; level > 0; level -= Bits )
+            {
+                node = node->children[ findSlot( node, index, level ) ];
+            }
+            return node->values[ index ];
+        }
+
+        PersistentVector set( size_t index, Value value ) const
+        {
+            nassert( index < size, "PersistentVector", "Index out of range" );
+            PersistentVector result( *this );
+            result.root = setIn( result.root, shift, index, value, 0 );
+            return result;
+        }
+
+        PersistentVector push( Value value ) const
+        {
+            PersistentVector result( *this );
+            result.pushRoot( value, 0 );
+            return result;
+        }
+
+        static PersistentVector concat( const PersistentVector& left, const PersistentVector& right )
+        {
+            if( left.size == 0 )
+            {
+                return right;
+            }
+            if( right.size == 0 )
+            {
+                return left;
+            }
+
+            PersistentVector result;
+            auto [ first, second ] = join( retain( left.root ), left.shift, retain( right.root ), right.shift );
+            result.root = first;
+            result.shift = std::max( left.shift, right.shift );
+            result.size = left.size + right.size;
+            if( second != nullptr )
+            {
+                result.root = create( false );
+                result.root->children[ 0 ] = first;
+                result.root->children[ 1 ] = second;
+                result.root->count = 2;
+                result.shift += Bits;
+                fixSizes( result.root, result.shift );
+            }
+
+            // the seam may leave a chain of single child branches on top
+            while( result.shift > 0 && result.root->count == 1 )
+            {
+                Node* child = retain( result.root->children[ 0 ] );
+                release( result.root );
+                result.root = child;
+                result.shift -= Bits;
+            }
+            return result;
+        }
+
+    private:
+        static Node* create( bool leaf, uint64 owner = 0 ) { return new Node( owner, leaf ); }
+
+        static inline Node* retain( Node* node )
+        {
+            if( node != nullptr )
+            {
+                node->references.fetch_add( 1, std::memory_order_relaxed );
+            }
+            return node;
+        }
+
+        static void release( Node* node )
+        {
+            if( node == nullptr || node->references.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+            {
+                return;
+            }
+
+            if( !node->leaf )
+            {
+                for( uint32 i = 0; i < node->count; ++i )
+                {
+                    release( node->children[ i ] );
+                }
+            }
+            delete[] node->sizes;
+            delete node;
+        }
+
+        // takes over the caller's reference and returns a node the owner may write: the node itself when the
+        // owner made it, otherwise a copy holding its own references to the children
+        static Node* take( Node* node, uint64 owner )
+        {
+            if( owner != 0 && node->owner == owner )
+            {
+                return node;
+            }
+
+            Node* copy = create( node->leaf, owner );
+            copy->count = node->count;
+            if( node->leaf )
+            {
+                std::copy( node->values, node->values + node->count, copy->values );
+            }
+            else
+            {
+                for( uint32 i = 0; i < node->count; ++i )
+                {
+                    copy->children[ i ] = retain( node->children[ i ] );
+                }
+            }
+            if( node->sizes != nullptr )
+            {
+                copy->sizes = new uint32[ Width ];
+                std::copy( node->sizes, node->sizes + node->count, copy->sizes );
+            }
+
+            release( node );
+            return copy;
+        }
+
+        // child holding index, index becomes relative to that child
+        static inline uint32 findSlot( const Node* node, size_t& index, uint32 level )
+        {
+            if( node->sizes == nullptr )
+            {
+                uint32 slot = static_cast<uint32>( index >> level );
+                index -= size_t( slot ) << level;
+                return slot;
+            }
+
+            uint32 slot = 0;
+            while( node->sizes[ slot ] <= index )
+            {
+                ++slot;
+            }
+            index -= slot == 0 ? 0 : node->sizes[ slot - 1 ];
+            return slot;
+        }
+
+        static size_t sizeOf( const Node* node, uint32 level )
+        {
+            if( level == 0 )
+            {
+                return node->count;
+            }
+            if( node->sizes != nullptr )
+            {
+                return node->sizes[ node->count - 1 ];
+            }
+            return ( size_t( node->count - 1 ) << level ) + sizeOf( node->children[ node->count - 1 ], level - Bits );
+        }
+
+        static bool isFull( const Node* node, uint32 level )
+        {
+            if( node->count < Width )
+            {
+                return false;
+            }
+            return level == 0 || isFull( node->children[ Width - 1 ], level - Bits );
+        }
+
+        // a branch stays balanced while every child but the last is complete and balanced itself
+        static void fixSizes( Node* node, uint32 level )
+        {
+            bool balanced = true;
+            size_t total = 0;
+            uint32 sizes[ Width ];
+            for( uint32 i = 0; i < node->count; ++i )
+            {
+                const Node* child = node->children[ i ];
+                size_t child_size = sizeOf( child, level - Bits );
+                if( child->sizes != nullptr || ( i + 1 < node->count && child_size != ( size_t( 1 ) << level ) ) )
+                {
+                    balanced = false;
+                }
+                total += child_size;
+                sizes[ i ] = static_cast<uint32>( total );
+            }
+
+            if( balanced )
+            {
+                delete[] node->sizes;
+                node->sizes = nullptr;
+                return;
+            }
+            if( node->sizes == nullptr )
+            {
+                node->sizes = new uint32[ Width ];
+            }
+            std::copy( sizes, sizes + node->count, node->sizes );
+        }
+
+        static Node* setIn( Node* node, uint32 level, size_t index, Value value, uint64 owner )
+        {
+            node = take( node, owner );
+            if( level == 0 )
+            {
+                node->values[ index ] = value;
+                return node;
+            }
+
+            uint32 slot = findSlot( node, index, level );
+            node->children[ slot ] = setIn( node->children[ slot ], level - Bits, index, value, owner );
+            return node;
+        }
+
+        // a single value hanging off a chain of single child branches
+        static Node* makePath( uint32 level, Value value, uint64 owner )
+        {
+            Node* node = create( true, owner );
+            node->values[ 0 ] = value;
+            node->count = 1;
+            for( uint32 current = Bits; current <= level; current += Bits )
+            {
+                Node* parent = create( false, owner );
+                parent->children[ 0 ] = node;
+                parent->count = 1;
+                node = parent;
+            }
+            return node;
+        }
+
+        // appends along the rightmost path of a subtree that is known to have room
+        static Node* pushIn( Node* node, uint32 level, Value value, uint64 owner )
+        {
+            node = take( node, owner );
+            if( level == 0 )
+            {
+                node->values[ node->count++ ] = value;
+                return node;
+            }
+
+            uint32 last = node->count - 1;
+            if( !isFull( node->children[ last ], level - Bits ) )
+            {
+                node->children[ last ] = pushIn( node->children[ last ], level - Bits, value, owner );
+                if( node->sizes != nullptr )
+                {
+                    ++node->sizes[ last ];
+                }
+            }
+            else
+            {
+                node->children[ node->count ] = makePath( level - Bits, value, owner );
+                if( node->sizes != nullptr )
+                {
+                    node->sizes[ node->count ] = node->sizes[ last ] + 1;
+                }
+                ++node->count;
+            }
+            return node;
+        }
+
+        void pushRoot( Value value, uint64 owner )
+        {
+            if( root == nullptr )
+            {
+                root = makePath( 0, value, owner );
+            }
+            else if( !isFull( root, shift ) )
+            {
+                root = pushIn( root, shift, value, owner );
+            }
+            else
+            {
+                Node* top = create( false, owner );
+                top->children[ 0 ] = root;
+                top->children[ 1 ] = makePath( shift, value, owner );
+                top->count = 2;
+                root = top;
+                shift += Bits;
+                fixSizes( root, shift );
+            }
+            ++size;
+        }
+
+        // a node on level with room for one more child, or the second half when there is none
+        static std::pair<Node*, Node*> insertChild( Node* node, uint32 level, uint32 slot, Node* child )
+        {
+            if( node->count < Width )
+            {
+                std::copy_backward( node->children + slot, node->children + node->count, node->children + node->count + 1 );
+                node->children[ slot ] = child;
+                ++node->count;
+                fixSizes( node, level );
+                return { node, nullptr };
+            }
+
+            Node* single = create( false );
+            single->children[ 0 ] = child;
+            single->count = 1;
+            fixSizes( node, level );
+            fixSizes( single, level );
+            return slot == 0 ? std::make_pair( single, node ) : std::make_pair( node, single );
+        }
+
+        // joins two subtrees into one node, or two when they do not fit, on the level of the higher one
+        // both references are taken over, leaves are packed so lookups rarely meet a relaxed branch
+        static std::pair<Node*, Node*> join( Node* left, uint32 left_level, Node* right, uint32 right_level )
+        {
+            if( left_level > right_level )
+            {
+                Node* node = take( left, 0 );
+                uint32 last = node->count - 1;
+                auto [ first, second ] = join( node->children[ last ], left_level - Bits, right, right_level );
+                node->children[ last ] = first;
+                if( second == nullptr )
+                {
+                    fixSizes( node, left_level );
+                    return { node, nullptr };
+                }
+                return insertChild( node, left_level, node->count, second );
+            }
+
+            if( left_level < right_level )
+            {
+                Node* node = take( right, 0 );
+                auto [ first, second ] = join( left, left_level, node->children[ 0 ], right_level - Bits );
+                if( second == nullptr )
+                {
+                    node->children[ 0 ] = first;
+                    fixSizes( node, right_level );
+                    return { node, nullptr };
+                }
+                node->children[ 0 ] = second;
+                return insertChild( node, right_level, 0, first );
+            }
+
+            if( left_level == 0 )
+            {
+                uint32 moved = std::min( Width - left->count, right->count );
+                if( moved == 0 )
+                {
+                    return { left, right };
+                }
+
+                Node* to = take( left, 0 );
+                std::copy( right->values, right->values + moved, to->values + to->count );
+                to->count += moved;
+                if( moved == right->count )
+                {
+                    release( right );
+                    return { to, nullptr };
+                }
+
+                Node* rest = create( true );
+                rest->count = right->count - moved;
+                std::copy( right->values + moved, right->values + right->count, rest->values );
+                release( right );
+                return { to, rest };
+            }
+
+            // same level: join the seam, then lay both child lists out again
+            Node* children[ 2 * Width ];
+            uint32 count = 0;
+            for( uint32 i = 0; i + 1 < left->count; ++i )
+            {
+                children[ count++ ] = retain( left->children[ i ] );
+            }
+            auto [ first, second ] = join( retain( left->children[ left->count - 1 ] ), left_level - Bits, retain( right->children[ 0 ] ), right_level - Bits );
+            children[ count++ ] = first;
+            if( second != nullptr )
+            {
+                children[ count++ ] = second;
+            }
+            for( uint32 i = 1; i < right->count; ++i )
+            {
+                children[ count++ ] = retain( right->children[ i ] );
+            }
+            release( left );
+            release( right );
+
+            Node* nodes[ 2 ] = { create( false ), count > Width ? create( false ) : nullptr };
+            for( uint32 i = 0; i < count; ++i )
+            {
+                Node* node = nodes[ i / Width ];
+                node->children[ node->count++ ] = children[ i ];
+            }
+            fixSizes( nodes[ 0 ], left_level );
+            if( nodes[ 1 ] != nullptr )
+            {
+                fixSizes( nodes[ 1 ], left_level );
+            }
+            return { nodes[ 0 ], nodes[ 1 ] };
+        }
+
+        Node* root = nullptr;
+        size_t size = 0;
+        uint32 shift = 0;
+    };
+
+    // batches updates into one version: the nodes it copies or creates are its own until it is frozen,
+    // and it writes them in place instead of copying the path again
+    class PersistentVector::Transient
+    {
+    public:
+        explicit Transient( PersistentVector vector = PersistentVector() )
+            : vector( std::move( vector ) )
+            , owner( Owner::acquire() )
+        {
+        }
+
+        // move only: a copy would share the owner token and write the same nodes in place,
+        // the moved-from transient gets a fresh token so it can never touch the nodes it gave away
+        Transient( Transient&& other ) noexcept
+            : vector( std::move( other.vector ) )
+            , owner( std::exchange( other.owner, Owner::acquire() ) )
+        {
+        }
+
+        Transient& operator=( Transient&& other ) noexcept
+        {
+            vector = std::move( other.vector );
+            owner = std::exchange( other.owner, Owner::acquire() );
+            return *this;
+        }
+
+        Transient( const Transient& ) = delete;
+        Transient& operator=( const Transient& ) = delete;
+
+        inline size_t getSize() const { return vector.size; }
+        inline Value get( size_t index ) const { return vector.get( index ); }
+        void push( Value value ) { vector.pushRoot( value, owner ); }
+
+        void set( size_t index, Value value )
+        {
+            nassert( index < vector.size, "PersistentVector", "Index out of range" );
+            vector.root = setIn( vector.root, vector.shift, index, value, owner );
+        }
+
+        // later updates go through a new owner, so nothing reachable from the version is written again
+        PersistentVector freeze()
+        {
+            owner = Owner::acquire();
+            return vector;
+        }
+
+    private:
+        PersistentVector vector;
+        uint64 owner;
+    };
+
+    // a node of a persistent map: entries stored inline and subtrees, each placed by five bits of the key's hash
+    // once the hash is used up, the node is a collision list of keys with equal hashes
+    struct MapNode
+    {
+        struct Entry
+        {
+            Value key;
+            Value value;
+        };
+
+        explicit MapNode( uint64 owner )
+            : references( 1 )
+            , owner( owner )
+        {
+        }
+
+        std::atomic<uint32> references;
+        uint64 owner;
+        uint32 entry_map = 0;
+        uint32 child_map = 0;
+        std::vector<Entry> entries;
+        std::vector<MapNode*> children;
+    };
+
+    // hash array mapped trie keyed by Value identity: numbers and short values by their bits, references by address
+    class PersistentMap
+    {
+    public:
+        using Node = MapNode;
+        using Entry = MapNode::Entry;
+        static constexpr uint32 Bits = 5;
+        static constexpr uint32 Mask = ( 1 << Bits ) - 1;
+        static constexpr uint32 HashBits = 32;
+
+        class Transient;
+
+        PersistentMap() = default;
+
+        PersistentMap( const PersistentMap& other )
+            : root( retain( other.root ) )
+            , size( other.size )
+        {
+        }
+
+        PersistentMap( PersistentMap&& other ) noexcept
+            : root( std::exchange( other.root, nullptr ) )
+            , size( std::exchange( other.size, 0 ) )
+        {
+        }
+
+        PersistentMap& operator=( PersistentMap other )
+        {
+            std::swap( root, other.root );
+            std::swap( size, other.size );
+            return *this;
+        }
+
+        ~PersistentMap() { release( root ); }
+
+        inline size_t getSize() const { return size; }
+
+        const Value* find( Value key ) const
+        {
+            uint32 key_hash = hash( key );
+            const Node* node = root;
+            for( uint32 shift = 0; node != nullptr; shift += Bits )
+            {
+                if( shift >= HashBits )
+                {
+                    for( const Entry& entry : node->entries )
+                    {
+                        if( isSame( entry.key, key ) )
+                        {
+                            return &entry.value;
+                        }
+                    }
+                    return nullptr;
+                }
+
+                uint32 bit = getBit( key_hash, shift );
+                if( ( node->entry_map & bit ) != 0 )
+                {
+                    const Entry& entry = node->entries[ getIndex( node->entry_map, bit ) ];
+                    return isSame( entry.key, key ) ? &entry.value : nullptr;
+                }
+                node = ( node->child_map & bit ) != 0 ? node->children[ getIndex( node->child_map, bit ) ] : nullptr;
+            }
+            return nullptr;
+        }
+
+        PersistentMap set( Value key, Value value ) const
+        {
+            PersistentMap result( *this );
+            result.setRoot( key, value, 0 );
+            return result;
+        }
+
+        PersistentMap remove( Value key ) const
+        {
+            PersistentMap result( *this );
+            result.removeRoot( key, 0 );
+            return result;
+        }
+
+    private:
+        static inline uint32 hash( Value key )
+        {
+            uint64 bits;
+            memcpy( &bits, &key, sizeof( bits ) );
+            bits ^= bits >> 33;
+            bits *= 0xff51afd7ed558ccdull;
+            bits ^= bits >> 33;
+            bits *= 0xc4ceb9fe1a85ec53ull;
+            bits ^= bits >> 33;
+            return static_cast<uint32>( bits );
+        }
+
+        static inline bool isSame( Value lhs, Value rhs ) { return memcmp( &lhs, &rhs, sizeof( Value ) ) == 0; }
+        static inline uint32 getBit( uint32 key_hash, uint32 shift ) { return 1u << ( ( key_hash >> shift ) & Mask ); }
+        static inline uint32 getIndex( uint32 map, uint32 bit ) { return std::popcount( map & ( bit - 1 ) ); }
+
+        static inline Node* retain( Node* node )
+        {
+            if( node != nullptr )
+            {
+                node->references.fetch_add( 1, std::memory_order_relaxed );
+            }
+            return node;
+        }
+
+        static void release( Node* node )
+        {
+            if( node == nullptr || node->references.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+            {
+                return;
+            }
+
+            for( Node* child : node->children )
+            {
+                release( child );
+            }
+            delete node;
+        }
+
+        // same contract as the vector's: takes the caller's reference, returns a node the owner may write
+        static Node* take( Node* node, uint64 owner )
+        {
+            if( owner != 0 && node->owner == owner )
+            {
+                return node;
+            }
+
+            Node* copy = new Node( owner );
+            copy->entry_map = node->entry_map;
+            copy->child_map = node->child_map;
+            copy->entries = node->entries;
+            copy->children.reserve( node->children.size() );
+            for( Node* child : node->children )
+            {
+                copy->children.push_back( retain( child ) );
+            }
+
+            release( node );
+            return copy;
+        }
+
+        // a subtree for two entries whose hashes agree below shift
+        static Node* makePair( const Entry& first, uint32 first_hash, const Entry& second, uint32 second_hash, uint32 shift, uint64 owner )
+        {
+            Node* node = new Node( owner );
+            if( shift >= HashBits )
+            {
+                node->entries = { first, second };
+                return node;
+            }
+
+            uint32 first_bit = getBit( first_hash, shift );
+            uint32 second_bit = getBit( second_hash, shift );
+            if( first_bit == second_bit )
+            {
+                node->child_map = first_bit;
+                node->children.push_back( makePair( first, first_hash, second, second_hash, shift + Bits, owner ) );
+                return node;
+            }
+
+            node->entry_map = first_bit | second_bit;
+            node->entries = first_bit < second_bit ? std::vector<Entry> { first, second } : std::vector<Entry> { second, first };
+            return node;
+        }
+
+        static Node* setIn( Node* node, uint32 key_hash, uint32 shift, const Entry& entry, uint64 owner, bool& added )
+        {
+            node = take( node, owner );
+            if( shift >= HashBits )
+            {
+                for( Entry& existing : node->entries )
+                {
+                    if( isSame( existing.key, entry.key ) )
+                    {
+                        existing.value = entry.value;
+                        return node;
+                    }
+                }
+                node->entries.push_back( entry );
+                added = true;
+                return node;
+            }
+
+            uint32 bit = getBit( key_hash, shift );
+            if( ( node->entry_map & bit ) != 0 )
+            {
+                uint32 index = getIndex( node->entry_map, bit );
+                if( isSame( node->entries[ index ].key, entry.key ) )
+                {
+                    node->entries[ index ].value = entry.value;
+                    return node;
+                }
+
+                // two keys share this slot, they move down into a subtree of their own
+                Entry existing = node->entries[ index ];
+                node->entries.erase( node->entries.begin() + index );
+                node->entry_map ^= bit;
+                Node* child = makePair( existing, hash( existing.key ), entry, key_hash, shift + Bits, owner );
+                node->children.insert( node->children.begin() + getIndex( node->child_map, bit ), child );
+                node->child_map |= bit;
+                added = true;
+            }
+            else if( ( node->child_map & bit ) != 0 )
+            {
+                uint32 index = getIndex( node->child_map, bit );
+                node->children[ index ] = setIn( node->children[ index ], key_hash, shift + Bits, entry, owner, added );
+            }
+            else
+            {
+                node->entries.insert( node->entries.begin() + getIndex( node->entry_map, bit ), entry );
+                node->entry_map |= bit;
+                added = true;
+            }
+            return node;
+        }
+
+        // the key is known to be present, a subtree left with a single entry folds back into its parent
+        static Node* removeIn( Node* node, Value key, uint32 key_hash, uint32 shift, uint64 owner )
+        {
+            node = take( node, owner );
+            if( shift >= HashBits )
+            {
+                auto it = std::find_if( node->entries.begin(), node->entries.end(), [key]( const Entry& entry ) { return isSame( entry.key, key ); } );
+                node->entries.erase( it );
+                return node;
+            }
+
+            uint32 bit = getBit( key_hash, shift );
+            if( ( node->entry_map & bit ) != 0 )
+            {
+                node->entries.erase( node->entries.begin() + getIndex( node->entry_map, bit ) );
+                node->entry_map ^= bit;
+                return node;
+            }
+
+            uint32 index = getIndex( node->child_map, bit );
+            Node* child = removeIn( node->children[ index ], key, key_hash, shift + Bits, owner );
+            if( child->children.empty() && child->entries.size() == 1 )
+            {
+                Entry entry = child->entries[ 0 ];
+                release( child );
+                node->children.erase( node->children.begin() + index );
+                node->child_map ^= bit;
+                node->entries.insert( node->entries.begin() + getIndex( node->entry_map, bit ), entry );
+                node->entry_map |= bit;
+            }
+            else
+            {
+                node->children[ index ] = child;
+            }
+            return node;
+        }
+
+        void setRoot( Value key, Value value, uint64 owner )
+        {
+            uint32 key_hash = hash( key );
+            if( root == nullptr )
+            {
+                root = new Node( owner );
+                root->entry_map = getBit( key_hash, 0 );
+                root->entries.push_back( { key, value } );
+                size = 1;
+                return;
+            }
+
+            bool added = false;
+            root = setIn( root, key_hash, 0, { key, value }, owner, added );
+            size += added ? 1 : 0;
+        }
+
+        void removeRoot( Value key, uint64 owner )
+        {
+            // nothing is copied for a key that is not there
+            if( find( key ) == nullptr )
+            {
+                return;
+            }
+            root = removeIn( root, key, hash( key ), 0, owner );
+            --size;
+        }
+
+        Node* root = nullptr;
+        size_t size = 0;
+    };
+
+    class PersistentMap::Transient
+    {
+    public:
+        explicit Transient( PersistentMap map = PersistentMap() )
+            : map( std::move( map ) )
+            , owner( Owner::acquire() )
+        {
+        }
+
+        // move only: a copy would share the owner token and write the same nodes in place,
+        // the moved-from transient gets a fresh token so it can never touch the nodes it gave away
+        Transient( Transient&& other ) noexcept
+            : map( std::move( other.map ) )
+            , owner( std::exchange( other.owner, Owner::acquire() ) )
+        {
+        }
+
+        Transient& operator=( Transient&& other ) noexcept
+        {
+            map = std::move( other.map );
+            owner = std::exchange( other.owner, Owner::acquire() );
+            return *this;
+        }
+
+        Transient( const Transient& ) = delete;
+        Transient& operator=( const Transient& ) = delete;
+
+        inline size_t getSize() const { return map.size; }
+        inline const Value* find( Value key ) const { return map.find( key ); }
+        void set( Value key, Value value ) { map.setRoot( key, value, owner ); }
+        void remove( Value key ) { map.removeRoot( key, owner ); }
+
+        PersistentMap freeze()
+        {
+            owner = Owner::acquire();
+            return map;
+        }
+
+    private:
+        PersistentMap map;
+        uint64 owner;
+    };
+
+    // backing store of an Array, values follow the header inline
+    struct ArrayBuffer
+    {
+        std::atomic<uint32> references;
+        size_t size;
+        size_t capacity;
+        // length of the buffer's own mapping, 0 for one on the allocator's heap
+        size_t mapped_bytes;
+
+        inline Value* getValues() { return reinterpret_cast<Value*>( this + 1 ); }
+    };
+
+    // value semantics array: a copy shares the buffer and the first write through a holder that is not the only
+    // one copies it. the only holder, a reference count of one, writes in place, nobody else can be reading
+    // small buffers grow geometrically on the allocator's heap, large ones live in a mapping of their own and grow
+    // by whole steps of pages through mremap, which moves page table entries instead of values
+    class Array
+    {
+    public:
+        static constexpr size_t MinimumCapacity = 8;
+        static constexpr size_t PageSize = 4096;
+        static constexpr size_t MappedBytes = size_t( 1 ) << 20;
+        static constexpr size_t MappedGrowth = size_t( 2 ) << 20;
+
+        Array() = default;
+
+        Array( size_t size, Value fill )
+        {
+            if( size == 0 )
+            {
+                return;
+            }
+            buffer = allocate( size );
+            buffer->size = size;
+            std::fill_n( buffer->getValues(), size, fill );
+        }
+
+        Array( std::initializer_list<Value> values )
+        {
+            if( values.size() == 0 )
+            {
+                return;
+            }
+            buffer = allocate( values.size() );
+            buffer->size = values.size();
+            std::copy( values.begin(), values.end(), buffer->getValues() );
+        }
+
+        Array( const Array& other )
+            : buffer( other.buffer )
+        {
+            if( buffer != nullptr )
+            {
+                buffer->references.fetch_add( 1, std::memory_order_relaxed );
+            }
+        }
+
+        Array( Array&& other ) noexcept
+            : buffer( std::exchange( other.buffer, nullptr ) )
+        {
+        }
+
+        Array& operator=( Array other )
+        {
+            std::swap( buffer, other.buffer );
+            return *this;
+        }
+
+        ~Array() { release( buffer ); }
+
+        inline size_t getSize() const { return buffer != nullptr ? buffer->size : 0; }
+        inline size_t getCapacity() const { return buffer != nullptr ? buffer->capacity : 0; }
+        inline bool isShared() const { return buffer != nullptr && buffer->references.load( std::memory_order_acquire ) != 1; }
+
+        inline Value get( size_t index ) const
+        {
+            nassert( index < getSize(), "Array", "Index out of range" );
+            return buffer->getValues()[ index ];
+        }
+
+        // reading never unshares
+        inline const Value* begin() const { return buffer != nullptr ? buffer->getValues() : nullptr; }
+        inline const Value* end() const { return begin() + getSize(); }
+
+        inline void set( size_t index, Value value )
+        {
+            nassert( index < getSize(), "Array", "Index out of range" );
+            makeUnique( getCapacity() );
+            buffer->getValues()[ index ] = value;
+        }
+
+        void push( Value value )
+        {
+            size_t size = getSize();
+            if( size == getCapacity() )
+            {
+                reserve( size + 1 );
+            }
+            else
+            {
+                makeUnique( getCapacity() );
+            }
+            buffer->getValues()[ buffer->size++ ] = value;
+        }
+
+        void pop()
+        {
+            nassert( getSize() != 0, "Array", "Pop from an empty array" );
+            makeUnique( getCapacity() );
+            --buffer->size;
+        }
+
+        void reserve( size_t capacity )
+        {
+            if( capacity > getCapacity() )
+            {
+                makeUnique( grow( getCapacity(), capacity ) );
+            }
+        }
+
+        // a writable view, unshared first
+        Value* getMutableValues()
+        {
+            makeUnique( getCapacity() );
+            return buffer != nullptr ? buffer->getValues() : nullptr;
+        }
+
+        // buffers copied because a holder wrote to a shared one
+        static inline uint64 getUnshareCount() { return unshare_count.load( std::memory_order_relaxed ); }
+        // mapped buffers grown without copying their values
+        static inline uint64 getRemapCount() { return remap_count.load( std::memory_order_relaxed ); }
+        inline bool isMapped() const { return buffer != nullptr && buffer->mapped_bytes != 0; }
+
+    private:
+        static inline size_t getBytes( size_t capacity ) { return sizeof( ArrayBuffer ) + capacity * sizeof( Value ); }
+        static inline size_t roundUp( size_t bytes, size_t granule ) { return ( bytes + granule - 1 ) / granule * granule; }
+        static inline size_t getCapacity( size_t bytes ) { return ( bytes - sizeof( ArrayBuffer ) ) / sizeof( Value ); }
+
+        // doubling while the buffer stays on the heap, then the smallest whole growth step that fits
+        static size_t grow( size_t current, size_t required )
+        {
+            size_t capacity = std::max( { required, current * 2, MinimumCapacity } );
+            if( getBytes( capacity ) < MappedBytes )
+            {
+                return capacity;
+            }
+            return getCapacity( roundUp( getBytes( required ), MappedGrowth ) );
+        }
+
+        static ArrayBuffer* allocate( size_t capacity )
+        {
+            ArrayBuffer* buffer = nullptr;
+            size_t mapped_bytes = 0;
+            if( getBytes( capacity ) >= MappedBytes )
+            {
+                mapped_bytes = roundUp( getBytes( capacity ), PageSize );
+                void* memory = mmap( nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+                nassert( memory != MAP_FAILED, "Array", "Failed to map a buffer" );
+                buffer = static_cast<ArrayBuffer*>( memory );
+                capacity = getCapacity( mapped_bytes );
+            }
+            else
+            {
+                buffer = static_cast<ArrayBuffer*>( ::operator new( getBytes( capacity ) ) );
+            }
+
+            new( &buffer->references ) std::atomic<uint32>( 1 );
+            buffer->size = 0;
+            buffer->capacity = capacity;
+            buffer->mapped_bytes = mapped_bytes;
+            return buffer;
+        }
+
+        static void release( ArrayBuffer* buffer )
+        {
+            if( buffer == nullptr || buffer->references.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+            {
+                return;
+            }
+
+            if( buffer->mapped_bytes != 0 )
+            {
+                munmap( buffer, buffer->mapped_bytes );
+            }
+            else
+            {
+                ::operator delete( buffer );
+            }
+        }
+
+        // after this the buffer is this array's alone and holds at least capacity values
+        void makeUnique( size_t capacity )
+        {
+            if( buffer != nullptr && capacity <= buffer->capacity && buffer->references.load( std::memory_order_acquire ) == 1 ) [[likely]]
+            {
+                return;
+            }
+            if( capacity == 0 )
+            {
+                return;
+            }
+
+            // an unshared mapping grows where it is, or wherever the kernel moves its pages
+            if( buffer != nullptr && buffer->mapped_bytes != 0 && buffer->references.load( std::memory_order_acquire ) == 1 )
+            {
+                size_t mapped_bytes = roundUp( getBytes( capacity ), PageSize );
+                void* memory = mremap( buffer, buffer->mapped_bytes, mapped_bytes, MREMAP_MAYMOVE );
+                if( memory != MAP_FAILED )
+                {
+                    buffer = static_cast<ArrayBuffer*>( memory );
+                    buffer->mapped_bytes = mapped_bytes;
+                    buffer->capacity = getCapacity( mapped_bytes );
+                    remap_count.fetch_add( 1, std::memory_order_relaxed );
+                    return;
+                }
+            }
+
+            ArrayBuffer* copy = allocate( capacity );
+            if( buffer != nullptr )
+            {
+                copy->size = buffer->size;
+                std::copy( buffer->getValues(), buffer->getValues() + buffer->size, copy->getValues() );
+                if( buffer->references.load( std::memory_order_relaxed ) != 1 )
+                {
+                    unshare_count.fetch_add( 1, std::memory_order_relaxed );
+                }
+            }
+            release( buffer );
+            buffer = copy;
+        }
+
+        static inline std::atomic<uint64> unshare_count { 0 };
+        static inline std::atomic<uint64> remap_count { 0 };
+
+        ArrayBuffer* buffer = nullptr;
+    };
+
+    // sort builtin for arrays. contents of a single numeric type are turned into unsigned keys that order like the
+    // values and radix sorted without comparing, anything mixed goes through pdqsort on the total order
+    class ArraySort
+    {
+    public:
+        enum class Method
+        {
+            Keyed,
+            Compared
+        };
+
+        static constexpr size_t RadixThreshold = 64;
+        static constexpr size_t InsertionSortThreshold = 24;
+        static constexpr size_t NintherThreshold = 128;
+
+        static Method sort( Array& array )
+        {
+            return array.getSize() < 2 ? Method::Keyed : sort( array.getMutableValues(), array.getSize() );
+        }
+
+        // sorts a range in place, for callers that split an array and sort the pieces on their own
+        static Method sort( Value* values, size_t size )
+        {
+            if( size < 2 )
+            {
+                return Method::Keyed;
+            }
+
+            switch( getUniformType( values, size ).value )
+            {
+                case TypeId::Int:
+                    sortKeys<uint32>( values, size, []( Value value ) { return uint32( value.getInt() ) ^ 0x80000000u; },
+                        []( uint32 key ) { return Value( int32( key ^ 0x80000000u ) ); } );
+                    return Method::Keyed;
+                case TypeId::UInt:
+                    sortKeys<uint32>( values, size, []( Value value ) { return value.getUInt(); },
+                        []( uint32 key ) { return Value( key ); } );
+                    return Method::Keyed;
+                case TypeId::Float:
+                    sortKeys<uint32>( values, size, []( Value value ) { return getKey( std::bit_cast<uint32>( value.getFloat() ) ); },
+                        []( uint32 key ) { return Value( std::bit_cast<float>( getBits( key ) ) ); } );
+                    return Method::Keyed;
+                case TypeId::Double:
+                    sortKeys<uint64>( values, size, []( Value value ) { return getKey( std::bit_cast<uint64>( value.getDouble() ) ); },
+                        []( uint64 key ) { return Value( std::bit_cast<double>( getBits( key ) ) ); } );
+                    return Method::Keyed;
+            }
+
+            pdqsort( values, values + size, isBefore, std::bit_width( size ), true );
+            return Method::Compared;
+        }
+
+        // total order over every value: by kind first, numbers by value whatever their type and then by type so
+        // equal numbers of different types still have a fixed order, floating point ones as ieee totalOrder
+        static bool isBefore( const Value& left, const Value& right )
+        {
+            uint32 left_rank = getRank( left );
+            uint32 right_rank = getRank( right );
+            if( left_rank != right_rank )
+            {
+                return left_rank < right_rank;
+            }
+
+            switch( left_rank )
+            {
+                case TypeRank:
+                    return left.getTypeId().value < right.getTypeId().value;
+                case BoolRank:
+                    return !left.getBool() && right.getBool();
+                case NumberRank:
+                {
+                    uint64 left_key = getKey( std::bit_cast<uint64>( toDouble( left ) ) );
+                    uint64 right_key = getKey( std::bit_cast<uint64>( toDouble( right ) ) );
+                    return left_key != right_key ? left_key < right_key : left.getType().value < right.getType().value;
+                }
+                case ReferenceRank:
+                    return reinterpret_cast<uint64>( left.getReference() ) < reinterpret_cast<uint64>( right.getReference() );
+            }
+
+            return false;
+        }
+
+    private:
+        static constexpr uint32 TypeRank = 0;
+        static constexpr uint32 NullRank = 1;
+        static constexpr uint32 BoolRank = 2;
+        static constexpr uint32 NumberRank = 3;
+        static constexpr uint32 ReferenceRank = 4;
+
+        static TypeId getUniformType( const Value* values, size_t size )
+        {
+            if( size == 0 )
+            {
+                return TypeId::Invalid;
+            }
+
+            TypeId type = values[ 0 ].getType();
+            if( type.value < TypeId::Int )
+            {
+                return TypeId::Invalid;
+            }
+
+            for( size_t i = 1; i < size; ++i )
+            {
+                if( values[ i ].getType().value != type.value )
+                {
+                    return TypeId::Invalid;
+                }
+            }
+
+            return type;
+        }
+
+        static uint32 getRank( const Value& value )
+        {
+            if( value.isReference() )
+            {
+                return ReferenceRank;
+            }
+
+            switch( value.getType().value )
+            {
+                case TypeId::Null: return NullRank;
+                case TypeId::Bool: return BoolRank;
+                case TypeId::Int:
+                case TypeId::UInt:
+                case TypeId::Float:
+                case TypeId::Double: return NumberRank;
+            }
+
+            return TypeRank;
+        }
+
+        static double toDouble( const Value& value )
+        {
+            switch( value.getType().value )
+            {
+                case TypeId::Int: return double( value.getInt() );
+                case TypeId::UInt: return double( value.getUInt() );
+                case TypeId::Float: return double( value.getFloat() );
+                case TypeId::Double: return value.getDouble();
+            }
+
+            return 0.0;
+        }
+
+        // flipping every bit of a negative float and only the sign of a positive one makes unsigned order match
+        template<typename Bits>
+        static inline Bits getKey( Bits bits )
+        {
+            constexpr Bits Sign = Bits( 1 ) << ( sizeof( Bits ) * 8 - 1 );
+            return ( bits & Sign ) != 0 ? ~bits : bits | Sign;
+        }
+
+        template<typename Bits>
+        static inline Bits getBits( Bits key )
+        {
+            constexpr Bits Sign = Bits( 1 ) << ( sizeof( Bits ) * 8 - 1 );
+            return ( key & Sign ) != 0 ? key ^ Sign : ~key;
+        }
+
+        template<typename Key, typename Encode, typename Decode>
+        static void sortKeys( Value* values, size_t size, Encode encode, Decode decode )
+        {
+            std::vector<Key> keys( size );
+            for( size_t i = 0; i < size; ++i )
+            {
+                keys[ i ] = encode( values[ i ] );
+            }
+
+            if( size < RadixThreshold )
+            {
+                std::sort( keys.begin(), keys.end() );
+            }
+            else
+            {
+                radixSort( keys );
+            }
+
+            for( size_t i = 0; i < size; ++i )
+            {
+                values[ i ] = decode( keys[ i ] );
+            }
+        }
+
+        // least significant digit first, one byte per pass. all histograms come from a single read of the keys and
+        // a pass whose byte is the same in every key is skipped
+        template<typename Key>
+        static void radixSort( std::vector<Key>& keys )
+        {
+            constexpr size_t Passes = sizeof( Key );
+            size_t size = keys.size();
+            std::vector<Key> scratch( size );
+            std::vector<size_t> counts( Passes * 256, 0 );
+            for( Key key : keys )
+            {
+                for( size_t pass = 0; pass < Passes; ++pass )
+                {
+                    ++counts[ pass * 256 + ( ( key >> ( pass * 8 ) ) & 0xff ) ];
+                }
+            }
+
+            Key* from = keys.data();
+            Key* to = scratch.data();
+            for( size_t pass = 0; pass < Passes; ++pass )
+            {
+                size_t* offsets = counts.data() + pass * 256;
+                uint32 shift = uint32( pass * 8 );
+                if( offsets[ ( from[ 0 ] >> shift ) & 0xff ] == size )
+                {
+                    continue;
+                }
+
+                size_t offset = 0;
+                for( size_t digit = 0; digit < 256; ++digit )
+                {
+                    size_t count = offsets[ digit ];
+                    offsets[ digit ] = offset;
+                    offset += count;
+                }
+
+                for( size_t i = 0; i < size; ++i )
+                {
+                    to[ offsets[ ( from[ i ] >> shift ) & 0xff ]++ ] = from[ i ];
+                }
+                std::swap( from, to );
+            }
+
+            if( from != keys.data() )
+            {
+                std::memcpy( keys.data(), from, size * sizeof( Key ) );
+            }
+        }
+
+        template<typename Less>
+        static void insertionSort( Value* begin, Value* end, Less less )
+        {
+            for( Value* current = begin + 1; current < end; ++current )
+            {
+                Value value = *current;
+                Value* hole = current;
+                for( ; hole != begin && less( value, *( hole - 1 ) ); --hole )
+                {
+                    *hole = *( hole - 1 );
+                }
+                *hole = value;
+            }
+        }
+
+        // gives up as soon as more than a few elements had to move, only meant to finish nearly sorted runs
+        template<typename Less>
+        static bool partialInsertionSort( Value* begin, Value* end, Less less )
+        {
+            size_t moved = 0;
+            for( Value* current = begin + 1; current < end; ++current )
+            {
+                Value value = *current;
+                Value* hole = current;
+                for( ; hole != begin && less( value, *( hole - 1 ) ); --hole )
+                {
+                    *hole = *( hole - 1 );
+                }
+                *hole = value;
+
+                moved += size_t( current - hole );
+                if( moved > 8 )
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        template<typename Less>
+        static void sort3( Value* a, Value* b, Value* c, Less less )
+        {
+            if( less( *b, *a ) ) std::swap( *a, *b );
+            if( less( *c, *b ) ) std::swap( *b, *c );
+            if( less( *b, *a ) ) std::swap( *a, *b );
+        }
+
+        // partitions around *begin into [ < pivot ][ pivot ][ >= pivot ], also reporting whether nothing had to move
+        template<typename Less>
+        static std::pair<Value*, bool> partitionRight( Value* begin, Value* end, Less less )
+        {
+            Value pivot = *begin;
+            Value* first = begin;
+            Value* last = end;
+
+            while( less( *++first, pivot ) );
+            if( first - 1 == begin )
+            {
+                while( first < last && !less( *--last, pivot ) );
+            }
+            else
+            {
+                while( !less( *--last, pivot ) );
+            }
+
+            bool partitioned = first >= last;
+            while( first < last )
+            {
+                std::swap( *first, *last );
+                while( less( *++first, pivot ) );
+                while( !less( *--last, pivot ) );
+            }
+
+            Value* position = first - 1;
+            *begin = *position;
+            *position = pivot;
+            return { position, partitioned };
+        }
+
+        // [ <= pivot ][ > pivot ], used when the pivot equals the element before the range so a run of equal
+        // values is finished in one step
+        template<typename Less>
+        static Value* partitionLeft( Value* begin, Value* end, Less less )
+        {
+            Value pivot = *begin;
+            Value* first = begin;
+            Value* last = end;
+
+            while( less( pivot, *--last ) );
+            if( last + 1 == end )
+            {
+                while( first < last && !less( pivot, *++first ) );
+            }
+            else
+            {
+                while( !less( pivot, *++first ) );
+            }
+
+            while( first < last )
+            {
+                std::swap( *first, *last );
+                while( less( pivot, *--last ) );
+                while( !less( pivot, *++first ) );
+            }
+
+            Value* position = last;
+            *begin = *position;
+            *position = pivot;
+            return position;
+        }
+
+        template<typename Less>
+        static void pdqsort( Value* begin, Value* end, Less less, int32 bad_allowed, bool leftmost )
+        {
+            while( true )
+            {
+                size_t size = size_t( end - begin );
+                if( size < InsertionSortThreshold )
+                {
+                    insertionSort( begin, end, less );
+                    return;
+                }
+
+                size_t half = size / 2;
+                if( size > NintherThreshold )
+                {
+                    sort3( begin, begin + half, end - 1, less );
+                    sort3( begin + 1, begin + ( half - 1 ), end - 2, less );
+                    sort3( begin + 2, begin + ( half + 1 ), end - 3, less );
+                    sort3( begin + ( half - 1 ), begin + half, begin + ( half + 1 ), less );
+                    std::swap( *begin, *( begin + half ) );
+                }
+                else
+                {
+                    sort3( begin + half, begin, end - 1, less );
+                }
+
+                if( !leftmost && !less( *( begin - 1 ), *begin ) )
+                {
+                    begin = partitionLeft( begin, end, less ) + 1;
+                    continue;
+                }
+
+                auto [ pivot, partitioned ] = partitionRight( begin, end, less );
+                size_t left_size = size_t( pivot - begin );
+                size_t right_size = size_t( end - ( pivot + 1 ) );
+                if( left_size < size / 8 || right_size < size / 8 )
+                {
+                    // too many bad pivots means adversarial input, heapsort keeps it n log n
+                    if( --bad_allowed == 0 )
+                    {
+                        std::make_heap( begin, end, less );
+                        std::sort_heap( begin, end, less );
+                        return;
+                    }
+
+                    if( left_size >= InsertionSortThreshold )
+                    {
+                        std::swap( *begin, *( begin + left_size / 4 ) );
+                        std::swap( *( pivot - 1 ), *( pivot - left_size / 4 ) );
+                    }
+                    if( right_size >= InsertionSortThreshold )
+                    {
+                        std::swap( *( pivot + 1 ), *( pivot + ( 1 + right_size / 4 ) ) );
+                        std::swap( *( end - 1 ), *( end - right_size / 4 ) );
+                    }
+                }
+                else if( partitioned && partialInsertionSort( begin, pivot, less ) && partialInsertionSort( pivot + 1, end, less ) )
+                {
+                    return;
+                }
+
+                pdqsort( begin, pivot, less, bad_allowed, leftmost );
+                begin = pivot + 1;
+                leftmost = false;
+            }
+        }
+    };
+
+    // payload access by c++ type, lets a kernel check the type of a span once and then loop over raw payloads
+    template<typename T>
+    struct Payload;
+
+    template<>
+    struct Payload<int32>
+    {
+        static constexpr uint32 Type = TypeId::Int;
+        static inline int32 get( Value value ) { return value.getInt(); }
+    };
+
+    template<>
+    struct Payload<uint32>
+    {
+        static constexpr uint32 Type = TypeId::UInt;
+        static inline uint32 get( Value value ) { return value.getUInt(); }
+    };
+
+    template<>
+    struct Payload<float>
+    {
+        static constexpr uint32 Type = TypeId::Float;
+        static inline float get( Value value ) { return value.getFloat(); }
+    };
+
+    template<>
+    struct Payload<double>
+    {
+        static constexpr uint32 Type = TypeId::Double;
+        static inline double get( Value value ) { return value.getDouble(); }
+    };
+
+    // calls f with a zero of the c++ type of a numeric type id, false for anything else
+    template<typename F>
+    inline bool dispatchNumber( uint32 type, F f )
+    {
+        switch( type )
+        {
+            case TypeId::Int: f( int32() ); return true;
+            case TypeId::UInt: f( uint32() ); return true;
+            case TypeId::Float: f( float() ); return true;
+            case TypeId::Double: f( double() ); return true;
+        }
+
+        return false;
+    }
+
+    // the type every value of a span has, TypeId::Invalid for an empty or mixed span
+    inline uint32 getSpanType( const Value* values, size_t count )
+    {
+        if( count == 0 )
+        {
+            return TypeId::Invalid;
+        }
+
+        uint32 type = values[ 0 ].getType().value;
+        for( size_t i = 1; i < count; ++i )
+        {
+            if( values[ i ].getType().value != type )
+            {
+                return TypeId::Invalid;
+            }
+        }
+
+        return type;
+    }
+
+    template<std::size_t I>
+    struct Instruction;
+
+    template<>
+    struct Instruction<0>
+    {
+        template<typename T>
+        static constexpr bool Addable = std::same_as<T, int32> || std::same_as<T, uint32> || std::same_as<T, float> || std::same_as<T, double>;
+
+        // int32 wraps around like the other integer sums instead of overflowing
+        template<typename T, typename U>
+        static inline constexpr auto add( T lhs, U rhs )
+        {
+            if constexpr( std::same_as<T, int32> && std::same_as<U, int32> )
+            {
+                return int32( uint32( lhs ) + uint32( rhs ) );
+            }
+            else
+            {
+                return lhs + rhs;
+            }
+        }
+
+        static inline constexpr Value evaluate( Value lhs, Value rhs )
+        {
+            Value result = lhs.apply( [rhs]<typename T>( T lhs_value ) mutable {
+                if constexpr( Addable<T> )
+                {
+                    // workaround the bug that nested lambda can't capture parameters in parent scope
+                    T redirect_lhs_value = lhs_value;
+                    return rhs.apply( [redirect_lhs_value]<typename U>( U rhs_value ) {
+                        if constexpr( Addable<U> )
+                        {
+                            return Value( add( redirect_lhs_value, rhs_value ) );
+                        }
+                        return Value( Value::InvalidType );
+                    } );
+                }
+                return Value( Value::InvalidType );
+            } );
+            return result;
+        }
+
+        // result[ i ] = lhs[ i ] + rhs, result may be lhs
+        static void evaluate( const Value* lhs, Value rhs, Value* result, size_t count )
+        {
+            bool typed = false;
+            dispatchNumber( getSpanType( lhs, count ), [ & ]<typename T>( T )
+            {
+                typed = dispatchNumber( rhs.getType().value, [ & ]<typename U>( U )
+                {
+                    U operand = Payload<U>::get( rhs );
+                    for( size_t i = 0; i < count; ++i )
+                    {
+                        result[ i ] = Value( add( Payload<T>::get( lhs[ i ] ), operand ) );
+                    }
+                } );
+            } );
+
+            if( !typed )
+            {
+                for( size_t i = 0; i < count; ++i )
+                {
+                    result[ i ] = evaluate( lhs[ i ], rhs );
+                }
+            }
+        }
+
+        // result[ i ] = lhs[ i ] + rhs[ i ], result may be either operand
+        static void evaluate( const Value* lhs, const Value* rhs, Value* result, size_t count )
+        {
+            uint32 lhs_type = getSpanType( lhs, count );
+            uint32 rhs_type = lhs_type != TypeId::Invalid ? getSpanType( rhs, count ) : TypeId::Invalid;
+            bool typed = false;
+            dispatchNumber( lhs_type, [ & ]<typename T>( T )
+            {
+                typed = dispatchNumber( rhs_type, [ & ]<typename U>( U )
+                {
+                    for( size_t i = 0; i < count; ++i )
+                    {
+                        result[ i ] = Value( add( Payload<T>::get( lhs[ i ] ), Payload<U>::get( rhs[ i ] ) ) );
+                    }
+                } );
+            } );
+
+            if( !typed )
+            {
+                for( size_t i = 0; i < count; ++i )
+                {
+                    result[ i ] = evaluate( lhs[ i ], rhs[ i ] );
+                }
+            }
+        }
+
+        // left fold of evaluate over a span, the same value as adding one by one. once the running sum has the
+        // span's type the rest is a loop over payloads
+        static Value reduce( Value initial, const Value* values, size_t count )
+        {
+            uint32 type = getSpanType( values, count );
+            size_t i = 0;
+            for( ; i < count && initial.getType().value != type; ++i )
+            {
+                initial = evaluate( initial, values[ i ] );
+            }
+
+            if( i == count )
+            {
+                return initial;
+            }
+
+            dispatchNumber( type, [ & ]<typename T>( T )
+            {
+                T sum = Payload<T>::get( initial );
+                for( ; i < count; ++i )
+                {
+                    sum = add( sum, Payload<T>::get( values[ i ] ) );
+                }
+                initial = Value( sum );
+            } );
+
+            return initial;
+        }
+    };
+
+    // element stage that keeps every value as it is, the start of every run of fused map and filter stages
+    struct PassStage
+    {
+        inline bool operator()( Value& ) const { return true; }
+    };
+
+    // a fused run of map and filter stages: one loop, a single body that maps in place and reports whether the
+    // value survived. filtering compacts, so output may alias input
+    template<typename F>
+    struct ElementStage
+    {
+        F f;
+
+        inline size_t apply( const Value* input, Value* output, size_t count ) const
+        {
+            size_t kept = 0;
+            for( size_t i = 0; i < count; ++i )
+            {
+                Value value = input[ i ];
+                if( f( value ) )
+                {
+                    output[ kept++ ] = value;
+                }
+            }
+            return kept;
+        }
+    };
+
+    // adds a constant with the span kernel of Instruction<0>
+    struct AddStage
+    {
+        Value operand;
+
+        inline size_t apply( const Value* input, Value* output, size_t count ) const
+        {
+            Instruction<0>::evaluate( input, operand, output, count );
+            return count;
+        }
+    };
+
+    // lazy pipeline over an array. map and filter only compose, adjacent ones into one element stage at compile
+    // time, and a terminal operation runs every stage in a single pass over the source. the source is walked a
+    // block at a time, each stage rewriting the block while it is in l1, so no stage materializes an array and
+    // numeric stages can run span kernels over the whole block
+    template<typename Element = PassStage, typename... Stages>
+    class Pipeline
+    {
+        template<typename, typename...>
+        friend class Pipeline;
+
+    public:
+        static constexpr size_t BlockSize = 256;
+        static constexpr size_t StageCount = sizeof...( Stages );
+
+        explicit Pipeline( const Array& source )
+            : source( source )
+        {
+        }
+
+        template<typename F>
+        auto map( F f ) const
+        {
+            auto fused = [ element = element, f ]( Value& value )
+            {
+                if( !element( value ) )
+                {
+                    return false;
+                }
+                value = f( value );
+                return true;
+            };
+            return make( source, stages, fused );
+        }
+
+        template<typename F>
+        auto filter( F f ) const
+        {
+            auto fused = [ element = element, f ]( Value& value ) { return element( value ) && f( value ); };
+            return make( source, stages, fused );
+        }
+
+        auto add( Value operand ) const
+        {
+            return make( source, std::tuple_cat( flush(), std::make_tuple( AddStage { operand } ) ), PassStage {} );
+        }
+
+        Value sum() const
+        {
+            Value total( int32( 0 ) );
+            run( [ & ]( const Value* values, size_t count ) { total = Instruction<0>::reduce( total, values, count ); } );
+            return total;
+        }
+
+        template<typename F>
+        Value reduce( Value initial, F f ) const
+        {
+            run( [ & ]( const Value* values, size_t count )
+            {
+                for( size_t i = 0; i < count; ++i )
+                {
+                    initial = f( initial, values[ i ] );
+                }
+            } );
+            return initial;
+        }
+
+        size_t count() const
+        {
+            size_t total = 0;
+            run( [ & ]( const Value*, size_t count ) { total += count; } );
+            return total;
+        }
+
+        Array collect() const
+        {
+            Array result;
+            result.reserve( source.getSize() );
+            run( [ & ]( const Value* values, size_t count )
+            {
+                for( size_t i = 0; i < count; ++i )
+                {
+                    result.push( values[ i ] );
+                }
+            } );
+            return result;
+        }
+
+    private:
+        Pipeline( const Array& source, std::tuple<Stages...> stages, Element element )
+            : source( source )
+            , stages( std::move( stages ) )
+            , element( element )
+        {
+        }
+
+        template<typename E, typename... S>
+        static Pipeline<E, S...> make( const Array& source, std::tuple<S...> stages, E element )
+        {
+            return Pipeline<E, S...>( source, std::move( stages ), element );
+        }
+
+        // the pending element stage closed off behind the recorded ones, dropped when nothing was fused into it
+        auto flush() const
+        {
+            if constexpr( std::same_as<Element, PassStage> )
+            {
+                return stages;
+            }
+            else
+            {
+                return std::tuple_cat( stages, std::make_tuple( ElementStage<Element> { element } ) );
+            }
+        }
+
+        // hands each processed block to sink, straight from the source when there is no stage at all
+        template<typename Sink>
+        void run( Sink sink ) const
+        {
+            auto all = flush();
+            Value block[ BlockSize ];
+            const Value* values = source.begin();
+            size_t size = source.getSize();
+            for( size_t offset = 0; offset < size; offset += BlockSize )
+            {
+                size_t count = std::min( BlockSize, size - offset );
+                const Value* input = values + offset;
+                std::apply( [ & ]( const auto&... stage )
+                {
+                    ( ( count = stage.apply( input, block, count ), input = block ), ... );
+                }, all );
+                sink( input, count );
+            }
+        }
+
+        Array source;
+        std::tuple<Stages...> stages;
+        Element element;
+    };
+
+    Pipeline( const Array& ) -> Pipeline<PassStage>;
+
+    // fixed set of threads that run the chunks of one job at a time. worker 0 is the thread that submits the
+    // job, the others wake on an epoch change, take chunks from a shared counter and check out when none is left
+    class WorkerPool
+    {
+    public:
+        explicit WorkerPool( uint32 worker_count = std::thread::hardware_concurrency() )
+            : invoke( nullptr )
+            , context( nullptr )
+            , chunk_count( 0 )
+            , next_chunk( 0 )
+            , job_epoch( 0 )
+            , workers_running( 0 )
+            , stopping( false )
+        {
+            worker_count = worker_count == 0 ? 1 : worker_count;
+            for( uint32 i = 1; i < worker_count; ++i )
+            {
+                threads.emplace_back( [this, i] { runWorker( i ); } );
+            }
+        }
+
+        ~WorkerPool()
+        {
+            stopping.store( true, std::memory_order_release );
+            job_epoch.fetch_add( 1, std::memory_order_release );
+            job_epoch.notify_all();
+
+            for( std::thread& thread : threads )
+            {
+                thread.join();
+            }
+        }
+
+        WorkerPool( const WorkerPool& ) = delete;
+        WorkerPool& operator=( const WorkerPool& ) = delete;
+
+        inline uint32 getWorkerCount() const { return uint32( threads.size() ) + 1; }
+
+        // pool shared by the parallel builtins, one worker per hardware thread
+        static WorkerPool& getShared()
+        {
+            static WorkerPool pool;
+            return pool;
+        }
+
+        // calls task( chunk, worker ) once for every chunk in [ 0, count ) and returns when all calls did. a call
+        // from inside a task, or while another thread's job runs, would wait on itself or on the pool, so both go
+        // through the chunks on the calling thread as worker 0
+        template<typename F>
+        void run( size_t count, F task )
+        {
+            std::unique_lock<std::mutex> lock( job_mutex, std::defer_lock );
+            if( count < 2 || threads.empty() || in_worker || !lock.try_lock() )
+            {
+                for( size_t chunk = 0; chunk < count; ++chunk )
+                {
+                    task( chunk, 0 );
+                }
+                return;
+            }
+
+            invoke = []( void* context, size_t chunk, uint32 worker ) { ( *static_cast<F*>( context ) )( chunk, worker ); };
+            context = &task;
+            chunk_count = count;
+            next_chunk.store( 0, std::memory_order_relaxed );
+            workers_running.store( uint32( threads.size() ), std::memory_order_relaxed );
+            job_epoch.fetch_add( 1, std::memory_order_release );
+            job_epoch.notify_all();
+
+            in_worker = true;
+            work( 0 );
+            in_worker = false;
+
+            uint32 running = workers_running.load( std::memory_order_acquire );
+            while( running != 0 )
+            {
+                workers_running.wait( running, std::memory_order_acquire );
+                running = workers_running.load( std::memory_order_acquire );
+            }
+        }
+
+    private:
+        void work( uint32 worker )
+        {
+            while( true )
+            {
+                size_t chunk = next_chunk.fetch_add( 1, std::memory_order_relaxed );
+                if( chunk >= chunk_count )
+                {
+                    return;
+                }
+                invoke( context, chunk, worker );
+            }
+        }
+
+        void runWorker( uint32 worker )
+        {
+            in_worker = true;
+            uint32 epoch = 0;
+            while( true )
+            {
+                job_epoch.wait( epoch, std::memory_order_acquire );
+                epoch = job_epoch.load( std::memory_order_acquire );
+                if( stopping.load( std::memory_order_acquire ) )
+                {
+                    return;
+                }
+
+                work( worker );
+
+                if( workers_running.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                {
+                    workers_running.notify_all();
+                }
+            }
+        }
+
+        static inline thread_local bool in_worker = false;
+
+        void ( *invoke )( void*, size_t, uint32 );
+        void* context;
+        size_t chunk_count;
+        std::atomic<size_t> next_chunk;
+        std::atomic<uint32> job_epoch;
+        std::atomic<uint32> workers_running;
+        std::atomic<bool> stopping;
+        std::mutex job_mutex;
+        std::vector<std::thread> threads;
+    };
+
+    // parallel builtins over arrays. work is split into chunks that fit in l2, independent of the worker count, so
+    // every per chunk result is the same however many threads there are and whichever of them ran it
+    class ParallelArray
+    {
+    public:
+        static constexpr size_t ChunkBytes = 256 * 1024;
+        static constexpr size_t ChunkSize = ChunkBytes / sizeof( Value );
+
+        enum class SumMode
+        {
+            // each worker keeps a running total over the chunks it happened to take, floating point totals vary
+            // with scheduling
+            Fast,
+            // one partial per chunk added in chunk order, the same bits on every run and any number of workers
+            Deterministic
+        };
+
+        template<typename F>
+        static Array map( const Array& source, F f, WorkerPool& pool = WorkerPool::getShared() )
+        {
+            size_t size = source.getSize();
+            Array result( size, Value() );
+            const Value* input = source.begin();
+            Value* output = result.getMutableValues();
+            pool.run( getChunkCount( size ), [ & ]( size_t chunk, uint32 )
+            {
+                size_t end = std::min( size, ( chunk + 1 ) * ChunkSize );
+                for( size_t i = chunk * ChunkSize; i < end; ++i )
+                {
+                    output[ i ] = f( input[ i ] );
+                }
+            } );
+            return result;
+        }
+
+        // f has to be associative with identity as its identity, chunks are folded from identity and their
+        // results folded again in chunk order
+        template<typename F>
+        static Value reduce( const Array& source, Value identity, F f, WorkerPool& pool = WorkerPool::getShared() )
+        {
+            size_t size = source.getSize();
+            const Value* input = source.begin();
+            std::vector<Value> partials( getChunkCount( size ), identity );
+            pool.run( partials.size(), [ & ]( size_t chunk, uint32 )
+            {
+                Value partial = identity;
+                size_t end = std::min( size, ( chunk + 1 ) * ChunkSize );
+                for( size_t i = chunk * ChunkSize; i < end; ++i )
+                {
+                    partial = f( partial, input[ i ] );
+                }
+                partials[ chunk ] = partial;
+            } );
+
+            Value total = identity;
+            for( const Value& partial : partials )
+            {
+                total = f( total, partial );
+            }
+            return total;
+        }
+
+        // chunks are summed with the span kernel of Instruction<0> and their sums added with its evaluator
+        static Value sum( const Array& source, SumMode mode = SumMode::Fast, WorkerPool& pool = WorkerPool::getShared() )
+        {
+            size_t size = source.getSize();
+            const Value* input = source.begin();
+            size_t chunk_count = getChunkCount( size );
+            std::vector<Value> partials( mode == SumMode::Fast ? pool.getWorkerCount() : chunk_count, Value( int32( 0 ) ) );
+            pool.run( chunk_count, [ & ]( size_t chunk, uint32 worker )
+            {
+                size_t begin = chunk * ChunkSize;
+                size_t count = std::min( size - begin, ChunkSize );
+                Value& partial = partials[ mode == SumMode::Fast ? worker : chunk ];
+                partial = Instruction<0>::reduce( partial, input + begin, count );
+            } );
+
+            Value total( int32( 0 ) );
+            for( const Value& partial : partials )
+            {
+                total = Instruction<0>::evaluate( total, partial );
+            }
+            return total;
+        }
+
+        // one piece per worker sorted by ArraySort, then sorted neighbours merged pairwise, every merge of a round
+        // running in parallel, until one run is left
+        static void sort( Array& array, WorkerPool& pool = WorkerPool::getShared() )
+        {
+            size_t size = array.getSize();
+            size_t piece_count = std::min<size_t>( pool.getWorkerCount(), getChunkCount( size ) );
+            if( piece_count < 2 )
+            {
+                ArraySort::sort( array );
+                return;
+            }
+
+            Value* values = array.getMutableValues();
+            std::vector<size_t> bounds( piece_count + 1 );
+            for( size_t i = 0; i <= piece_count; ++i )
+            {
+                bounds[ i ] = size * i / piece_count;
+            }
+            pool.run( piece_count, [ & ]( size_t piece, uint32 )
+            {
+                ArraySort::sort( values + bounds[ piece ], bounds[ piece + 1 ] - bounds[ piece ] );
+            } );
+
+            std::vector<Value> scratch( size );
+            Value* from = values;
+            Value* to = scratch.data();
+            for( size_t width = 1; width < piece_count; width *= 2 )
+            {
+                size_t merge_count = ( piece_count + width * 2 - 1 ) / ( width * 2 );
+                pool.run( merge_count, [ & ]( size_t merge, uint32 )
+                {
+                    size_t begin = bounds[ merge * width * 2 ];
+                    size_t middle = bounds[ std::min( piece_count, merge * width * 2 + width ) ];
+                    size_t end = bounds[ std::min( piece_count, merge * width * 2 + width * 2 ) ];
+                    std::merge( from + begin, from + middle, from + middle, from + end, to + begin, ArraySort::isBefore );
+                } );
+                std::swap( from, to );
+            }
+
+            if( from != values )
+            {
+                std::copy( from, from + size, values );
+            }
+        }
+
+    private:
+        static inline size_t getChunkCount( size_t size ) { return ( size + ChunkSize - 1 ) / ChunkSize; }
+    };
+}
+
+using Value = ::Nickel::System::Runtime::Alchemy::Value;
+using PersistentVector = ::Nickel::System::Runtime::Alchemy::PersistentVector;
+using PersistentMap = ::Nickel::System::Runtime::Alchemy::PersistentMap;
+using Array = ::Nickel::System::Runtime::Alchemy::Array;
+using ArraySort = ::Nickel::System::Runtime::Alchemy::ArraySort;
+using Pipeline = ::Nickel::System::Runtime::Alchemy::Pipeline<>;
+using Instruction = ::Nickel::System::Runtime::Alchemy::Instruction<0>;
+using WorkerPool = ::Nickel::System::Runtime::Alchemy::WorkerPool;
+using ParallelArray = ::Nickel::System::Runtime::Alchemy::ParallelArray;
+
+int main( int argc, char** argv )
+{
+    int result = 0;
+
+    // a transient builds the first version in place, later versions share all but the path they changed
+    constexpr int32 VectorSize = 100000;
+    PersistentVector::Transient builder;
+    for( int32 i = 0; i < VectorSize; ++i )
+    {
+        builder.push( Value( i ) );
+    }
+    PersistentVector first = builder.freeze();
+    PersistentVector second = first.set( 500, Value( int32( -1 ) ) ).push( Value( VectorSize ) );
+    result += first.getSize() == size_t( VectorSize ) && second.getSize() == size_t( VectorSize + 1 ) ? 0 : 1;
+    result += first.get( 500 ).getInt() == 500 && second.get( 500 ).getInt() == -1 && second.get( VectorSize ).getInt() == VectorSize ? 0 : 1;
+    result += first.getDepth() == 4 ? 0 : 1;
+
+    // freezing retires the owner, so the transient's next write copies instead of reaching into the version
+    builder.set( 0, Value( int32( -2 ) ) );
+    result += first.get( 0 ).getInt() == 0 && builder.get( 0 ).getInt() == -2 ? 0 : 1;
+
+    // concatenating ragged pieces keeps every element in order through the relaxed branches
+    PersistentVector joined;
+    std::vector<int32> expected;
+    for( int32 piece = 1; piece <= 200; ++piece )
+    {
+        PersistentVector part;
+        for( int32 i = 0; i < piece * 7 % 97; ++i )
+        {
+            part = part.push( Value( int32( expected.size() + i ) ) );
+        }
+        for( int32 i = 0; i < piece * 7 % 97; ++i )
+        {
+            expected.push_back( int32( expected.size() ) );
+        }
+        joined = PersistentVector::concat( joined, part );
+    }
+    joined = PersistentVector::concat( joined, first );
+    for( int32 i = 0; i < VectorSize; ++i )
+    {
+        expected.push_back( i );
+    }
+
+    bool ordered = joined.getSize() == expected.size();
+    for( size_t i = 0; ordered && i < expected.size(); ++i )
+    {
+        ordered = joined.get( i ).getInt() == expected[ i ];
+    }
+    result += ordered ? 0 : 1;
+
+    joined = joined.set( 12345, Value( int32( 7 ) ) ).push( Value( int32( 8 ) ) );
+    result += joined.get( 12345 ).getInt() == 7 && joined.get( expected.size() ).getInt() == 8 ? 0 : 1;
+
+    // a map with enough keys that some of them share their whole hash
+    constexpr int32 MapSize = 200000;
+    PersistentMap::Transient map_builder;
+    for( int32 i = 0; i < MapSize; ++i )
+    {
+        map_builder.set( Value( i ), Value( i * 2 ) );
+    }
+    PersistentMap config = map_builder.freeze();
+    PersistentMap updated = config.set( Value( int32( 5 ) ), Value( int32( -5 ) ) ).set( Value( 0.5 ), Value( true ) );
+    PersistentMap trimmed = updated.remove( Value( int32( 5 ) ) ).remove( Value( int32( 6 ) ) ).remove( Value( int32( -1 ) ) );
+
+    bool found = config.getSize() == size_t( MapSize );
+    for( int32 i = 0; found && i < MapSize; ++i )
+    {
+        const Value* value = config.find( Value( i ) );
+        found = value != nullptr && value->getInt() == i * 2;
+    }
+    result += found ? 0 : 1;
+    result += updated.getSize() == size_t( MapSize + 1 ) && updated.find( Value( int32( 5 ) ) )->getInt() == -5 && updated.find( Value( 0.5 ) )->isTrue() ? 0 : 1;
+    result += config.find( Value( int32( 5 ) ) )->getInt() == 10 && config.find( Value( 0.5 ) ) == nullptr ? 0 : 1;
+    result += trimmed.getSize() == size_t( MapSize - 1 ) && trimmed.find( Value( int32( 5 ) ) ) == nullptr && trimmed.find( Value( int32( 7 ) ) )->getInt() == 14 ? 0 : 1;
+
+    PersistentMap::Transient editor( trimmed );
+    for( int32 i = 0; i < MapSize; i += 2 )
+    {
+        editor.remove( Value( i ) );
+    }
+    PersistentMap odd = editor.freeze();
+    result += odd.getSize() == size_t( MapSize / 2 ) && odd.find( Value( int32( 8 ) ) ) == nullptr && odd.find( Value( int32( 9 ) ) )->getInt() == 18 ? 0 : 1;
+    result += trimmed.find( Value( int32( 8 ) ) )->getInt() == 16 ? 0 : 1;
+
+    // value semantics: copies share until written, a holder that is alone writes in place
+    auto scaled = []( Array values, int32 factor )
+    {
+        Value* data = values.getMutableValues();
+        for( size_t i = 0; i < values.getSize(); ++i )
+        {
+            data[ i ] = Value( data[ i ].getInt() * factor );
+        }
+        return values;
+    };
+
+    Array numbers;
+    for( int32 i = 0; i < 1000; ++i )
+    {
+        numbers.push( Value( i ) );
+    }
+    uint64 unshared = Array::getUnshareCount();
+
+    Array copy = numbers;
+    result += copy.isShared() && numbers.isShared() ? 0 : 1;
+    for( size_t i = 0; i < copy.getSize(); ++i )
+    {
+        copy.set( i, Value( int32( -1 ) ) );
+    }
+    result += Array::getUnshareCount() == unshared + 1 && !copy.isShared() && numbers.get( 10 ).getInt() == 10 ? 0 : 1;
+
+    // a caller that still needs its array pays one copy, one that hands it over pays none
+    Array tripled = scaled( numbers, 3 );
+    result += Array::getUnshareCount() == unshared + 2 && numbers.get( 10 ).getInt() == 10 && tripled.get( 10 ).getInt() == 30 ? 0 : 1;
+    Array doubled = scaled( std::move( numbers ), 2 );
+    result += Array::getUnshareCount() == unshared + 2 && doubled.get( 999 ).getInt() == 1998 ? 0 : 1;
+
+    // a bulk load moves onto its own mapping once and then grows by remapping, copies of it still copy
+    constexpr int32 BulkSize = 3000000;
+    uint64 remapped = Array::getRemapCount();
+    Array bulk;
+    for( int32 i = 0; i < BulkSize; ++i )
+    {
+        bulk.push( Value( i ) );
+    }
+    result += bulk.isMapped() && Array::getRemapCount() > remapped && bulk.getCapacity() - bulk.getSize() < Array::MappedGrowth / sizeof( Value ) ? 0 : 1;
+    result += bulk.get( 0 ).getInt() == 0 && bulk.get( BulkSize - 1 ).getInt() == BulkSize - 1 ? 0 : 1;
+
+    Array snapshot = bulk;
+    bulk.push( Value( BulkSize ) );
+    result += Array::getUnshareCount() == unshared + 3 && snapshot.getSize() == size_t( BulkSize ) && bulk.get( BulkSize ).getInt() == BulkSize ? 0 : 1;
+
+    // sorted by keys or by comparison, the result has to match a plain comparison sort bit for bit
+    uint64 seed = 0x9e3779b97f4a7c15ull;
+    auto random = [ & ]()
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+    };
+    auto check = [ & ]( Array values, ArraySort::Method method )
+    {
+        std::vector<Value> expected( values.begin(), values.end() );
+        std::sort( expected.begin(), expected.end(), ArraySort::isBefore );
+        return ArraySort::sort( values ) == method && values.getSize() == expected.size()
+            && std::memcmp( values.begin(), expected.data(), expected.size() * sizeof( Value ) ) == 0 ? 0 : 1;
+    };
+
+    Array ints;
+    Array uints;
+    Array floats;
+    Array doubles;
+    Array mixed;
+    for( int32 i = 0; i < 100000; ++i )
+    {
+        uint64 bits = random();
+        ints.push( Value( int32( bits ) ) );
+        uints.push( Value( uint32( bits >> 32 ) ) );
+        floats.push( Value( float( int32( bits ) ) / 1024.0f ) );
+        doubles.push( Value( double( int64( bits ) ) * 1e-9 ) );
+        switch( bits % 5 )
+        {
+            case 0: mixed.push( Value( int32( bits % 100 ) - 50 ) ); break;
+            case 1: mixed.push( Value( double( bits % 1000 ) / 10.0 - 50.0 ) ); break;
+            case 2: mixed.push( Value( bool( bits & 8 ) ) ); break;
+            case 3: mixed.push( Value( nullptr ) ); break;
+            default: mixed.push( Value( float( bits % 64 ) ) ); break;
+        }
+    }
+    for( float special : { -0.0f, 0.0f, 1.0f / 0.0f, -1.0f / 0.0f } )
+    {
+        floats.push( Value( special ) );
+        doubles.push( Value( double( special ) ) );
+    }
+
+    result += check( ints, ArraySort::Method::Keyed );
+    result += check( uints, ArraySort::Method::Keyed );
+    result += check( floats, ArraySort::Method::Keyed );
+    result += check( doubles, ArraySort::Method::Keyed );
+    result += check( Array { Value( 3 ), Value( -1 ), Value( 2 ) }, ArraySort::Method::Keyed );
+    result += check( mixed, ArraySort::Method::Compared );
+
+    // already ordered, reversed and all equal inputs are the cases a quicksort goes quadratic on
+    Array ascending;
+    Array descending;
+    Array same;
+    for( int32 i = 0; i < 50000; ++i )
+    {
+        ascending.push( i % 2 == 0 ? Value( i ) : Value( double( i ) ) );
+        descending.push( i % 2 == 0 ? Value( -i ) : Value( -double( i ) ) );
+        same.push( i % 2 == 0 ? Value( 1 ) : Value( 1.0 ) );
+    }
+    result += check( ascending, ArraySort::Method::Compared );
+    result += check( descending, ArraySort::Method::Compared );
+    result += check( same, ArraySort::Method::Compared );
+
+    // one pass with no intermediate arrays has to agree with running the stages eagerly one after another
+    Array readings;
+    for( int32 i = 0; i < 100000; ++i )
+    {
+        readings.push( i % 7 == 0 ? Value( double( i ) * 0.5 ) : Value( i ) );
+    }
+    auto triple = []( Value value ) { return Instruction::evaluate( Instruction::evaluate( value, value ), value ); };
+    auto even = []( Value value ) { return value.isInt() ? value.getInt() % 2 == 0 : value.getDouble() < 1000.0; };
+
+    Array tripled_readings;
+    for( const Value& value : readings )
+    {
+        tripled_readings.push( triple( value ) );
+    }
+    Array kept_readings;
+    for( const Value& value : tripled_readings )
+    {
+        if( even( value ) )
+        {
+            kept_readings.push( value );
+        }
+    }
+    Array incremented_readings;
+    for( const Value& value : kept_readings )
+    {
+        incremented_readings.push( Instruction::evaluate( value, Value( 1 ) ) );
+    }
+    Value eager_sum( int32( 0 ) );
+    for( const Value& value : incremented_readings )
+    {
+        eager_sum = Instruction::evaluate( eager_sum, value );
+    }
+
+    uint64 unshared_before = Array::getUnshareCount();
+    auto fused = Pipeline( readings ).map( triple ).filter( even );
+    static_assert( decltype( fused )::StageCount == 0, "map and filter fuse into the pending element stage" );
+    static_assert( decltype( fused.add( Value( 1 ) ) )::StageCount == 2, "a span stage closes the element stage" );
+    Value lazy_sum = fused.add( Value( 1 ) ).sum();
+    result += std::memcmp( &lazy_sum, &eager_sum, sizeof( Value ) ) == 0 && lazy_sum.isDouble() ? 0 : 1;
+    result += fused.count() == kept_readings.getSize() && Array::getUnshareCount() == unshared_before ? 0 : 1;
+
+    Array collected = fused.collect();
+    result += collected.getSize() == kept_readings.getSize()
+        && std::memcmp( collected.begin(), kept_readings.begin(), collected.getSize() * sizeof( Value ) ) == 0 ? 0 : 1;
+    Value folded = fused.reduce( Value( int32( 0 ) ), []( Value total, Value value ) { return Instruction::evaluate( total, value ); } );
+    Value reduced = Instruction::reduce( Value( int32( 0 ) ), kept_readings.begin(), kept_readings.getSize() );
+    result += std::memcmp( &folded, &reduced, sizeof( Value ) ) == 0 ? 0 : 1;
+
+    // the span kernels give what adding one value at a time gives, typed spans and mixed ones alike
+    Array floats_only = Pipeline( floats ).collect();
+    Value one_by_one( 0.0f );
+    for( const Value& value : floats_only )
+    {
+        one_by_one = Instruction::evaluate( one_by_one, value );
+    }
+    Value spanned = Pipeline( floats ).sum();
+    Value from_float = Instruction::reduce( Value( 0.0f ), floats_only.begin(), floats_only.getSize() );
+    result += std::memcmp( &from_float, &one_by_one, sizeof( Value ) ) == 0 && spanned.isFloat() ? 0 : 1;
+    result += Pipeline( Array {} ).sum().getInt() == 0 && Pipeline( Array { Value( 2 ), Value( 3u ) } ).add( Value( 1.5f ) ).sum().getFloat() == 8.0f ? 0 : 1;
+
+    // parallel results do not depend on the number of workers, and agree with a serial run where the order of
+    // the additions does not matter
+    WorkerPool alone( 1 );
+    WorkerPool few( 3 );
+    WorkerPool many( 8 );
+    Array measurements;
+    Array counters;
+    for( int32 i = 0; i < 1000000; ++i )
+    {
+        uint64 bits = random();
+        measurements.push( Value( double( int64( bits ) ) * 1e-18 ) );
+        counters.push( Value( int32( bits ) ) );
+    }
+
+    Value serial_count = Instruction::reduce( Value( int32( 0 ) ), counters.begin(), counters.getSize() );
+    Value fast_count = ParallelArray::sum( counters, ParallelArray::SumMode::Fast, many );
+    result += serial_count.getInt() == fast_count.getInt() && fast_count.isInt() ? 0 : 1;
+
+    Value exact_alone = ParallelArray::sum( measurements, ParallelArray::SumMode::Deterministic, alone );
+    Value exact_few = ParallelArray::sum( measurements, ParallelArray::SumMode::Deterministic, few );
+    Value exact_many = ParallelArray::sum( measurements, ParallelArray::SumMode::Deterministic, many );
+    Value fast_many = ParallelArray::sum( measurements, ParallelArray::SumMode::Fast, many );
+    double serial_measurement = Instruction::reduce( Value( int32( 0 ) ), measurements.begin(), measurements.getSize() ).getDouble();
+    result += std::memcmp( &exact_alone, &exact_few, sizeof( Value ) ) == 0 && std::memcmp( &exact_few, &exact_many, sizeof( Value ) ) == 0 ? 0 : 1;
+    result += std::abs( fast_many.getDouble() - serial_measurement ) < 1e-6 && std::abs( exact_many.getDouble() - serial_measurement ) < 1e-6 ? 0 : 1;
+
+    auto larger = []( Value left, Value right ) { return left.getInt() < right.getInt() ? right : left; };
+    Value largest = ParallelArray::reduce( counters, Value( int32( INT32_MIN ) ), larger, few );
+    result += largest.getInt() == std::max_element( counters.begin(), counters.end(), []( Value left, Value right ) { return left.getInt() < right.getInt(); } )->getInt() ? 0 : 1;
+
+    Array shifted = ParallelArray::map( counters, []( Value value ) { return Instruction::evaluate( value, Value( 1.5 ) ); }, many );
+    Array shifted_serial;
+    for( const Value& value : counters )
+    {
+        shifted_serial.push( Instruction::evaluate( value, Value( 1.5 ) ) );
+    }
+    result += shifted.getSize() == shifted_serial.getSize()
+        && std::memcmp( shifted.begin(), shifted_serial.begin(), shifted.getSize() * sizeof( Value ) ) == 0 ? 0 : 1;
+
+    // merged pieces come out exactly like one sort over the whole array, keyed or compared
+    for( Array* unsorted : { &measurements, &mixed } )
+    {
+        Array serial = *unsorted;
+        Array parallel = *unsorted;
+        ArraySort::sort( serial );
+        ParallelArray::sort( parallel, many );
+        result += std::memcmp( serial.begin(), parallel.begin(), serial.getSize() * sizeof( Value ) ) == 0 ? 0 : 1;
+    }
+
+    return result;
+}
\ No newline at end of file